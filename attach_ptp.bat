@@ -14,6 +14,7 @@ attach ptp %1
 echo
 echo Use 'detach ptp' to close the file and commit the buffers
 echo (otherwise the file won't write completely)
+echo then use '"! dectape -p %1"' to convert it to a host text file
 echo
 cont
 
@@ -10,7 +10,7 @@ echo
 echo enter '"pip %1=PC:"' within PDP11 env to copy to the PDP
 echo
 detach ptr
-! if test -n "%1" ; then if test -e "%1" ; then crlf -m %1 ; fi ; fi
+! if test -n "%1" ; then if test -e "%1" ; then dectape -P %1 ; fi ; fi
 attach ptr %1
 echo
 echo Use 'detach ptr' to close the input file
@@ -18,12 +18,20 @@
 
 // this program reads/writes FSM formatted magtape data
 
+// tape images can be larger than 2Gb, so always use 64-bit file offsets
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE_SOURCE
+
+// for SEEK_DATA and SEEK_HOLE (sparse files)
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdarg.h> /* stdarg to make sure I have va_list and other important stuff */
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
 #include <dirent.h>
 #include <fnmatch.h>
@@ -31,6 +39,20 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/param.h>
+#include <limits.h>
+#include <sys/time.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif // __linux__
 
 
 
@@ -149,6 +171,8 @@ typedef union _RT11_FILE_EOF_
 
 
 
+#define TAPE_BUFSIZE (1024 * 1024) /* stdio buffer for the tape file */
+
 uint8_t DATA_MARKER[4]={0, 0, 0, 0};
 uint8_t TAPE_MARKER[4]={0, 2, 0, 0};
 
@@ -159,14 +183,100 @@ uint8_t TAPE_MARKER[4]={0, 2, 0, 0};
 
 int iVerbosity = 0; // debug output
 
+// the separator for a file list from stdin, a new line or (with '-0') a NUL
+char cFileListSeparator = '\n';
+
+// file extensions that are converted as text when '-t' is specified (see '-T')
+const char *szTextExtensions = "TXT,MAC,FOR,FTN,BAS,PAS,C,H,LST,MAP,CTL,COM,BAT,DOC,MEM,HLP,RNO,INI,DIR";
+
+typedef struct _TEXT_CONVERT_
+{
+  int bToRT11; // non-zero to convert host text to RT11, zero for RT11 to host
+  int bCR;     // a <CR> was the last thing in the previous buffer
+  int bEnd;    // a ^Z was found, end of text
+} TEXT_CONVERT;
+
+#define OUTPUT_BUFSIZE (256 * 1024) /* write buffer for extracted files */
+#define OUTPUT_HOLE_MIN 4096 /* zero blocks in a run at least this long are left as a hole */
+
+typedef struct _OUTPUT_FILE_
+{
+  int iFD;       // file descriptor, -1 if not open
+  uint8_t *pBuf; // write buffer, OUTPUT_BUFSIZE bytes
+  size_t cbBuf;  // bytes in 'pBuf'
+  off_t lSize;   // bytes written to the file so far (not including 'pBuf')
+  off_t lHole;   // zero bytes after 'pBuf' that have not been written yet
+} OUTPUT_FILE;
+
+// a volume set is a series of tape files, 'tape', 'tape.002', 'tape.003' and so on,
+// that are read and written as one logical tape (see '-M')
+typedef struct _VOLUME_SET_
+{
+  const char *szTapeFileName; // the first volume
+  int iVolume;                // the current volume, starting at 1
+  int iDriveSize;             // size of each volume (in MB)
+  const char *szLabel;        // label for new volumes
+  off_t lPos;                 // write position on the current volume
+} VOLUME_SET;
+
+// the journal 'tapefile.jnl' records the last file that was completely extracted from
+// (or written to) a tape, so that a run that fails part way through can be resumed (see '-r')
+typedef struct _JOURNAL_
+{
+  char szFileName[PATH_MAX];  // the journal file
+  int bCreate;                // non-zero when writing the tape, zero when extracting
+  int bResume;                // non-zero to resume after the last file in the journal
+  off_t lPos;                 // tape position after the last file (where the next one starts)
+  int iVolume;                // volume for 'lPos'
+  int iSeq;                   // sequence number of the last file
+  char szName[PATH_MAX];      // host file name of the last file
+  int bWarned;                // a journal write failed (and I said so)
+
+  int bPending;               // a commit that isn't permanent yet (see 'commit_tape_files()')
+  off_t lPending;
+  int iPendingSeq;
+  char szPending[PATH_MAX];
+} JOURNAL;
+
 int QueryYesNo(const char *szMessage); // returns non-zero for yes, zero for no
 
 int read_the_tape(FILE *pTape, const char *szTapeFileName, const char *pOutPath,
-                  int bDirectory, int bOverwrite, int bConfirm, int bValidate, int bFindEndOfTape, int *piSeq);
+                  int bDirectory, int bOverwrite, int bConfirm, int bValidate, int bFindEndOfTape, int *piSeq,
+                  int bTextMode, VOLUME_SET *pVS, JOURNAL *pJ);
 int read_tape_block(FILE *pTape, void *pHeader); // always 512 byte blocks plus leading/trailing 'TAPE_MARKER'
 int write_tape_block(FILE *pTape, void *pHeader); // always 512 byte blocks plus leading/trailing 'TAPE_MARKER'
-int write_single_file_to_tape(FILE *pTape, const char *szFileName, int *pnFileSeqNum);
-int write_the_tape(FILE *pTape, const char *pTapeFileName, const char *pInputName, int bAppend, int iDriveSize, const char *szLabel);
+int write_end_of_tape(FILE *pTape);
+char *make_output_file_name(const char *pFileIdentifier, char *pBuf, int cbBuf);
+int do_open_output_file(int iOutDir, const char *pOutPath, const char *pFileIdentifier,
+                        int bOverwrite, int bConfirm, char *szName, int cbName);
+int output_file_flush(OUTPUT_FILE *pOF);
+int output_file_write(OUTPUT_FILE *pOF, const void *pData, size_t cbData);
+int output_file_skip(OUTPUT_FILE *pOF, size_t cbData);
+int output_file_fill_hole(OUTPUT_FILE *pOF);
+int is_zero_block(const uint8_t *pData, int cbData);
+int find_file_data(int iFD, off_t lPos, off_t lFileSize, off_t *plData, off_t *plDataEnd);
+int output_file_close(OUTPUT_FILE *pOF, int bTrimLastBlock, const char *pCreationDate);
+int write_single_file_to_tape(FILE *pTape, const char *szFileName, int *pnFileSeqNum, int bTextMode,
+                              VOLUME_SET *pVS, int bHoldCommit, const char *szTapeName, uint64_t *pqwTextHash);
+int read_file_list_entry(FILE *pList, char *pPath, int cbPath, char *pTapeName, int cbTapeName,
+                         unsigned long *pdwMode);
+int commit_tape_files(FILE *pTape, off_t lCommit, JOURNAL *pJ, int iSeq, const char *szLastFile);
+int write_next_file_section(FILE *pTape, RT11_FILE_HEADER *pFile, RT11_FILE_EOF *pEOF, int nBlocks,
+                            VOLUME_SET *pVS, int bNextVolume);
+int write_file_data_block(FILE *pTape, RT11_FILE_HEADER *pFile, RT11_FILE_EOF *pEOF,
+                          void *pBlock, int *pnSectionBlocks, VOLUME_SET *pVS);
+int next_section_follows(FILE *pTape, const RT11_FILE_HEADER *pFile, VOLUME_SET *pVS);
+int write_the_tape(FILE *pTape, const char *pTapeFileName, const char *pInputName, int bAppend, int iDriveSize, const char *szLabel,
+                   int bTextMode, VOLUME_SET *pVS, JOURNAL *pJ, int nCommitGroup, const char *szOrder, int bVerify);
+
+// volume sets
+char *volume_file_name(const VOLUME_SET *pVS, int iVolume, char *pBuf, int cbBuf);
+int open_volume(FILE *pTape, VOLUME_SET *pVS, int iVolume, const char *szMode);
+
+// checkpoint journal
+int journal_init(JOURNAL *pJ, const char *szTapeFileName, int bCreate, int bResume);
+int journal_write(JOURNAL *pJ, FILE *pTape, off_t lPos, int iVolume, int iSeq, const char *szName);
+void journal_remove(JOURNAL *pJ);
 
 int days_since_year_start(int iYear, int iMonth, int iDay);
 void mdy_from_days_since_year_start(int iYear, int nDays, int *piMonth, int *piDay);
@@ -176,12 +286,109 @@ void format_rt11_file_name(const char *szSourceFile, char *pBuf, int cbBuf);
 
 int do_initialize_tape(FILE *pTape, const char *szFileName, int iDriveSize, const char *pLabel);
 int initialize_tape(const char *szFileName, int iDriveSize, int bOverwrite, const char *pLabel);
+int fit_tape_size(FILE *pTape, const char *szFileName, off_t lEndOfTape, int cbHeadroom);
+int shrink_tape(const char *szFileName, int cbHeadroom);
+int grow_tape(const char *szFileName, int iDriveSize);
+
+// text conversion, including paper tape (PTR/PTP)
+const uint8_t *find_first_of(const uint8_t *p1, const uint8_t *pEnd, const char *pMatch, int nMatch);
+size_t text_convert(TEXT_CONVERT *pTC, const uint8_t *pIn, size_t cbIn, uint8_t *pOut);
+int is_text_file_name(const char *szFileName);
+int is_text_data(const uint8_t *pData, int cbData);
+int paper_tape_convert(const char *szInput, const char *szOutput, int bToReader);
+
+// line printer (LPT) capture file follow mode
+int follow_printer_file(const char *szCaptureFile, const char *szOutDir);
+
+// keeping a tape up to date with a directory
+int watch_directory(const char *szDir, const char *szTape, int iDriveSize, const char *szLabel, int bTextMode);
+
+// parallel work (threads)
+int run_in_parallel(int nThreads, int nItems, void (*pfnWork)(void *pContext, int iItem), void *pContext);
+int default_thread_count(void);
+
+// reading all of the files on a tape
+typedef struct _TAPE_WALK_ TAPE_WALK;
+int walk_tape(FILE *pTape, TAPE_WALK *pW);
+int is_next_file_section(const RT11_FILE_HEADER *pPrev, const RT11_FILE_HEADER *pFile);
+
+// tape catalog
+int catalog_build(const char *szCatalog, char * const *pPaths, int nPaths, int nThreads);
+int catalog_query(const char *szCatalog, const char *szName, const char *szDates);
+uint16_t rad50_word(const char *pText, int cbText);
+void rad50_file_name(const char *pName, int cbName, uint16_t wName[3]);
+char *rad50_to_file_name(const uint16_t wName[3], char *pBuf);
+int rad50_name_compare(const uint16_t wName1[3], const uint16_t wName2[3]);
+
+// searching the files on tapes
+int search_tapes(const char *szPattern, char * const *pTapes, int nTapes, int nThreads);
+
+// comparing tapes
+int diff_tapes(const char *szTape1, const char *szTape2, int nThreads);
+int write_manifests(char * const *pTapes, int nTapes, int nThreads);
+uint64_t fnv1a_hash(uint64_t qwHash, const uint8_t *pData, size_t cbData);
+#define FNV1A_HASH_INIT 0xcbf29ce484222325ULL
+
+// salvaging damaged tapes
+int salvage_tape(const char *szTapeFile, const char *pOutPath, int bOverwrite, int bConfirm, int nThreads);
+int is_tape_record(const uint8_t *pTape, off_t cbTape, off_t lPos);
+off_t find_tape_record(const uint8_t *pTape, off_t cbTape, off_t lStart, off_t lEnd);
+typedef struct _LABEL_MARK_ LABEL_MARK;
+int find_label_records(const uint8_t *pTape, off_t cbTape, int nThreads, LABEL_MARK **ppMarks);
+
+// validating a tape in parallel
+int validate_tape_parallel(const char *szTapeFile, int nThreads);
+
+// archive store (data that's the same on more than one tape is only stored once)
+int archive_tapes(const char *szStore, char * const *pTapes, int nTapes, int nThreads);
+int archive_rebuild(const char *szStore, const char *szName, const char *szTapeFile);
+
+// tape layout (the order files are written in) and the cost report
+typedef struct _LAYOUT_LIST_ LAYOUT_LIST;
+LAYOUT_LIST *layout_sort_directory(const char *szDirSpec, const char *szOrder);
+int layout_next_entry(LAYOUT_LIST *pL, char *szNameReturn, int cbNameReturn, unsigned long *pdwModeAttrReturn);
+void layout_destroy_list(LAYOUT_LIST *pL);
+int layout_report(const char *szTapeFile, const char *szOrder);
+
+// tape index, and the tape server
+typedef struct _TAPE_INDEX_ TAPE_INDEX;
+int tape_index_build(FILE *pTape, TAPE_INDEX *pI);
+int tape_index_scan(int iFD, TAPE_INDEX *pI);
+void tape_index_free(TAPE_INDEX *pI);
+int tape_index_find(const TAPE_INDEX *pI, const char *szPattern, int iBefore);
+int tape_index_stat(const TAPE_INDEX *pI, const char *szPattern, FILE *pOut);
+int tape_index_first_section(const TAPE_INDEX *pI, int iEntry);
+int serve_tapes(const char *szSocket);
+int server_request(const char *szCommand, const char *szTape, const char *szArg, int iFD, FILE *pOut);
+int extract_matching_files(const char *szTapeFile, const char *szPattern, const char *szOutDir,
+                           int bOverwrite, int bConfirm);
+int stat_tape_files(const char *szTapeFile, const char *szPattern);
+int cat_tape_file(const char *szTapeFile, const char *szName);
+int append_files_to_server(const char *szDir, const char *szTapeFile);
+
+// tape merge and split
+int merge_copy_range(int iInFD, off_t lIn, int iOutFD, off_t lOut, off_t cbCopy);
+off_t merge_end_tape(int iOutFD, const char *szOutput, off_t lOut, int iDriveSize, int cbHeadroom);
+int merge_tapes(const char *szOutput, char * const *pTapes, int nTapes, int iDriveSize,
+                const char *szLabel, int cbHeadroom);
+int split_tape(const char *szTapeFile, const char *szSelect, const char *szOutput,
+               int bOverwrite, int bConfirm, int iDriveSize, const char *szLabel, int cbHeadroom);
+
+// read after write verification
+typedef struct _VERIFY_ VERIFY;
+VERIFY *verify_start(const char *szTapeFile);
+int verify_add(VERIFY *pV, const char *szFileName, off_t lStart, off_t lEnd, uint64_t qwTextHash);
+void verify_commit(VERIFY *pV);
+int verify_finish(VERIFY *pV);
 
 // file utilities (some are derived code from 'ForkMe')
 int FileExists(const char *szFileName);
 int IsDirectory(const char *szFileName);
+uint64_t stat_fingerprint(const struct stat *pSt);
 int get_file_RT11_date_time(const char *szFileName, int *pnRTYear, int *pnRTDay);
+time_t rt11_date_to_time(int nRTYear, int nRTDay);
 int set_file_RT11_date_time(const char *szFileName, int nRTYear, int nRTDay);
+int set_fd_RT11_date_time(int iFD, int nRTYear, int nRTDay);
 void *WBAllocDirectoryList(const char *szDirSpec);
 void WBDestroyDirectoryList(void *pDirectoryList);
 int WBNextDirectoryEntry(void *pDirectoryList, char *szNameReturn, int cbNameReturn, unsigned long *pdwModeAttrReturn);
@@ -193,8 +400,28 @@ void usage()
   fputs("USAGE:\n"
         "  dectape -h\n"
         "  dectape [-v] tapefile\n"
-        "  dectape tapefile directory\n"
-        "  dectape directory tapefile\n"
+        "  dectape [-r|-J] tapefile directory\n"
+        "  dectape [-r|-J] [-w] directory tapefile\n"
+        "  dectape [-0] - tapefile < filelist\n"
+        "  dectape -P|-p textfile [outfile]\n"
+        "  dectape -F lptfile directory\n"
+        "  dectape -W directory tapefile\n"
+        "  dectape -C catalog [-j threads] tapefile|directory [...]\n"
+        "  dectape -C catalog [-f name] [-d date[:date]]\n"
+        "  dectape -G string [-j threads] tapefile [...]\n"
+        "  dectape -D tapefile1 tapefile2\n"
+        "  dectape -K tapefile [...]\n"
+        "  dectape -R [-j threads] tapefile [directory]\n"
+        "  dectape -X [-H headroom] tapefile [...]\n"
+        "  dectape -E -S size tapefile\n"
+        "  dectape -Z store [-j threads] [tapefile ...]\n"
+        "  dectape -e store name tapefile\n"
+        "  dectape -m newtape tapefile [...]\n"
+        "  dectape -x files tapefile newtape|directory\n"
+        "  dectape -O size|orderfile [directory] tapefile\n"
+        "  dectape -f name tapefile [directory]\n"
+        "  dectape -c name tapefile\n"
+        "  dectape -Y socket\n"
         " where\n"
         " tapefile  a file that is (or will be) attached to a TMx device\n"
         " directory a directory to/from which to write files\n"
@@ -203,12 +430,71 @@ void usage()
         " -n        do not overwrite existing files (the default)\n"
         " -o        DO overwrite existing files\n"
         " -q        Do not prompt to overwrite files or create a directory\n"
-        " -V        validates a tape (rather than printing the directory)\n"
+        " -V        validates a tape (rather than printing the directory).  The\n"
+        "           files on the tape are checked in parallel (see '-j').\n"
         " -A        append to the tape, rather than overwriting\n"
         "           (this can put duplicate file names on the tape)\n"
+        " -s        Crash safe writing, in groups of 'n' files.  Each group is synced\n"
+        "           and then added to the tape all at once, so a crash leaves either\n"
+        "           the tape as it was or with all of the files in the group\n"
+        " -w        Verify each file after it's written to the tape, by reading it\n"
+        "           back and comparing it to the file it came from\n"
         " -I        Initialize a new tape file\n"
-        " -S        Specify the size for a new tape file (in MB)\n"
+        " -S        Specify the size for a new tape file (in MB).  With '-S 0' it's\n"
+        "           only as big as the files on it (plus the '-H' headroom)\n"
+        " -H        Headroom (in KB) to leave after the end of the tape with '-S 0'\n"
+        "           or '-X'\n"
+        " -X        Shrink tape files to just past the end of the tape\n"
+        " -E        Extend ('grow') a tape file to the '-S' size\n"
         " -L        Specify the label for a new tape file\n"
+        " -M        Multi-volume tape set.  Writing starts 'tapefile.002', '.003' etc.\n"
+        "           when a volume reaches the '-S' size, and reading continues\n"
+        "           through all of the volumes as one tape\n"
+        " -t        Convert text files (CRLF <-> LF) when copying to/from a tape\n"
+        " -T        Same as '-t' with a list of text file extensions, i.e. 'TXT,MAC'\n"
+        "           (other files are converted if the first block looks like text)\n"
+        " -P        Convert a host text file for the paper tape reader (PTR)\n"
+        " -p        Convert paper tape punch (PTP) output to a host text file\n"
+        "           (with no 'outfile', the text file is converted in place)\n"
+        " -F        Follow a line printer (LPT) capture file, writing print jobs\n"
+        "           to 'directory' as they are printed\n"
+        " -W        Watch a directory, keeping 'tapefile' up to date as files in\n"
+        "           it are changed (only the changed files are added to the tape)\n"
+        " -C        Build or update a catalog of the files on tapes (or all of the\n"
+        "           tapes in a directory).  With no tapes, look files up in it.\n"
+        " -f        File name (or wildcard pattern) to look up in the catalog, or on\n"
+        "           a tape (copying just those files when there's a 'directory')\n"
+        " -c        Write a file on a tape to stdout (the last one, if the name is\n"
+        "           on the tape more than once)\n"
+        " -d        Date or date range to look up, 'YYYY[-MM[-DD]][:YYYY[-MM[-DD]]]'\n"
+        " -G        Search the files on tapes for a string, printing the tape,\n"
+        "           file name, and position in the file for each match\n"
+        " -D        List the files that were added, removed, or changed between\n"
+        "           two tapes\n"
+        " -K        Write a checksum manifest 'tapefile.sum' for each tape (used by '-D')\n"
+        " -J        Keep a journal 'tapefile.jnl' of the last file that was completed\n"
+        "           while copying a tape to a directory (or a directory to a tape),\n"
+        "           so that '-r' can resume it.  '-s' and '-r' always keep one\n"
+        " -r        Resume copying a tape to a directory (or a directory to a tape)\n"
+        "           after the last file that was completed, from 'tapefile.jnl'\n"
+        " -R        Salvage a damaged tape, listing (or copying to 'directory') every\n"
+        "           file that can be recovered, and the damaged regions\n"
+        " -Z        Add tapes to an archive store, where data that is the same on\n"
+        "           more than one tape is only stored once (with no tapes, list them)\n"
+        " -e        Rebuild tape file 'name' from an archive store, exactly as it was\n"
+        " -m        Merge tapes into 'newtape', copying the files as they are (the\n"
+        "           files are renumbered, and the first tape's volume header is kept)\n"
+        " -x        Copy some of the files on a tape to 'newtape', or each of them to\n"
+        "           its own tape in 'directory'.  'files' is a list of sequence numbers,\n"
+        "           ranges, and names (or wildcard patterns), i.e. '1-4,9,*.MAC'\n"
+        " -O        Write the files in order by size (smallest first), or by an\n"
+        "           order file (a list of names, or a log of the files used), and\n"
+        "           report how long each file takes to load in the emulator\n"
+        " -Y        Run a tape server on 'socket', that keeps the directory of each tape\n"
+        "           it reads.  Set DECTAPE_SOCKET to 'socket' to have 'dectape' use it.\n"
+        " -0        The file list on stdin (with '-' for the directory) is separated\n"
+        "           by NUL characters instead of new lines\n"
+        " -j        Number of threads to use (default is one per CPU)\n"
         "\n"
         "To list the file directory of a tape, use\n"
         "    dectape tapefile\n"
@@ -239,12 +525,41 @@ int bConfirm = 1;
 int bValidate = 0;
 int bInitialize = 0;
 int iDriveSize = 32;
+int iPaperTape = 0; // 1 for '-P' (to PTR), -1 for '-p' (from PTP)
+int bFollow = 0;
+int bTextMode = 0;
+int bVolumeSet = 0;
+VOLUME_SET vs;
+const char *szCatalog = NULL;
+const char *szFind = NULL;
+const char *szDates = NULL;
+const char *szSearch = NULL;
+int bDiff = 0;
+int bManifest = 0;
+int bSalvage = 0;
+int bResume = 0;
+int bJournal = 0;
+int nCommitGroup = 0;
+int cbHeadroom = 0;
+const char *szOrder = NULL;
+const char *szServe = NULL;
+const char *szSplit = NULL;
+const char *szCat = NULL;
+int bShrink = 0;
+int bGrow = 0;
+int bWatch = 0;
+int bArchive = 0;
+int bRebuild = 0;
+int bMerge = 0;
+int bVerify = 0;
+JOURNAL jnl;
+int nThreads = default_thread_count();
 
 
   // demo - do a directory of the tape
 
   // get options using 'getopt' so it behaves like every OTHER 'POSIX' utility
-  while((i1 = getopt(argc, argv, "hvVqonAIS:L:"))
+  while((i1 = getopt(argc, argv, "hvVqonAIS:L:MPpFtT:C:f:d:j:G:DKRrJs:H:XEWZeO:Y:0mx:c:w"))
         != -1)
   {
     switch(i1)
@@ -300,18 +615,390 @@ int iDriveSize = 32;
         }
 
         break;
+
+      case 'M':
+        bVolumeSet = 1;
+        break;
+
+      case 'P':
+        iPaperTape = 1;
+        break;
+
+      case 'p':
+        iPaperTape = -1;
+        break;
+
+      case 'F':
+        bFollow = 1;
+        break;
+
+      case 't':
+        bTextMode = 1;
+        break;
+
+      case 'T':
+        bTextMode = 1;
+        szTextExtensions = optarg;
+        break;
+
+      case 'C':
+        szCatalog = optarg;
+        break;
+
+      case 'f':
+        szFind = optarg;
+        break;
+
+      case 'd':
+        szDates = optarg;
+        break;
+
+      case 'G':
+        szSearch = optarg;
+        break;
+
+      case 'D':
+        bDiff = 1;
+        break;
+
+      case 'K':
+        bManifest = 1;
+        break;
+
+      case 'R':
+        bSalvage = 1;
+        break;
+
+      case 'r':
+        bResume = 1;
+        break;
+
+      case 'J':
+        bJournal = 1;
+        break;
+
+      case 's':
+        nCommitGroup = atoi(optarg);
+
+        if(nCommitGroup < 1)
+          nCommitGroup = 1;
+
+        break;
+
+      case 'H':
+        cbHeadroom = atoi(optarg) * 1024;
+
+        if(cbHeadroom < 0)
+          cbHeadroom = 0;
+
+        break;
+
+      case 'X':
+        bShrink = 1;
+        break;
+
+      case 'E':
+        bGrow = 1;
+        break;
+
+      case 'W':
+        bWatch = 1;
+        break;
+
+      case 'Z':
+        bArchive = 1;
+        break;
+
+      case 'O':
+        szOrder = optarg;
+        break;
+
+      case 'Y':
+        szServe = optarg;
+        break;
+
+      case '0':
+        cFileListSeparator = 0;
+        break;
+
+      case 'e':
+        bRebuild = 1;
+        break;
+
+      case 'm':
+        bMerge = 1;
+        break;
+
+      case 'x':
+        szSplit = optarg;
+        break;
+
+      case 'c':
+        szCat = optarg;
+        break;
+
+      case 'w':
+        bVerify = 1;
+        break;
+
+      case 'j':
+        nThreads = atoi(optarg);
+
+        if(nThreads < 1)
+          nThreads = 1;
+
+        break;
     }
   }
 
   argc -= optind;
   argv += optind;
 
+  if(szCatalog)
+  {
+    iRval = 0;
+
+    if(argc > 0)
+      iRval = catalog_build(szCatalog, argv, argc, nThreads);
+
+    if(!iRval && (argc == 0 || szFind || szDates))
+      iRval = catalog_query(szCatalog, szFind, szDates);
+
+    return iRval;
+  }
+
+  if(szSearch)
+  {
+    if(argc < 1)
+    {
+      usage();
+      exit(1);
+    }
+
+    return search_tapes(szSearch, argv, argc, nThreads);
+  }
+
+  if(bDiff)
+  {
+    if(argc != 2)
+    {
+      fprintf(stderr, "Diff needs two tape files\n");
+      usage();
+      exit(1);
+    }
+
+    return diff_tapes(argv[0], argv[1], nThreads);
+  }
+
+  if(bManifest)
+  {
+    if(argc < 1)
+    {
+      usage();
+      exit(1);
+    }
+
+    return write_manifests(argv, argc, nThreads);
+  }
+
+  if(bShrink)
+  {
+    if(argc < 1)
+    {
+      usage();
+      exit(1);
+    }
+
+    for(i1=0, iRval=0; i1 < argc; i1++)
+    {
+      if(shrink_tape(argv[i1], cbHeadroom))
+        iRval = 1;
+    }
+
+    return iRval;
+  }
+
+  if(bGrow)
+  {
+    if(argc != 1 || iDriveSize <= 0)
+    {
+      fprintf(stderr, "Grow needs one tape file and a size ('-S')\n");
+      usage();
+      exit(1);
+    }
+
+    return grow_tape(argv[0], iDriveSize);
+  }
+
+  if(bSalvage)
+  {
+    if(argc < 1 || argc > 2)
+    {
+      usage();
+      exit(1);
+    }
+
+    if(argc > 1 && !IsDirectory(argv[1]) && mkdir(argv[1], 0777))
+    {
+      fprintf(stderr, "Unable to create directory \"%s\" - errno=%d (%xH)\n", argv[1], errno, errno);
+      exit(2);
+    }
+
+    return salvage_tape(argv[0], argc > 1 ? argv[1] : NULL, bOverwrite, bConfirm, nThreads);
+  }
+
+  if(bArchive)
+  {
+    if(argc < 1)
+    {
+      usage();
+      exit(1);
+    }
+
+    return archive_tapes(argv[0], argv + 1, argc - 1, nThreads) ? 1 : 0;
+  }
+
+  if(bRebuild)
+  {
+    if(argc != 3)
+    {
+      fprintf(stderr, "Rebuild needs an archive store, a tape name, and a tape file\n");
+      usage();
+      exit(1);
+    }
+
+    if(FileExists(argv[2]) && !bOverwrite && bConfirm && !QueryYesNo("Overwrite tape file"))
+      return 0;
+
+    return archive_rebuild(argv[0], argv[1], argv[2]) ? 1 : 0;
+  }
+
+  if(bMerge)
+  {
+    if(argc < 2)
+    {
+      fprintf(stderr, "Merge needs a new tape file and the tapes to put on it\n");
+      usage();
+      exit(1);
+    }
+
+    if(FileExists(argv[0]) && !bOverwrite && bConfirm && !QueryYesNo("Overwrite tape file"))
+      return 0;
+
+    return merge_tapes(argv[0], argv + 1, argc - 1, iDriveSize, szTapeLabel, cbHeadroom) ? 1 : 0;
+  }
+
+  if(szSplit)
+  {
+    if(argc != 2)
+    {
+      fprintf(stderr, "Split needs a tape file, and a new tape file or a directory\n");
+      usage();
+      exit(1);
+    }
+
+    return split_tape(argv[0], szSplit, argv[1], bOverwrite, bConfirm, iDriveSize, szTapeLabel, cbHeadroom) ? 1 : 0;
+  }
+
+  if(szOrder && argc == 1 && !IsDirectory(argv[0])) // the cost report for a tape
+    return layout_report(argv[0], szOrder) ? 1 : 0;
+
+  if(szServe)
+    return serve_tapes(szServe) ? 1 : 0;
+
+  if(szCat)
+  {
+    if(argc != 1)
+    {
+      fprintf(stderr, "Cat needs a file name and a tape file\n");
+      usage();
+      exit(1);
+    }
+
+    return cat_tape_file(argv[0], szCat) ? 1 : 0;
+  }
+
+  if(szFind && argc == 1) // look up files on a tape
+    return stat_tape_files(argv[0], szFind) ? 1 : 0;
+
+  if(szFind && argc == 2 && IsDirectory(argv[1])) // copy some of the files from a tape
+    return extract_matching_files(argv[0], szFind, argv[1], bOverwrite, bConfirm) ? 1 : 0;
+
   if(argc < 1)
   {
     usage();
     exit(1);
   }
 
+  if(iPaperTape)
+  {
+    if(argc > 2 || bInitialize || bAppend)
+    {
+      fprintf(stderr, "Invalid parameters for paper tape conversion\n");
+      usage();
+      exit(1);
+    }
+
+    if(argc > 1 && FileExists(argv[1]) && !bOverwrite && bConfirm && // '-q' overwrites it
+       !QueryYesNo("Overwrite output file"))
+    {
+      exit(0); // don't do it, but not an error either
+    }
+
+    return paper_tape_convert(argv[0], argc > 1 ? argv[1] : NULL, iPaperTape > 0);
+  }
+
+  if(bFollow)
+  {
+    if(argc != 2)
+    {
+      fprintf(stderr, "Follow mode needs a capture file and a directory\n");
+      usage();
+      exit(1);
+    }
+
+    return follow_printer_file(argv[0], argv[1]);
+  }
+
+  if(bWatch)
+  {
+    if(argc != 2 || !IsDirectory(argv[0]) || IsDirectory(argv[1]))
+    {
+      fprintf(stderr, "Watch mode needs a directory and a tape file\n");
+      usage();
+      exit(1);
+    }
+
+    return watch_directory(argv[0], argv[1], iDriveSize, szTapeLabel, bTextMode);
+  }
+
+  memset(&vs, 0, sizeof(vs));
+  vs.szTapeFileName = argc >= 2 && IsDirectory(argv[0]) ? argv[1] : argv[0];
+  vs.iVolume = 1;
+  vs.iDriveSize = iDriveSize;
+  vs.szLabel = szTapeLabel;
+
+  if(bVolumeSet && nCommitGroup)
+  {
+    fprintf(stderr, "Commit groups ('-s') can not be used with a volume set\n");
+    usage();
+    exit(1);
+  }
+
+  if(bVolumeSet && bVerify)
+  {
+    fprintf(stderr, "Verify ('-w') can not be used with a volume set\n");
+    usage();
+    exit(1);
+  }
+
+  if(bVolumeSet && iDriveSize <= 0)
+  {
+    fprintf(stderr, "Invalid drive size %d\n", iDriveSize);
+    usage();
+    exit(1);
+  }
+
   // see if one is a file, and one is a directory
   // if output file, make sure it does not exist unless 'overwrite'
   // if output dir, should it be empty??
@@ -329,14 +1016,34 @@ int iDriveSize = 32;
     {
       bDirectory = 0; // a flag for later on
     }
-    else if(!IsDirectory(argv[1]) && IsDirectory(argv[0]))
+    else if(!IsDirectory(argv[1]) && (IsDirectory(argv[0]) || !strcmp(argv[0], "-")))
     {
-      if(FileExists(argv[1]) && !bOverwrite && !bAppend && !QueryYesNo("Overwrite tape file"))
+      // a simple append can be done by the tape server, if it's running
+
+      if(bAppend && FileExists(argv[1]) && !bVolumeSet && !bResume && !nCommitGroup &&
+         !bTextMode && !szOrder && !bVerify && strcmp(argv[0], "-") &&
+         (iRval = append_files_to_server(argv[0], argv[1])) <= 0)
+      {
+        return iRval ? 1 : 0;
+      }
+
+      if(!strcmp(argv[0], "-") && FileExists(argv[1]) && !bOverwrite && !bAppend && !bResume)
+      {
+        fprintf(stderr, "Tape file \"%s\" exists - use '-o' to overwrite it (the file list is on stdin)\n", argv[1]);
+        exit(1);
+      }
+
+      if(journal_init(&jnl, argv[1], 1, bResume))
+      {
+        exit(1);
+      }
+
+      if(FileExists(argv[1]) && !bOverwrite && !bAppend && !bResume && !QueryYesNo("Overwrite tape file"))
       {
         exit(0); // don't do it, but not an error either
       }
 
-      if(bAppend && FileExists(argv[1]))
+      if((bAppend || bResume) && FileExists(argv[1]))
       {
         pTape = fopen(argv[1], "r+"); // open for read/write access
       }
@@ -352,7 +1059,20 @@ int iDriveSize = 32;
         exit(2);
       }
 
-      iRval = write_the_tape(pTape, argv[1], argv[0], bAppend, iDriveSize, szTapeLabel);
+      setvbuf(pTape, NULL, _IOFBF, TAPE_BUFSIZE);
+
+      iRval = write_the_tape(pTape, argv[1], argv[0], bAppend, iDriveSize, szTapeLabel, bTextMode,
+                             bVolumeSet ? &vs : NULL, bJournal || bResume || nCommitGroup ? &jnl : NULL,
+                             nCommitGroup, szOrder, bVerify);
+
+      // with '-S 0' the tape is only as big as it needs to be.  'write_the_tape()'
+      // leaves the file pointer at the end of tape marker.
+
+      if(!iRval && !iDriveSize && !bVolumeSet)
+        iRval = fit_tape_size(pTape, argv[1], ftello(pTape), cbHeadroom);
+
+      if(!iRval && szOrder && !bVolumeSet && !fflush(pTape))
+        layout_report(argv[1], szOrder);
 
       goto exit_point;
     }
@@ -373,17 +1093,37 @@ int iDriveSize = 32;
 
   // LIST TAPE DIRECTORY, VALIDATE, OR COPY TAPE TO DIRECTORY
 
-  pTape = fopen(argv[0], "r");
-  if(!pTape)
+  if(bValidate && bDirectory && !bVolumeSet && nThreads > 1 &&
+     !validate_tape_parallel(argv[0], nThreads))
   {
-    fprintf(stderr, "Unable to open tape file \"%s\"\n", argv[0]);
-    exit(2);
+    return 0; // otherwise, 'read_the_tape()' validates it (and reports the errors)
   }
 
-  iRval = read_the_tape(pTape, argv[0], (const char *)(bDirectory ? NULL : argv[1]),
-                        bDirectory, bOverwrite, bConfirm, bValidate, 0, NULL);
+  if(!bDirectory && journal_init(&jnl, argv[0], 0, bResume))
+  {
+    exit(1);
+  }
 
-exit_point:
+  if(bDirectory && !bValidate && !bVolumeSet &&
+     !server_request("LIST", argv[0], NULL, -1, stdout)) // the tape server has it already
+  {
+    return 0;
+  }
+
+  pTape = fopen(argv[0], "r");
+  if(!pTape)
+  {
+    fprintf(stderr, "Unable to open tape file \"%s\"\n", argv[0]);
+    exit(2);
+  }
+
+  setvbuf(pTape, NULL, _IOFBF, TAPE_BUFSIZE);
+
+  iRval = read_the_tape(pTape, argv[0], (const char *)(bDirectory ? NULL : argv[1]),
+                        bDirectory, bOverwrite, bConfirm, bValidate, 0, NULL, bTextMode,
+                        bVolumeSet ? &vs : NULL, bDirectory || !(bJournal || bResume) ? NULL : &jnl);
+
+exit_point:
   fclose(pTape);
   return iRval;
 }
@@ -465,10 +1205,12 @@ uint8_t marker[4];  // where to read the markers into
   return 0; // OK!
 }
 
+// NOTE:  this no longer writes an EOT after every block.  Re-positioning the file
+//        after every block flushes the stdio buffer, which makes large files very
+//        slow to write.  'write_end_of_tape()' does it once, after each file.
+
 int write_tape_block(FILE *pTape, void *pBlock)
 {
-size_t lPos;
-
   if(!pTape)
     return -1;
 
@@ -481,41 +1223,37 @@ size_t lPos;
   if(fwrite(TAPE_MARKER, 4, 1, pTape) != 1)
     return -4;
 
-  lPos = ftell(pTape); // where am I right now?
+  return 0; // OK!
+}
 
-  if(fwrite(DATA_MARKER, 4, 1, pTape) != 1 || // write two data markers here to mark EOT
-     fwrite(DATA_MARKER, 4, 1, pTape) != 1)
+// write a data marker to mark EOT, following the data marker after the EOF record,
+// and re-position the file just before it so the next file header overwrites it
+int write_end_of_tape(FILE *pTape)
+{
+  if(fwrite(DATA_MARKER, 4, 1, pTape) != 1)
     return -5;
 
-  if(fseek(pTape, lPos, SEEK_SET) < 0) // re-position just before data marker
+  if(fseeko(pTape, -4, SEEK_CUR) < 0) // re-position just before data marker
     return -6;
 
   return 0; // OK!
 }
 
-char *make_output_file_name(const char *pOutPath, const char *pFileIdentifier)
+// build the host file name (no path) for a tape file identifier, i.e. 'FOO   .MAC' -> 'FOO.MAC'
+// 'pBuf' should be at least 24 characters long
+char *make_output_file_name(const char *pFileIdentifier, char *pBuf, int cbBuf)
 {
-char *pRval;
 int i1;
 const char *p1, *p2, *pEnd;
+char tbuf[24];
 
-  pRval = (char *)malloc(PATH_MAX * 2 + 256);
-  if(!pRval)
-    return NULL;
-
-  strncpy(pRval, pOutPath, PATH_MAX);
-  i1 = strlen(pRval);
-
-  if(i1 > 0 && pRval[i1] != '/')
-    strcat(pRval, "/");
-
-  i1 = strlen(pRval);
+  i1 = 0;
 
   p1 = pFileIdentifier;  // up to 17
 
   pEnd = p1 + 17;
 
-  while(*p1 && *p1 > ' ')
+  while(*p1 && *p1 > ' ' && p1 < pEnd)
     p1++;
 
   p2 = p1;
@@ -524,7 +1262,7 @@ const char *p1, *p2, *pEnd;
 
   if(p1 > pFileIdentifier)
   {
-    memcpy(pRval + i1, pFileIdentifier, p1 - pFileIdentifier);
+    memcpy(tbuf + i1, pFileIdentifier, p1 - pFileIdentifier);
     i1 +=  p1 - pFileIdentifier;
   }
   if(p2 < pEnd && *p2 == '.')
@@ -535,88 +1273,328 @@ const char *p1, *p2, *pEnd;
 
     if((p2 - p1) > 4)
     {
-      memcpy(pRval + i1, p1, 4);
+      memcpy(tbuf + i1, p1, 4);
       i1 += 4;
     }
     else
     {
-      memcpy(pRval + i1, p1, p2 - p1);
+      memcpy(tbuf + i1, p1, p2 - p1);
       i1 += p2 - p1;
     }
   }
 
-  pRval[i1] = 0;
+  tbuf[i1] = 0;
 
-  return pRval;
+  strncpy(pBuf, tbuf, cbBuf);
+  pBuf[cbBuf - 1] = 0;
+
+  return pBuf;
 }
 
-FILE *do_open_output_file(const char *pOutPath, const char *pFileIdentifier, int bOverwrite, int bConfirm)
+// open an output file relative to the output directory 'iOutDir' (already open), which
+// saves a path lookup for every file.  'szName' receives the host file name.
+// returns < 0 if the file was not opened (including 'do not overwrite')
+int do_open_output_file(int iOutDir, const char *pOutPath, const char *pFileIdentifier,
+                        int bOverwrite, int bConfirm, char *szName, int cbName)
 {
-char *pFileName;
-FILE *pRval;
+int iRval;
 
 
-  pFileName = make_output_file_name(pOutPath, pFileIdentifier);
-  if(!pFileName)
-    return NULL;
+  make_output_file_name(pFileIdentifier, szName, cbName);
+
+  // the usual case is a new file, so try that first
+
+  iRval = openat(iOutDir, szName, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
 
-  if(FileExists(pFileName) && !bOverwrite)
+  if(iRval < 0 && errno == EEXIST)
   {
-    if(bConfirm)
+    if(!bOverwrite && bConfirm)
     {
       char tbuf[4096];
-      snprintf(tbuf, sizeof(tbuf), "Overwrite \"%s\"", pFileName);
+      snprintf(tbuf, sizeof(tbuf), "Overwrite \"%s/%s\"", pOutPath, szName);
 
       if(!QueryYesNo(tbuf))
       {
-        free(pFileName);
-        return NULL;
+        errno = EEXIST;
+        return -1;
       }
     }
 
-    if(truncate(pFileName, 0)) // zero bytes long
+    iRval = openat(iOutDir, szName, O_WRONLY | O_TRUNC | O_CLOEXEC);
+  }
+
+  return iRval;
+}
+
+// buffered output, so that a file with many small blocks only needs a few 'write' calls
+int output_file_flush(OUTPUT_FILE *pOF)
+{
+ssize_t cbWrite;
+size_t cbDone;
+
+  for(cbDone=0; cbDone < pOF->cbBuf; cbDone += cbWrite)
+  {
+    cbWrite = write(pOF->iFD, pOF->pBuf + cbDone, pOF->cbBuf - cbDone);
+
+    if(cbWrite < 0 && errno == EINTR)
     {
-      fprintf(stderr, "Unable to write (truncate) to \"%s\", errno=%d (%xH)\n",
-              pFileName, errno, errno);
+      cbWrite = 0;
+      continue;
+    }
 
-      free(pFileName);
-      return NULL;
+    if(cbWrite <= 0)
+      return -1;
+  }
+
+  pOF->lSize += pOF->cbBuf;
+  pOF->cbBuf = 0;
+
+  return 0;
+}
+
+// append data to the output file.  Anything written in one call stays in the buffer
+// until the next call, so that 'output_file_close()' can still trim the last block.
+int output_file_write(OUTPUT_FILE *pOF, const void *pData, size_t cbData)
+{
+  if(pOF->lHole > 0 && output_file_fill_hole(pOF))
+    return -1;
+
+  if(pOF->cbBuf + cbData > OUTPUT_BUFSIZE && output_file_flush(pOF))
+    return -1;
+
+  if(cbData > OUTPUT_BUFSIZE) // should not happen
+  {
+    if(write(pOF->iFD, pData, cbData) != (ssize_t)cbData)
+      return -1;
+
+    pOF->lSize += cbData;
+    return 0;
+  }
+
+  memcpy(pOF->pBuf + pOF->cbBuf, pData, cbData);
+  pOF->cbBuf += cbData;
+
+  return 0;
+}
+
+// append 'cbData' zero bytes to the output file without writing them.  They are
+// written (or skipped over, leaving a hole in the file) by the next write or close.
+int output_file_skip(OUTPUT_FILE *pOF, size_t cbData)
+{
+  pOF->lHole += cbData;
+
+  return 0;
+}
+
+// a short run of zero bytes is copied into the buffer.  A longer one is left as a
+// hole, by writing the buffer and then moving the file pointer past it.
+int output_file_fill_hole(OUTPUT_FILE *pOF)
+{
+  if(pOF->lHole < OUTPUT_HOLE_MIN && pOF->cbBuf + pOF->lHole <= OUTPUT_BUFSIZE)
+  {
+    memset(pOF->pBuf + pOF->cbBuf, 0, pOF->lHole);
+    pOF->cbBuf += pOF->lHole;
+  }
+  else
+  {
+    if(output_file_flush(pOF) ||
+       lseek(pOF->iFD, pOF->lHole, SEEK_CUR) < 0)
+    {
+      return -1;
     }
+
+    pOF->lSize += pOF->lHole;
   }
 
-  pRval = fopen(pFileName, "w");
+  pOF->lHole = 0;
 
-  free(pFileName);
-  return pRval;
+  return 0;
 }
 
-int do_set_output_file_date_time(const char *pOutPath, const char *pFileIdentifier,
-                                 const char * pCreationDate)
+// write what's left, optionally without the trailing zero bytes of the last block, so
+// the file is written at its final size.  The file's date is set from the RT11 date
+// via the open file descriptor, and then it's closed.
+int output_file_close(OUTPUT_FILE *pOF, int bTrimLastBlock, const char *pCreationDate)
 {
-int iRval;
-char *pFileName;
-int iYear, iDay;
+int iRval = 0, iYear, iDay;
+size_t cbEnd;
 
-  pFileName = make_output_file_name(pOutPath, pFileIdentifier);
-  if(!pFileName)
+  if(pOF->iFD < 0)
     return -1;
 
-  rt11_date(pCreationDate, &iYear, &iDay);
-  iRval = set_file_RT11_date_time(pFileName, iYear, iDay);
+  if(pOF->lHole > 0)
+  {
+    // the file ends with zero blocks, and the last one is trimmed off completely.
+    // Setting the size leaves the rest of them as a hole.
+
+    if(bTrimLastBlock)
+      pOF->lHole -= pOF->lHole >= 512 ? 512 : pOF->lHole;
+
+    if(output_file_flush(pOF) ||
+       ftruncate(pOF->iFD, pOF->lSize + pOF->lHole))
+    {
+      iRval = -1;
+    }
+
+    pOF->lHole = 0;
+  }
+  else if(bTrimLastBlock && pOF->cbBuf > 0)
+  {
+    cbEnd = pOF->cbBuf > 512 ? pOF->cbBuf - 512 : 0; // start of the last block
+
+    while(pOF->cbBuf > cbEnd && !pOF->pBuf[pOF->cbBuf - 1])
+      pOF->cbBuf--;
+  }
+
+  if(output_file_flush(pOF))
+    iRval = -1;
+
+  if(pCreationDate)
+  {
+    rt11_date(pCreationDate, &iYear, &iDay);
+
+    if(set_fd_RT11_date_time(pOF->iFD, iYear, iDay))
+      iRval = -1;
+  }
+
+  if(close(pOF->iFD))
+    iRval = -1;
+
+  pOF->iFD = -1;
+  pOF->cbBuf = 0;
+  pOF->lSize = 0;
 
-  free(pFileName);
   return iRval;
 }
 
+// returns non-zero if all 'cbData' bytes are zero (checking 8 bytes at a time)
+int is_zero_block(const uint8_t *pData, int cbData)
+{
+uint64_t u1 = 0, u2;
+int i1;
+
+  for(i1=0; i1 + 8 <= cbData; i1 += 8)
+  {
+    memcpy(&u2, pData + i1, 8);
+    u1 |= u2;
+  }
+
+  for(; i1 < cbData; i1++)
+    u1 |= pData[i1];
+
+  return !u1;
+}
+
+// find the next data in a (possibly sparse) input file, at or after 'lPos'.
+// '*plData' is where the data starts, and '*plDataEnd' where the hole after it starts.
+// Everything before '*plData' reads as zeros.  The file pointer is not changed.
+int find_file_data(int iFD, off_t lPos, off_t lFileSize, off_t *plData, off_t *plDataEnd)
+{
+off_t lSave;
+
+  *plData = lPos; // if the file system can't tell me, it's all data
+  *plDataEnd = lFileSize;
+
+#ifdef SEEK_DATA
+  lSave = lseek(iFD, 0, SEEK_CUR);
+
+  *plData = lseek(iFD, lPos, SEEK_DATA);
+
+  if(*plData < 0)
+  {
+    // ENXIO means there's no more data, only a hole to the end of the file
+
+    *plData = errno == ENXIO ? lFileSize : lPos;
+  }
+  else
+  {
+    *plDataEnd = lseek(iFD, *plData, SEEK_HOLE);
+
+    if(*plDataEnd < 0)
+      *plDataEnd = lFileSize;
+  }
+
+  lseek(iFD, lSave, SEEK_SET); // for the 'FILE' that uses it
+#else // SEEK_DATA
+  (void)iFD;
+  (void)lSave;
+#endif // SEEK_DATA
+
+  return 0;
+}
+
+
+// on entry the tape is positioned at the EOF record for 'pFile' (the current section).
+// returns non-zero if the next file on the tape is the next section of the same file.
+// For a volume set, a file that ends a volume can continue on the next one.
+// The file position is not changed.
+int next_section_follows(FILE *pTape, const RT11_FILE_HEADER *pFile, VOLUME_SET *pVS)
+{
+int i1, iRval = 0;
+off_t lPos;
+FILE *pNext;
+RT11_FILE_HEADER next;
+char tbuf[PATH_MAX];
+
+  lPos = ftello(pTape);
+
+  // skip the EOF record and the data marker after it, then read the next header
+
+  i1 = fseeko(pTape, 4 + 512 + 4 + 4, SEEK_CUR) ? -1 : read_tape_block(pTape, &next);
+
+  if(i1 > 0 && pVS) // end of the volume - read the first header on the next one
+  {
+    pNext = fopen(volume_file_name(pVS, pVS->iVolume + 1, tbuf, sizeof(tbuf)), "r");
+
+    if(pNext)
+    {
+      i1 = read_tape_block(pNext, &next); // the volume header
+
+      if(!i1 && !memcmp(next.label_identifier, "VOL", 3))
+        i1 = read_tape_block(pNext, &next);
+      else
+        i1 = -1;
+
+      fclose(pNext);
+    }
+  }
+
+  if(!i1 &&
+     !memcmp(next.label_identifier, "HDR", 3) && next.label_number == '1' &&
+     !memcmp(next.file_identifier, pFile->file_identifier, sizeof(next.file_identifier)) &&
+     !memcmp(next.file_sequence_number, pFile->file_sequence_number, sizeof(next.file_sequence_number)))
+  {
+    memcpy(tbuf, pFile->file_section_number, sizeof(pFile->file_section_number));
+    tbuf[sizeof(pFile->file_section_number)] = 0;
+    i1 = atoi(tbuf);
+
+    memcpy(tbuf, next.file_section_number, sizeof(next.file_section_number));
+    tbuf[sizeof(next.file_section_number)] = 0;
+
+    iRval = atoi(tbuf) == i1 + 1;
+  }
+
+  clearerr(pTape); // in case I hit the end of the file
+  fseeko(pTape, lPos, SEEK_SET);
+
+  return iRval;
+}
 
 int read_the_tape(FILE *pTape, const char *szTapeFileName, const char *pOutPath,
-                  int bDirectory, int bOverwrite, int bConfirm, int bValidate, int bFindEndOfTape, int *piSeq)
+                  int bDirectory, int bOverwrite, int bConfirm, int bValidate, int bFindEndOfTape, int *piSeq,
+                  int bTextMode, VOLUME_SET *pVS, JOURNAL *pJ)
 {
-int iRval = -1, i1, nBlocks, iSeq, nBytesInLastBlock;
+int iRval = -1, i1, nBlocks, iSeq, bText = 0, bContinued = 0, bResumed = 0;
+long long nTotalBlocks = 0;
+size_t cbText;
+TEXT_CONVERT tc;
+uint8_t textbuf[512 * 2 + 1]; // converted text
 int bFoundTapeHeader = 0;
-size_t lZeroedZZZ = 0L;
-size_t lPos;
-FILE *pOutFile;
+off_t lZeroedZZZ = 0;
+off_t lPos = 0;
+int iOutDir = -1;
+OUTPUT_FILE out;
+char szOutName[32], szIdentifier[18];
 RT11_VOL_HEADER vol;
 RT11_FILE_HEADER file;
 RT11_FILE_EOF eof;
@@ -630,22 +1608,45 @@ char tbuf[512];
   if(piSeq)
     *piSeq = 0;
 
-  fseek(pTape, 0, SEEK_SET); // this function only reads from the beginning of the tape
+  memset(&out, 0, sizeof(out));
+  out.iFD = -1;
+
+  if(pOutPath) // output files are opened relative to the directory
+  {
+    iOutDir = open(pOutPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    out.pBuf = (uint8_t *)malloc(OUTPUT_BUFSIZE);
+
+    if(iOutDir < 0 || !out.pBuf)
+    {
+      fprintf(stderr, "Unable to open output directory \"%s\" - errno=%d (%xH)\n",
+              pOutPath, errno, errno);
+
+      iRval = -15;
+      goto the_exit_point;
+    }
+  }
+
+  fseeko(pTape, 0, SEEK_SET); // this function only reads from the beginning of the tape
+
+  if(pVS)
+    pVS->iVolume = 1; // 'pTape' is always the first volume
 
   i1 = read_tape_block(pTape, &vol); // read volume info
 
   if(i1 < 0)
   {
     fprintf(stderr, "Unable to read header on tape file \"%s\"\n", szTapeFileName);
-    return -9;
+    iRval = -9;
+    goto the_exit_point;
   }
 
   if(i1 == 1) // empty tape
   {
     if(bFindEndOfTape)
     {
-      fseek(pTape, 0, SEEK_SET);
-      return 1; // to indicate 'empty tape'
+      fseeko(pTape, 0, SEEK_SET);
+      iRval = 1; // to indicate 'empty tape'
+      goto the_exit_point;
     }
 
     // the tape is empty but I still want to output all of the things
@@ -666,7 +1667,8 @@ char tbuf[512];
       fputs("** TAPE VALIDATED **\n", stdout);
     }
 
-    return 0;
+    iRval = 0;
+    goto the_exit_point;
   }
 
   if(!memcmp(vol.label_identifier, "HDR", 3))
@@ -690,7 +1692,8 @@ char tbuf[512];
     fprintf(stderr, "Bad volume header - \"%-3.3s\" '%c'\n",
             vol.label_identifier, vol.label_number);
 
-    return -8;
+    iRval = -8;
+    goto the_exit_point;
   }
 
   bFoundTapeHeader = 1;
@@ -704,12 +1707,75 @@ char tbuf[512];
 
   iSeq = -1; // as a flag, first time around
 
+  if(pJ && pJ->bResume)
+  {
+    // skip the files that were already extracted.  The one that was in progress
+    // is extracted again, overwriting what was there.
+
+    if(pVS && pJ->iVolume > 1 && open_volume(pTape, pVS, pJ->iVolume, "r"))
+    {
+      fprintf(stderr, "ERROR - volume %d (from the journal) is missing\n", pJ->iVolume);
+
+      iRval = -9;
+      goto the_exit_point;
+    }
+
+    if(fseeko(pTape, pJ->lPos, SEEK_SET))
+    {
+      fprintf(stderr, "ERROR - unable to seek to position %lld (from the journal), errno=%d (%xH)\n",
+              (long long)pJ->lPos, errno, errno);
+
+      iRval = -9;
+      goto the_exit_point;
+    }
+
+    fprintf(stderr, "Resuming after \"%s\"\n", pJ->szName);
+
+    iSeq = pJ->iSeq;
+    bResumed = 1;
+  }
+
   while(!feof(pTape))
   {
-    lPos = ftell(pTape); // position of the current header
+    lPos = ftello(pTape); // position of the current header
 
     i1 = read_tape_block(pTape, &file); // read file directory 'HDR' info
 
+    if(i1 > 0 && pVS)
+    {
+      // end of this volume.  If there's another one, continue reading from it.
+
+      i1 = open_volume(pTape, pVS, pVS->iVolume + 1, bFindEndOfTape ? "r+" : "r");
+
+      if(i1 < 0)
+      {
+        iRval = -9;
+        goto the_exit_point;
+      }
+      else if(!i1)
+      {
+        if(read_tape_block(pTape, &vol) ||
+           memcmp(vol.label_identifier, "VOL", 3) || vol.label_number != '1')
+        {
+          fprintf(stderr, "Bad volume header on tape file \"%s\"\n",
+                  volume_file_name(pVS, pVS->iVolume, tbuf, sizeof(tbuf)));
+
+          iRval = -8;
+          goto the_exit_point;
+        }
+
+        if((bDirectory || bValidate) && !bFindEndOfTape)
+        {
+          printf("  -- VOLUME %d  \"%s\" --\n", pVS->iVolume,
+                 volume_file_name(pVS, pVS->iVolume, tbuf, sizeof(tbuf)));
+        }
+
+        continue;
+      }
+
+      i1 = 1; // no more volumes, this is the end of the tape
+    }
+
     if(i1 > 0)
     {
       if(bDirectory && !bValidate && !bFindEndOfTape)
@@ -720,7 +1786,7 @@ char tbuf[512];
       if(bFindEndOfTape)
       {
         // re-position file pointer back 4 bytes
-        fseek(pTape, ftell(pTape) - 4, SEEK_SET);
+        fseeko(pTape, -4, SEEK_CUR);
       }
 
       if(iSeq < 0)  // first time through?
@@ -730,9 +1796,10 @@ char tbuf[512];
     }
     else if(i1 < 0)
     {
-      fprintf(stderr, "Unable to read file header at position %ld\n", (long)ftell(pTape) - 4);
+      fprintf(stderr, "Unable to read file header at position %lld\n", (long long)ftello(pTape) - 4);
 
-      return -10;
+      iRval = -10;
+      goto the_exit_point;
     }
     else if(memcmp(file.label_identifier, "HDR", 3) || file.label_number != '1')
     {
@@ -751,19 +1818,21 @@ char tbuf[512];
       }
       else
       {
-        fprintf(stderr, "Invalid file header at position %ld - \"%-3.3s\" '%c'\n",
-                (long)ftell(pTape) - 4,
+        fprintf(stderr, "Invalid file header at position %lld - \"%-3.3s\" '%c'\n",
+                (long long)ftello(pTape) - 4,
                 file.label_identifier, file.label_number);
       }
 
-      return -10;
+      iRval = -10;
+      goto the_exit_point;
     }
 
     if(iSeq < 0) // first time through only, as a flag
       iSeq = 0;
 
 do_file:
-    iSeq++;
+    if(!bContinued) // the next section of a file has the same sequence number
+      iSeq++;
 
     if(piSeq)
       *piSeq = iSeq;
@@ -774,7 +1843,7 @@ do_file:
     memset(tbuf, 0, sizeof(tbuf));
     memcpy(tbuf, file.file_sequence_number, sizeof(file.file_sequence_number));
 
-    lZeroedZZZ = 0L;
+    lZeroedZZZ = 0;
 
     if(iSeq == 1 && atoi(tbuf) == 0) // special case, 'ZEROED.ZZZ' file
     {
@@ -798,7 +1867,7 @@ do_file:
       fprintf(stderr, "WARNING: Invalid file seq number in header - %d vs %d\n",
               iSeq, atoi(tbuf));
     }
-    else if(iSeq == 1 && bDirectory && !bValidate && !bFindEndOfTape)
+    else if(iSeq == 1 && !bContinued && bDirectory && !bValidate && !bFindEndOfTape)
     {
       fputs("  FILE NAME         CREATE DATE  BLOCKS  TOTAL BYTES\n"
             "  ================  ===========  ======  ===========\n", stdout);
@@ -807,45 +1876,65 @@ do_file:
     if(fread(marker, sizeof(marker), 1, pTape) != 1 ||
        memcmp(marker, DATA_MARKER, sizeof(marker))) // need a marker here
     {
-      fprintf(stderr, "missing data marker at position %ld, file \"%-17.17s\"\n",
-              (long)ftell(pTape) - 4,
+      fprintf(stderr, "missing data marker at position %lld, file \"%-17.17s\"\n",
+              (long long)ftello(pTape) - 4,
               file.file_identifier);
 
-      return -11;
+      iRval = -11;
+      goto the_exit_point;
     }
 
     if(lZeroedZZZ && // there should be one more data marker
        (fread(marker, sizeof(marker), 1, pTape) != 1 ||
         memcmp(marker, DATA_MARKER, sizeof(marker)))) // need a marker here
     {
-      fprintf(stderr, "missing 2nd data marker at position %ld, file \"%-17.17s\"\n",
-              (long)ftell(pTape) - 4,
+      fprintf(stderr, "missing 2nd data marker at position %lld, file \"%-17.17s\"\n",
+              (long long)ftello(pTape) - 4,
               file.file_identifier);
 
-      return -11;
+      iRval = -11;
+      goto the_exit_point;
     }
 
-    if(pOutPath && !lZeroedZZZ)
+    if(pOutPath && !lZeroedZZZ && !bContinued)
     {
-      pOutFile = do_open_output_file(pOutPath, file.file_identifier, bOverwrite, bConfirm);
+      out.iFD = do_open_output_file(iOutDir, pOutPath, file.file_identifier, bOverwrite || bResumed, bConfirm,
+                                    szOutName, sizeof(szOutName));
+
+      bResumed = 0;
 
-      if(!pOutFile)
+      if(out.iFD < 0)
       {
         fprintf(stderr, "Unable to open \"%s/%-17.17s\" - errno=%d (%xH)\n",
                 pOutPath, file.file_identifier, errno, errno);
       }
     }
-    else
+
+    nBlocks = 0;
+
+    if(bContinued)
     {
-      pOutFile = NULL; // a flag
+      // still writing the same output file, with the same text conversion
     }
+    else if(out.iFD >= 0 && bTextMode)
+    {
+      memset(&tc, 0, sizeof(tc)); // RT11 to host
 
-    nBlocks = 0;
-    nBytesInLastBlock = 512; // initially
+      memcpy(szIdentifier, file.file_identifier, sizeof(file.file_identifier)); // it isn't terminated
+      szIdentifier[sizeof(file.file_identifier)] = 0;
+
+      bText = is_text_file_name(szIdentifier); // if not, check the first block
+      nTotalBlocks = 0;
+    }
+    else
+    {
+      bText = 0;
+      nTotalBlocks = 0;
+    }
 
     while(!lZeroedZZZ && !feof(pTape))
     {
-      lPos = ftell(pTape); // current position
+      lPos = ftello(pTape); // current position
 
       i1 = read_tape_block(pTape, data); // read file data block
       // see if it's an EOF header.  Yes, this is a LAME way of doing it, but that's
@@ -857,60 +1946,90 @@ do_file:
       }
       else if(i1 < 0)
       {
-        fprintf(stderr, "read error at position %ld, file \"%-17.17s\"\n",
-                (long)lPos, file.file_identifier);
+        fprintf(stderr, "read error at position %lld, file \"%-17.17s\"\n",
+                (long long)lPos, file.file_identifier);
 
-        return -7;
+        iRval = -7;
+        goto the_exit_point;
       }
 
-      if(pOutFile)
+      if(out.iFD >= 0 && bTextMode && nTotalBlocks == 0 && nBlocks == 0 && !bText)
       {
-        if(fwrite(data, sizeof(data), 1, pOutFile) != 1)
-        {
-          fprintf(stderr, "ERROR - unable to write to \"%s/%-17.17s\" - errno=%d (%xH)\n",
-                  pOutPath, file.file_identifier, errno, errno);
+        bText = is_text_data(data, sizeof(data));
+      }
 
-          // TODO:  do I quit?  just flag the error??
+      if(out.iFD >= 0 && bText)
+      {
+        // text files are converted as they're written, without the NULL padding
+
+        cbText = text_convert(&tc, data, sizeof(data), textbuf);
+
+        if(cbText > 0 && output_file_write(&out, textbuf, cbText))
+        {
+          fprintf(stderr, "ERROR - unable to write to \"%s/%s\" - errno=%d (%xH)\n",
+                  pOutPath, szOutName, errno, errno);
         }
+      }
+      else if(out.iFD >= 0 && is_zero_block(data, sizeof(data)))
+      {
+        // zero blocks are not written, so that the output file can be sparse
 
-        // figure out which byte is the last one without a 0 in it
-        for(nBytesInLastBlock=512; nBytesInLastBlock > 0; nBytesInLastBlock--)
+        output_file_skip(&out, sizeof(data));
+      }
+      else if(out.iFD >= 0)
+      {
+        // the last block stays in the buffer until the next one is written, so the
+        // trailing zero bytes can be trimmed off before it's written to the file
+
+        if(output_file_write(&out, data, sizeof(data)))
         {
-          if(data[nBytesInLastBlock - 1] != 0)
-            break;
+          fprintf(stderr, "ERROR - unable to write to \"%s/%s\" - errno=%d (%xH)\n",
+                  pOutPath, szOutName, errno, errno);
+
+          // TODO:  do I quit?  just flag the error??
         }
       }
 
       nBlocks++;
     }
 
-    if(pOutFile)
-    {
-      fflush(pOutFile); // make sure I write it all first...
+    // a file larger than 999999 blocks, or one that continues on the next volume,
+    // continues in the next file section.  The output file stays open, and the
+    // directory shows the file once.
 
-      if(nBlocks > 0 && nBytesInLastBlock < 512)
+    nTotalBlocks += nBlocks;
+    bContinued = !lZeroedZZZ && next_section_follows(pTape, &file, pVS);
+
+    if(out.iFD >= 0 && !bContinued)
+    {
+      if(bText)
       {
-        if(DEBUG_OUTPUT_CHATTY)
-          fprintf(stderr, "truncating file \"%s/%-17.17s\" to %ld bytes\n",
-                  pOutPath, file.file_identifier, (nBlocks - 1) * 512L + nBytesInLastBlock);
+        cbText = text_convert(&tc, NULL, 0, textbuf); // a trailing <CR>
+
+        if(cbText > 0)
+          output_file_write(&out, textbuf, cbText);
 
-        // set file length to match the last block minus trailing 0 bytes
-        ftruncate(fileno(pOutFile), (nBlocks - 1) * 512L + nBytesInLastBlock);
+        if(DEBUG_OUTPUT_INFO)
+          fprintf(stderr, "*INFO* - \"%-17.17s\" converted as text\n", file.file_identifier);
       }
 
-      fclose(pOutFile);
-      pOutFile = NULL;
+      // binary files are written without the trailing 0 bytes of the last block,
+      // then the date is set on the open file before closing it
 
-      do_set_output_file_date_time(pOutPath, file.file_identifier, file.creation_date);
+      if(output_file_close(&out, !bText, file.creation_date))
+      {
+        fprintf(stderr, "ERROR - unable to write to \"%s/%s\" - errno=%d (%xH)\n",
+                pOutPath, szOutName, errno, errno);
+      }
     }
 
-    if(!lZeroedZZZ && bDirectory && !bValidate && !bFindEndOfTape)
+    if(!lZeroedZZZ && !bContinued && bDirectory && !bValidate && !bFindEndOfTape)
     {
       // directory output
-      printf("  %-17.17s  %-9.9s  %6d  %11ld\n",
+      printf("  %-17.17s  %-9.9s  %6lld  %11lld\n",
              file.file_identifier,
              rt11_date_string(file.creation_date),
-             nBlocks, (long)(nBlocks * 512));
+             nTotalBlocks, nTotalBlocks * 512);
     }
 
     i1 = read_tape_block(pTape, &eof); // read file EOF block
@@ -920,19 +2039,21 @@ do_file:
       printf("unexpected (missing EOF record)\nEND OF TAPE\n\n");
 
       if(lZeroedZZZ && bFindEndOfTape)
-        fseek(pTape, lPos, SEEK_SET);
+        fseeko(pTape, lPos, SEEK_SET);
 
-      return 1;
+      iRval = 1;
+      goto the_exit_point;
     }
     else if(i1 < 0 || memcmp(eof.label_identifier, "EOF", 3) || eof.label_number != '1')
     {
       if(i1 < 0)
-        fprintf(stderr, "Unable to read EOF header at position %ld\n", lPos);
+        fprintf(stderr, "Unable to read EOF header at position %lld\n", (long long)lPos);
       else
-        fprintf(stderr, "Invalid EOF header at position %ld - \"%-3.3s\" '%c'\n",
-                lPos, eof.label_identifier, eof.label_number);
+        fprintf(stderr, "Invalid EOF header at position %lld - \"%-3.3s\" '%c'\n",
+                (long long)lPos, eof.label_identifier, eof.label_number);
 
-      return -12;
+      iRval = -12;
+      goto the_exit_point;
     }
 
     memset(tbuf, 0, sizeof(tbuf));
@@ -950,33 +2071,39 @@ do_file:
 
     if(fread(marker, sizeof(marker), 1, pTape) != 1)
     {
-      fprintf(stderr, "missing data/tape marker at position %ld, file \"%-17.17s\"\n",
-              (long)ftell(pTape) - 4,
+      fprintf(stderr, "missing data/tape marker at position %lld, file \"%-17.17s\"\n",
+              (long long)ftello(pTape) - 4,
               file.file_identifier);
 
-      return -13;
+      iRval = -13;
+      goto the_exit_point;
     }
 
     if(memcmp(marker, DATA_MARKER, sizeof(marker))) // data marker means end of file should be next
     {
       printf("missing data marker at end of EOF record\n");
 
-      return -14;
+      iRval = -14;
+      goto the_exit_point;
     }
 
+    if(pJ && pOutPath && !lZeroedZZZ && !bContinued) // this file is done
+      journal_write(pJ, NULL, ftello(pTape), pVS ? pVS->iVolume : 1, iSeq, szOutName);
+
     if(lZeroedZZZ && bFindEndOfTape)
     {
       if(fread(marker, sizeof(marker), 1, pTape) != 1 ||
          memcmp(marker, DATA_MARKER, sizeof(marker))) // need a marker here
       {
-        fprintf(stderr, "missing 2nd data marker at position %ld, file \"%-17.17s\"\n",
-                (long)ftell(pTape) - 4,
+        fprintf(stderr, "missing 2nd data marker at position %lld, file \"%-17.17s\"\n",
+                (long long)ftello(pTape) - 4,
                 file.file_identifier);
 
-        return -14;
+        iRval = -14;
+        goto the_exit_point;
       }
 
-      fseek(pTape, lPos, SEEK_SET); // position to just BEFORE the 'ZEROED.ZZZ' file header
+      fseeko(pTape, lPos, SEEK_SET); // position to just BEFORE the 'ZEROED.ZZZ' file header
 
       break;
     }
@@ -988,36 +2115,89 @@ do_file:
   if(piSeq)
     *piSeq = iSeq; // I'm returning the sequence number of the last file on the tape
 
-  return 0; // success
+  if(pJ)
+    journal_remove(pJ);
+
+  iRval = 0; // success
+
+the_exit_point:
+
+  if(out.iFD >= 0)
+    output_file_close(&out, 0, NULL);
+
+  if(out.pBuf)
+    free(out.pBuf);
+
+  if(iOutDir >= 0)
+    close(iOutDir);
+
+  return iRval;
 }
 
-int write_the_tape(FILE *pTape, const char *szTapeFileName, const char *szInputName, int bAppend, int iDriveSize, const char *szLabel)
+int write_the_tape(FILE *pTape, const char *szTapeFileName, const char *szInputName, int bAppend, int iDriveSize, const char *szLabel,
+                   int bTextMode, VOLUME_SET *pVS, JOURNAL *pJ, int nCommitGroup, const char *szOrder, int bVerify)
 {
-int iRval = -1, iSeq=0, i1;
-void *pD;
+int iRval = -1, iSeq=0, i1, bSkip = 0, nUncommitted = 0, bList = 0;
+off_t lCommit = 0, lStart;
+uint64_t qwTextHash;
+void *pD = NULL;
+LAYOUT_LIST *pOrder = NULL;
+VERIFY *pVerify = NULL;
 unsigned long dwMode;
-char tbuf[PATH_MAX * 2], szDir[PATH_MAX];
+char tbuf[PATH_MAX * 2], szDir[PATH_MAX], szLastFile[PATH_MAX * 2], szTapeName[PATH_MAX];
 
-  fseek(pTape, 0, SEEK_SET);
+  fseeko(pTape, 0, SEEK_SET);
 
-  if(!bAppend)
+  if(pJ && pJ->bResume)
   {
-initialize_tape_first:
-    // initialize the tape file, extend to 32Mb, point just after the tape header
-
-    iRval = do_initialize_tape(pTape, szTapeFileName, iDriveSize, szLabel);
+    // go back to the end of the last file that was completely written, and end the
+    // tape there.  The file that was in progress is written again.
 
-    if(iRval)
+    if(pVS)
+    {
+      pVS->iVolume = 1;
+
+      if(pJ->iVolume > 1 && open_volume(pTape, pVS, pJ->iVolume, "r+"))
+      {
+        fprintf(stderr, "ERROR - volume %d (from the journal) is missing\n", pJ->iVolume);
+        return -9;
+      }
+    }
+
+    if(fseeko(pTape, pJ->lPos, SEEK_SET) || write_end_of_tape(pTape))
+    {
+      fprintf(stderr, "ERROR - unable to end the tape at position %lld (from the journal), errno=%d (%xH)\n",
+              (long long)pJ->lPos, errno, errno);
+
+      return -9;
+    }
+
+    fprintf(stderr, "Resuming after \"%s\"\n", pJ->szName);
+
+    iSeq = pJ->iSeq;
+    bSkip = 1;
+  }
+  else if(!bAppend)
+  {
+initialize_tape_first:
+    // initialize the tape file, extend to 32Mb, point just after the tape header
+
+    iRval = do_initialize_tape(pTape, szTapeFileName, iDriveSize, szLabel);
+
+    if(iRval)
     {
       return iRval;
     }
+
+    if(pVS)
+      pVS->iVolume = 1;
   }
   else
   {
     // read through the tape file until I get to the last file, and set the file pointer there
     // If the tape is not initialized, initialize it.
 
-    iRval = read_the_tape(pTape, szTapeFileName, NULL, 0, 0, 0, 0, 1, &iSeq); // seeks to end of tape;
+    iRval = read_the_tape(pTape, szTapeFileName, NULL, 0, 0, 0, 0, 1, &iSeq, 0, pVS, NULL); // seeks to end of tape;
       // TODO:  need the sequence number of the last file - new param
 
     if(iRval > 0) // an uninitialized tape
@@ -1041,7 +2221,15 @@ initialize_tape_first:
 
   // do a directory listing of the sub-directory 'pInputName' and write all of
   // the files that I find [that are not directories] to the tape, with upper case
-  // 6.3 file names and RT11 date/times
+  // 6.3 file names and RT11 date/times.  An input name of '-' is a list of files
+  // from stdin instead, written in that order (see 'read_file_list_entry()').
+
+  if(!strcmp(szInputName, "-"))
+  {
+    i1 = 0; // the list has the whole path
+    bList = 1;
+    goto the_list;
+  }
 
   strncpy(szDir, szInputName, sizeof(szDir) - 8);
 
@@ -1057,587 +2245,8281 @@ initialize_tape_first:
 
   memcpy(tbuf, szDir, i1); // to build full file name when needed
 
-  pD = WBAllocDirectoryList(szDir);
-  if(!pD)
+  if(szOrder) // in the '-O' order, rather than the order the directory has them in
   {
-    fprintf(stderr, "ERROR - unable to get directory list for \"%s\", errno=%d (%xH)\n",
-            szDir, errno, errno);
+    pOrder = layout_sort_directory(szDir, szOrder);
+
+    if(!pOrder)
+      return -21;
+  }
+  else
+  {
+    pD = WBAllocDirectoryList(szDir);
+    if(!pD)
+    {
+      fprintf(stderr, "ERROR - unable to get directory list for \"%s\", errno=%d (%xH)\n",
+              szDir, errno, errno);
 
-    return -21;
+      return -21;
+    }
   }
 
+the_list:
   iRval = 0;
 
-  while(!WBNextDirectoryEntry(pD, tbuf + i1, sizeof(tbuf) - i1 - 1, &dwMode))
+  if(bVerify && !(pVerify = verify_start(szTapeFileName))) // with '-w', a thread checks each file as it's done
+    iRval = -25;
+
+  while(!iRval &&
+        (bList ? !read_file_list_entry(stdin, tbuf, sizeof(tbuf), szTapeName, sizeof(szTapeName), &dwMode)
+         : pOrder ? !layout_next_entry(pOrder, tbuf + i1, sizeof(tbuf) - i1 - 1, &dwMode)
+                  : !WBNextDirectoryEntry(pD, tbuf + i1, sizeof(tbuf) - i1 - 1, &dwMode)))
   {
     if(!S_ISDIR(dwMode) && !S_ISFIFO(dwMode) && !S_ISSOCK(dwMode) // don't copy these
        && !S_ISLNK(dwMode)) // for now I also skip symlinks
     {
-      iRval = write_single_file_to_tape(pTape, tbuf, &iSeq);
+      if(bSkip) // resuming - this file was already written if it's not past the last one
+      {
+        bSkip = strcmp(tbuf + i1, pJ->szName) != 0;
+        continue;
+      }
+
+      if(nCommitGroup && !nUncommitted) // the first file in a commit group
+        lCommit = ftello(pTape);
+
+      lStart = ftello(pTape);
+
+      iRval = write_single_file_to_tape(pTape, tbuf, &iSeq, bTextMode, pVS,
+                                        nCommitGroup && !nUncommitted,
+                                        bList && szTapeName[0] ? szTapeName : NULL, &qwTextHash);
 
       if(iRval)
         break;
-    }
-  }
 
-  WBDestroyDirectoryList(pD);
+      if(pVerify && verify_add(pVerify, tbuf, lStart, ftello(pTape), qwTextHash))
+      {
+        iRval = -25;
+        break;
+      }
 
-  return iRval; // for now...
-}
+      if(nCommitGroup && ++nUncommitted >= nCommitGroup)
+      {
+        iRval = commit_tape_files(pTape, lCommit, pJ, iSeq, tbuf + i1);
+        nUncommitted = 0;
 
-// NOTE:  on entry, '*pfnFileSeqNum' is the seq # for the last file on the tape,
-//        or 0 if the tape is empty.  It is pre-incremented before assigning to
-//        the next file written to the tape.
-int write_single_file_to_tape(FILE *pTape, const char *szFileName, int *pnFileSeqNum)
-{
-int i1, i2, iRval = -999, nBlocks=0, nRTYear, nRTDay, cb1;
-long lFileSize, nBytes;
-FILE *pInput;
-const char *p1, *p2, *pEnd;
-RT11_FILE_HEADER file;
-RT11_FILE_EOF eof;
-uint8_t buf[512]; // file data
-char tbuf[256];
+        if(iRval)
+          break;
 
-  if(!FileExists(szFileName) || IsDirectory(szFileName))
-    return -1; // file will not be copied onto the tape or does not exist any more
+        if(pVerify)
+          verify_commit(pVerify);
+      }
+      else if(!nCommitGroup && pJ) // the position of the end of tape marker is where the next file starts
+      {
+        journal_write(pJ, pTape, ftello(pTape), pVS ? pVS->iVolume : 1, iSeq, tbuf + i1);
+      }
 
-  pInput = fopen(szFileName, "r");
-  if(!pInput)
-  {
-    fprintf(stderr, "ERROR opening file \"%s\" - errno=%d (%xH)\n",
-            szFileName, errno, errno);
+      if(pVerify && !nCommitGroup) // the file is on the tape once it's out of the stdio buffer
+      {
+        if(fflush(pTape))
+        {
+          fprintf(stderr, "ERROR - unable to write the tape file, errno=%d (%xH)\n", errno, errno);
+          iRval = -1;
+          break;
+        }
 
-    return -2; // error opening file
+        verify_commit(pVerify);
+      }
+
+      strcpy(szLastFile, tbuf + i1);
+    }
   }
 
-  // file is open.  build headers for it
-  // TODO:  since name is restricted to 6.3 uppercase I need to keep track of the files that
-  //        are already on the tape, and pick a new name as needed if there's already a match.
-  //        BUT, for NOW, to expedite writing this, I'll just convert to upper case and truncate
-  //        the name and put it on the tape as-is
+  // commit the last group, then sync again so that the last commit is permanent
 
-  memset(&file, 0, sizeof(file));
-  memcpy(file.label_identifier, "HDR", sizeof(file.label_identifier));
-  file.label_number = '1';
-  memcpy(file.file_set_identifier, "RT11A ", sizeof(file.file_set_identifier));
-  memcpy(file.file_section_number, "0001", sizeof(file.file_section_number));
+  if(!iRval && nUncommitted)
+    iRval = commit_tape_files(pTape, lCommit, pJ, iSeq, szLastFile);
 
-  (*pnFileSeqNum) ++; // increment first
-  snprintf(tbuf, sizeof(tbuf), "%04d", *pnFileSeqNum);
-  memcpy(file.file_sequence_number, tbuf, sizeof(file.file_sequence_number));
+  if(!iRval && pVerify)
+    verify_commit(pVerify);
 
-  format_rt11_file_name(szFileName, tbuf, sizeof(tbuf));
-  memset(file.file_identifier, ' ', sizeof(file.file_identifier));
-  memcpy(file.file_identifier, tbuf, 10); // always 10 bytes long
+  if(!iRval && nCommitGroup)
+    iRval = commit_tape_files(pTape, -1, pJ, iSeq, NULL);
 
-  memcpy(file.generation_version, "00", sizeof(file.generation_version));
+  if(pOrder)
+    layout_destroy_list(pOrder);
+  else if(pD)
+    WBDestroyDirectoryList(pD);
 
-  // get the file's date/time info as RT11 date/time, make it the 'creation date'
-  get_file_RT11_date_time(szFileName, &nRTYear, &nRTDay); // this returns the year as YYYY not YY
-  snprintf(tbuf, sizeof(tbuf), "%3d%03d", (nRTYear-1900)%1000, nRTDay);
-  memcpy(file.creation_date, tbuf, sizeof(file.creation_date));
+  if(bSkip)
+  {
+    fprintf(stderr, "ERROR - \"%s\" (from the journal) was not found in \"%s\"\n",
+            pJ->szName, szInputName);
 
-  memcpy(file.expiration_date, "000000", sizeof(file.expiration_date));
-  file.accessibility = ' ';
-  memcpy(file.block_count, "000000", sizeof(file.block_count));
-  memcpy(file.system_code, "DECRT11A     ", sizeof(file.system_code));
-  memset(file.reserved7, ' ', sizeof(file.reserved7));
+    iRval = -22;
+  }
+  else if(!iRval && pJ)
+  {
+    journal_remove(pJ);
+  }
 
-  // NEXT, do the EOF header.  Most fields are duplicates of 'file'
+  if(pVerify) // wait for the last files to be checked
+  {
+    i1 = verify_finish(pVerify);
 
-  memcpy(&eof, &file, sizeof(eof));
-  // eof fields that are different
-  memcpy(eof.label_identifier, "EOF", 3);
+    if(!iRval)
+      iRval = i1;
+  }
 
-  // start by writing the file header
+  // a new volume set replaces the old one, so any volumes past the last one that I
+  // wrote are left over from before, and must not be read as part of this one
 
-  i1 = write_tape_block(pTape, &file);
-  if(i1)
+  for(i1=pVS && !bAppend ? pVS->iVolume + 1 : 0;
+      i1 > 0 && FileExists(volume_file_name(pVS, i1, tbuf, sizeof(tbuf)));
+      i1++)
   {
-    fprintf(stderr, "ERROR - write_tape_block() returns %d, errno=%d (%xH)\n",
-            i1, errno, errno);
+    if(DEBUG_OUTPUT_WARN)
+      fprintf(stderr, "*WARN* - removing old volume \"%s\"\n", tbuf);
 
-    iRval = i1;
-    goto the_exit_point;
+    unlink(tbuf);
   }
 
-  // next I must write a DATA_MARKER
+  return iRval; // for now...
+}
 
-  if(fwrite(DATA_MARKER, 4, 1, pTape) != 1) // write two data markers here to mark EOT
+// reads the next file from a file list (see 'cFileListSeparator').  Each one is a path,
+// optionally followed by '=NAME.EXT' for the name it has on the tape.  Returns 0 for a
+// file, or non-zero at the end of the list.
+int read_file_list_entry(FILE *pList, char *pPath, int cbPath, char *pTapeName, int cbTapeName,
+                         unsigned long *pdwMode)
+{
+static char *pLine = NULL;
+static size_t cbLine = 0;
+ssize_t cb1;
+char *p1;
+struct stat st;
+
+  do
   {
-data_marker_error:
-    fprintf(stderr, "ERROR - can't write data marker, errno=%d (%xH)\n",
-            errno, errno);
+    cb1 = getdelim(&pLine, &cbLine, cFileListSeparator, pList);
 
-    iRval = -1;
-    goto the_exit_point;
-  }
+    if(cb1 < 0)
+      return 1;
 
-  // next, read 512 byte blocks of the file and write them until I'm done reading it
+    if(cb1 > 0 && pLine[cb1 - 1] == cFileListSeparator)
+      pLine[--cb1] = 0;
 
-  fseek(pInput, 0, SEEK_END);
-  lFileSize = ftell(pInput);
-  fseek(pInput, 0, SEEK_SET);
+  } while(!cb1); // skip empty lines
 
-  nBlocks = (lFileSize + 511) / 512; // calc # of blocks that I'll need
+  // a '=' after the last '/' is the tape name
 
-  for(i1=0, nBytes=0; i1 < nBlocks; i1++, nBytes += 512)
+  p1 = strrchr(pLine, '=');
+
+  if(p1 && !strchr(p1, '/') && p1 > pLine)
   {
-    memset(buf, 0, sizeof(buf));
+    *(p1++) = 0;
+    strncpy(pTapeName, p1, cbTapeName - 1);
+    pTapeName[cbTapeName - 1] = 0;
+  }
+  else
+  {
+    pTapeName[0] = 0;
+  }
 
-    if(lFileSize > nBytes + 512)
-    {
-      cb1 = 512;
-    }
-    else
-    {
-      cb1 = (int)(lFileSize - nBytes);
-    }
+  strncpy(pPath, pLine, cbPath - 1);
+  pPath[cbPath - 1] = 0;
 
-    i2 = fread(buf, cb1, 1, pInput);
+  *pdwMode = 0;
 
-    if(i2 != 1)
-    {
-      fprintf(stderr, "READ ERROR on input file \"%s\", i2=%d  errno=%d (%xH)\n",
-              szFileName, i2, errno, errno);
-      iRval = -2;
+  if(stat(pPath, &st))
+    fprintf(stderr, "ERROR - \"%s\" (from the file list) does not exist\n", pPath);
+  else if(!S_ISREG(st.st_mode))
+    fprintf(stderr, "ERROR - \"%s\" (from the file list) is not a file\n", pPath);
+  else
+    *pdwMode = st.st_mode;
 
-      goto the_exit_point;
-    }
+  return 0;
+}
 
-    i2 = write_tape_block(pTape, buf);
-    if(i2)
-    {
-      fprintf(stderr, "ERROR - write_tape_block() returns %d, errno=%d (%xH)\n",
-              i2, errno, errno);
+// with a commit group size ('-s'), files are added to a tape so that a crash leaves
+// either the tape as it was, or with all of the files in a group.  The first file in
+// a group is written with the end of tape marker left in place of its first tape marker
+// (see 'write_single_file_to_tape()'), so none of the group is on the tape until that
+// one marker is written.  Everything written so far is synced before the marker is
+// written, so the files are never on the tape before they're complete.  That's one
+// sync for each group.  The marker itself is permanent after the next sync (the next
+// commit, or the last call with 'lCommit' < 0), and that's when the journal is updated.
+int commit_tape_files(FILE *pTape, off_t lCommit, JOURNAL *pJ, int iSeq, const char *szLastFile)
+{
+off_t lEnd;
 
-      iRval = i2;
-      goto the_exit_point;
-    }
-  }
+  lEnd = ftello(pTape);
 
-  // next I must write a DATA_MARKER
+  if(fflush(pTape) || fdatasync(fileno(pTape)))
+  {
+    fprintf(stderr, "ERROR - unable to sync the tape file, errno=%d (%xH)\n", errno, errno);
+    return -23;
+  }
 
-  if(fwrite(DATA_MARKER, 4, 1, pTape) != 1) // write two data markers here to mark EOT
+  if(pJ && pJ->bPending) // the last commit is permanent now
   {
-    goto data_marker_error;
+    journal_write(pJ, NULL, pJ->lPending, 1, pJ->iPendingSeq, pJ->szPending);
+    pJ->bPending = 0;
   }
 
-  // update the block count and write EOF
-  snprintf(tbuf, sizeof(tbuf), "%06d", nBlocks);
-  memcpy(eof.block_count, tbuf, sizeof(eof.block_count));
+  if(lCommit < 0)
+    return 0;
 
-  i1 = write_tape_block(pTape, &eof);
-  if(i1)
+  if(fseeko(pTape, lCommit, SEEK_SET) ||
+     fwrite(TAPE_MARKER, 4, 1, pTape) != 1 ||
+     fflush(pTape) ||
+     fseeko(pTape, lEnd, SEEK_SET))
   {
-    fprintf(stderr, "ERROR - write_tape_block() returns %d, errno=%d (%xH)\n",
-            i1, errno, errno);
+    fprintf(stderr, "ERROR - unable to commit files at position %lld, errno=%d (%xH)\n",
+            (long long)lCommit, errno, errno);
 
-    iRval = i1;
-    goto the_exit_point;
+    return -24;
   }
 
-  if(fwrite(DATA_MARKER, 4, 1, pTape) != 1) // write two data markers here to mark EOT
+  if(DEBUG_OUTPUT_INFO)
+    fprintf(stderr, "*INFO* - committed through \"%s\" at %lld\n", szLastFile, (long long)lEnd);
+
+  if(pJ)
   {
-    goto data_marker_error;
-  }
+    pJ->bPending = 1;
+    pJ->lPending = lEnd;
+    pJ->iPendingSeq = iSeq;
 
-  iRval = 0;
+    strncpy(pJ->szPending, szLastFile, sizeof(pJ->szPending) - 1);
+    pJ->szPending[sizeof(pJ->szPending) - 1] = 0;
+  }
 
-the_exit_point:
-  fclose(pInput);
-  return iRval;
+  return 0;
 }
 
-int do_initialize_tape(FILE *pTape, const char *szFileName, int iDriveSize, const char *pLabel)
+// NOTE:  on entry, '*pfnFileSeqNum' is the seq # for the last file on the tape,
+//        or 0 if the tape is empty.  It is pre-incremented before assigning to
+//        the next file written to the tape.
+// A file section can have at most 999999 blocks (the 'block_count' field in the EOF
+// record is 6 digits), about 512Mb.  Larger files are written as consecutive file
+// sections, each with its own HDR1 and EOF1, using the same file name and sequence
+// number and an incrementing 'file_section_number'.
+// In a volume set, a file that does not fit on the current volume is continued the
+// same way, with the next section at the start of the next volume.
+
+#define MAX_SECTION_BLOCKS 999999
+
+// bytes needed to end a file section and the volume - data marker, EOF1, data marker, EOT
+#define VOLUME_END_BYTES (4 + 520 + 4 + 4)
+
+// write the EOF for the current section, and the HDR1 for the next one.  With
+// 'bNextVolume' the current volume is ended, and the next section starts the next one.
+int write_next_file_section(FILE *pTape, RT11_FILE_HEADER *pFile, RT11_FILE_EOF *pEOF, int nBlocks,
+                            VOLUME_SET *pVS, int bNextVolume)
 {
 int i1;
-long lFileSize = 0, lTargetSize = 1024L * 1024L * iDriveSize, lPos;
-RT11_VOL_HEADER *pHdr;
-char buf[512]; // what I write from
+char tbuf[16];
 
-  // build a header
+  snprintf(tbuf, sizeof(tbuf), "%06d", nBlocks);
+  memcpy(pEOF->block_count, tbuf, sizeof(pEOF->block_count));
 
-  memset(buf, ' ', sizeof(buf)); // rather than zeros, use white space (no harm)
+  if(fwrite(DATA_MARKER, 4, 1, pTape) != 1 ||
+     (i1 = write_tape_block(pTape, pEOF)) ||
+     fwrite(DATA_MARKER, 4, 1, pTape) != 1)
+  {
+    return -1;
+  }
 
-  pHdr = (RT11_VOL_HEADER *)buf;
+  if(bNextVolume &&
+     (write_end_of_tape(pTape) || open_volume(pTape, pVS, pVS->iVolume + 1, "w")))
+  {
+    return -1;
+  }
 
-  memcpy(pHdr->label_identifier, "VOL", sizeof(pHdr->label_identifier));
-  pHdr->label_number = '1';
-  memcpy(pHdr->volume_identifier, "RT11A ", sizeof(pHdr->volume_identifier));
-  pHdr->accessibility = ' ';
-  memset(pHdr->reserved26, ' ', sizeof(pHdr->reserved26));
-  memcpy(pHdr->owner_identifier, "D%B", sizeof(pHdr->owner_identifier));
-  memcpy(pHdr->owner_name, pLabel, sizeof(pHdr->owner_name));
-  pHdr->DEC_standard_version = '1';
-  memset(pHdr->reserved28, ' ', sizeof(pHdr->reserved28));
-  pHdr->label_standard_version = '3';
+  memcpy(tbuf, pFile->file_section_number, sizeof(pFile->file_section_number));
+  tbuf[sizeof(pFile->file_section_number)] = 0;
 
-  // tape marker, header, tape marker
+  snprintf(tbuf, sizeof(tbuf), "%04d", atoi(tbuf) + 1);
+  memcpy(pFile->file_section_number, tbuf, sizeof(pFile->file_section_number));
+  memcpy(pEOF->file_section_number, tbuf, sizeof(pEOF->file_section_number));
 
-  if((i1 = fwrite("\x00\x02\x00\x00", 4, 1, pTape)) != 1 ||
-     (i1 = fwrite(buf, sizeof(buf), 1, pTape)) != 1 ||
-     (i1 = fwrite("\x00\x02\x00\x00", 4, 1, pTape)) != 1)
-  {
-write_error:
-    fprintf(stderr, "ERROR:  fwrite() returns %d, errno=%d (%xH)\n",
-            i1, errno, errno);
+  if(DEBUG_OUTPUT_INFO)
+    fprintf(stderr, "*INFO* - \"%-17.17s\" section %s\n", pFile->file_identifier, tbuf);
 
-    fclose(pTape);
+  if((i1 = write_tape_block(pTape, pFile)) ||
+     fwrite(DATA_MARKER, 4, 1, pTape) != 1)
+  {
     return -1;
   }
 
-  lPos = ftell(pTape); // current file postion
+  if(pVS)
+    pVS->lPos = ftello(pTape);
 
-  // always write at least one empty buffer minus the size of the marker * 2
+  return 0;
+}
 
-  memset(buf, 0, sizeof(buf));
+// write a data block for a file, starting a new file section when the current one is
+// full, or (for a volume set) when the block and the end of the section won't fit
+int write_file_data_block(FILE *pTape, RT11_FILE_HEADER *pFile, RT11_FILE_EOF *pEOF,
+                          void *pBlock, int *pnSectionBlocks, VOLUME_SET *pVS)
+{
+int i1, bFull;
 
-  if((i1 = fwrite(buf, sizeof(buf) - 8, 1, pTape)) != 1)
-    goto write_error;
+  bFull = *pnSectionBlocks >= MAX_SECTION_BLOCKS;
 
-  lFileSize = sizeof(buf) * 2; // tape and marker and remaining 0 bytes
+  if(pVS && *pnSectionBlocks > 0 &&
+     pVS->lPos + 520 + VOLUME_END_BYTES + (bFull ? 4 + 520 + 4 + 520 + 4 : 0) >
+       (off_t)1024 * 1024 * pVS->iDriveSize)
+  {
+    if(DEBUG_OUTPUT_INFO)
+      fprintf(stderr, "*INFO* - \"%-17.17s\" continues on volume %d\n",
+              pFile->file_identifier, pVS->iVolume + 1);
+
+    if(write_next_file_section(pTape, pFile, pEOF, *pnSectionBlocks, pVS, 1))
+      return -7;
 
-  while(lFileSize < lTargetSize)
+    *pnSectionBlocks = 0;
+  }
+  else if(bFull)
   {
-    if((i1 = fwrite(buf, sizeof(buf), 1, pTape)) != 1)
-      goto write_error;
+    if(write_next_file_section(pTape, pFile, pEOF, *pnSectionBlocks, pVS, 0))
+      return -7;
 
-    lFileSize += sizeof(buf);
+    *pnSectionBlocks = 0;
   }
 
-  // set the file pointer to "right after the header"
+  i1 = write_tape_block(pTape, pBlock);
 
-  fseek(pTape, lPos, SEEK_SET);
+  if(!i1)
+  {
+    (*pnSectionBlocks)++;
 
-  return 0; // I am done
+    if(pVS)
+      pVS->lPos += 520;
+  }
+
+  return i1;
 }
 
-int initialize_tape(const char *szFileName, int iDriveSize, int bOverwrite, const char *pLabel)
+// returns the file name for volume 'iVolume' of a volume set in 'pBuf'
+char *volume_file_name(const VOLUME_SET *pVS, int iVolume, char *pBuf, int cbBuf)
 {
-int iRval;
-FILE *pTape;
+  if(iVolume <= 1)
+    snprintf(pBuf, cbBuf, "%s", pVS->szTapeFileName);
+  else
+    snprintf(pBuf, cbBuf, "%s.%03d", pVS->szTapeFileName, iVolume);
 
+  return pBuf;
+}
 
-  if(!pLabel || !*pLabel) // would be padded with white space if done right
-    pLabel = "dectape   ";
+// re-opens 'pTape' as volume 'iVolume' of a volume set.  'szMode' is the 'fopen' mode;
+// "w" initializes the new volume, and leaves the file pointer just after the header.
+// For reading, returns 1 if the volume does not exist.
+int open_volume(FILE *pTape, VOLUME_SET *pVS, int iVolume, const char *szMode)
+{
+char tbuf[PATH_MAX];
 
-  if(iDriveSize <= 0)
-  {
-    fprintf(stderr, "Invalid drive size %d\n", iDriveSize);
+  volume_file_name(pVS, iVolume, tbuf, sizeof(tbuf));
 
-    usage();
+  if(*szMode == 'r' && !FileExists(tbuf))
+    return 1;
 
+  fflush(pTape);
+
+  if(!freopen(tbuf, szMode, pTape))
+  {
+    // 'pTape' is closed now, so there's nothing else I can do with it
+
+    fprintf(stderr, "ERROR - unable to open tape volume \"%s\", errno=%d (%xH)\n",
+            tbuf, errno, errno);
+
+    exit(2);
+  }
+
+  setvbuf(pTape, NULL, _IOFBF, TAPE_BUFSIZE);
+
+  pVS->iVolume = iVolume;
+
+  if(DEBUG_OUTPUT_INFO)
+    fprintf(stderr, "*INFO* - volume %d \"%s\"\n", iVolume, tbuf);
+
+  if(*szMode == 'w')
+  {
+    if(do_initialize_tape(pTape, tbuf, pVS->iDriveSize, pVS->szLabel))
+      return -1;
+
+    pVS->lPos = ftello(pTape);
+  }
+
+  return 0;
+}
+
+// the journal has a header line, then the tape position (and volume) after the last
+// complete file, its sequence number, and its host file name.  It's replaced (not
+// written over) each time, so it's never left half written.
+
+#define JOURNAL_HEADER "DECTAPE-JNL 1"
+
+// sets up the journal for 'szTapeFileName'.  With 'bResume', reads the last file from
+// it, and returns < 0 if there isn't one (or it was for a different operation).
+int journal_init(JOURNAL *pJ, const char *szTapeFileName, int bCreate, int bResume)
+{
+FILE *pF;
+long long llPos;
+int iRval = -1;
+char tbuf[PATH_MAX + 64], szMode[8];
+
+  memset(pJ, 0, sizeof(*pJ));
+
+  snprintf(pJ->szFileName, sizeof(pJ->szFileName), "%s.jnl", szTapeFileName);
+  pJ->bCreate = bCreate;
+  pJ->bResume = bResume;
+
+  if(!bResume)
+    return 0;
+
+  pF = fopen(pJ->szFileName, "r");
+
+  if(!pF)
+  {
+    fprintf(stderr, "ERROR - unable to open journal \"%s\", errno=%d (%xH)\n",
+            pJ->szFileName, errno, errno);
+
+    return -1;
+  }
+
+  if(fgets(tbuf, sizeof(tbuf), pF) &&
+     sscanf(tbuf, JOURNAL_HEADER " %7s", szMode) == 1 &&
+     !strcmp(szMode, bCreate ? "CREATE" : "EXTRACT") &&
+     fgets(tbuf, sizeof(tbuf), pF) &&
+     sscanf(tbuf, "%lld %d %d", &llPos, &(pJ->iVolume), &(pJ->iSeq)) == 3 &&
+     fgets(pJ->szName, sizeof(pJ->szName), pF))
+  {
+    pJ->szName[strcspn(pJ->szName, "\n")] = 0;
+    pJ->lPos = (off_t)llPos;
+
+    iRval = 0;
+  }
+  else
+  {
+    fprintf(stderr, "ERROR - journal \"%s\" is not valid for %s\n",
+            pJ->szFileName, bCreate ? "writing the tape" : "extracting the tape");
+  }
+
+  fclose(pF);
+
+  return iRval;
+}
+
+// records a file that was completed.  The tape (if 'pTape' isn't NULL) is flushed first,
+// so that the journal never says more has been written than actually was.
+int journal_write(JOURNAL *pJ, FILE *pTape, off_t lPos, int iVolume, int iSeq, const char *szName)
+{
+FILE *pF;
+int iRval = -1;
+char tbuf[PATH_MAX + 8];
+
+  snprintf(tbuf, sizeof(tbuf), "%s.tmp~", pJ->szFileName);
+
+  if(pTape && fflush(pTape))
+    goto the_exit_point;
+
+  pF = fopen(tbuf, "w");
+
+  if(!pF)
+    goto the_exit_point;
+
+  fprintf(pF, JOURNAL_HEADER " %s\n%lld %d %d\n%s\n",
+          pJ->bCreate ? "CREATE" : "EXTRACT", (long long)lPos, iVolume, iSeq, szName);
+
+  if(fclose(pF) || rename(tbuf, pJ->szFileName))
+  {
+    unlink(tbuf);
+    goto the_exit_point;
+  }
+
+  iRval = 0;
+
+the_exit_point:
+  if(iRval && !pJ->bWarned)
+  {
+    fprintf(stderr, "WARNING - unable to write journal \"%s\", errno=%d (%xH)\n",
+            pJ->szFileName, errno, errno);
+
+    pJ->bWarned = 1;
+  }
+
+  return iRval;
+}
+
+// the run is complete, so there's nothing to resume
+void journal_remove(JOURNAL *pJ)
+{
+  if(unlink(pJ->szFileName) && errno != ENOENT && DEBUG_OUTPUT_WARN)
+    fprintf(stderr, "*WARN* - unable to remove journal \"%s\", errno=%d (%xH)\n",
+            pJ->szFileName, errno, errno);
+}
+
+int write_single_file_to_tape(FILE *pTape, const char *szFileName, int *pnFileSeqNum, int bTextMode,
+                              VOLUME_SET *pVS, int bHoldCommit, const char *szTapeName, uint64_t *pqwTextHash)
+{
+int i1, i2, iRval = -999, nBlocks=0, nSectionBlocks=0, nRTYear, nRTDay, cb1, bText = 0, bSeek = 0;
+off_t lFileSize, nBytes, lData = 0, lDataEnd = 0;
+size_t cbText;
+FILE *pInput;
+RT11_FILE_HEADER file;
+RT11_FILE_EOF eof;
+TEXT_CONVERT tc;
+uint8_t buf[512]; // file data
+uint8_t textbuf[512 * 3 + 1]; // converted text, up to 1 block left over plus 2 * 512
+char tbuf[256];
+
+  if(pqwTextHash) // stays 0 unless the file is converted as text
+    *pqwTextHash = 0;
+
+  if(!FileExists(szFileName) || IsDirectory(szFileName))
+    return -1; // file will not be copied onto the tape or does not exist any more
+
+  pInput = fopen(szFileName, "r");
+  if(!pInput)
+  {
+    fprintf(stderr, "ERROR opening file \"%s\" - errno=%d (%xH)\n",
+            szFileName, errno, errno);
+
+    return -2; // error opening file
+  }
+
+  // file is open.  build headers for it
+  // TODO:  since name is restricted to 6.3 uppercase I need to keep track of the files that
+  //        are already on the tape, and pick a new name as needed if there's already a match.
+  //        BUT, for NOW, to expedite writing this, I'll just convert to upper case and truncate
+  //        the name and put it on the tape as-is
+
+  memset(&file, 0, sizeof(file));
+  memcpy(file.label_identifier, "HDR", sizeof(file.label_identifier));
+  file.label_number = '1';
+  memcpy(file.file_set_identifier, "RT11A ", sizeof(file.file_set_identifier));
+  memcpy(file.file_section_number, "0001", sizeof(file.file_section_number));
+
+  (*pnFileSeqNum) ++; // increment first
+  snprintf(tbuf, sizeof(tbuf), "%04d", *pnFileSeqNum);
+  memcpy(file.file_sequence_number, tbuf, sizeof(file.file_sequence_number));
+
+  format_rt11_file_name(szTapeName ? szTapeName : szFileName, tbuf, sizeof(tbuf));
+  memset(file.file_identifier, ' ', sizeof(file.file_identifier));
+  memcpy(file.file_identifier, tbuf, 10); // always 10 bytes long
+
+  memcpy(file.generation_version, "00", sizeof(file.generation_version));
+
+  // get the file's date/time info as RT11 date/time, make it the 'creation date'
+  get_file_RT11_date_time(szFileName, &nRTYear, &nRTDay); // this returns the year as YYYY not YY
+  snprintf(tbuf, sizeof(tbuf), "%3d%03d", (nRTYear-1900)%1000, nRTDay);
+  memcpy(file.creation_date, tbuf, sizeof(file.creation_date));
+
+  memcpy(file.expiration_date, "000000", sizeof(file.expiration_date));
+  file.accessibility = ' ';
+  memcpy(file.block_count, "000000", sizeof(file.block_count));
+  memcpy(file.system_code, "DECRT11A     ", sizeof(file.system_code));
+  memset(file.reserved7, ' ', sizeof(file.reserved7));
+
+  // NEXT, do the EOF header.  Most fields are duplicates of 'file'
+
+  memcpy(&eof, &file, sizeof(eof));
+  // eof fields that are different
+  memcpy(eof.label_identifier, "EOF", 3);
+
+  // in a volume set, a file that doesn't have room for its header, at least one block,
+  // and the EOF starts on the next volume (unless this volume has no files on it)
+
+  if(pVS)
+  {
+    pVS->lPos = ftello(pTape);
+
+    if(pVS->lPos > 520 &&
+       pVS->lPos + 520 + 4 + 520 + VOLUME_END_BYTES > (off_t)1024 * 1024 * pVS->iDriveSize &&
+       open_volume(pTape, pVS, pVS->iVolume + 1, "w"))
+    {
+      iRval = -1;
+      goto the_exit_point;
+    }
+
+    pVS->lPos += 520 + 4;
+  }
+
+  // start by writing the file header.  With 'bHoldCommit', the end of tape marker that's
+  // there now is left in place of its first tape marker, so the file is not on the tape
+  // until 'commit_tape_files()' writes it.
+
+  if(bHoldCommit)
+  {
+    i1 = fwrite(DATA_MARKER, 4, 1, pTape) != 1 || fwrite(&file, 512, 1, pTape) != 1 ||
+         fwrite(TAPE_MARKER, 4, 1, pTape) != 1 ? -5 : 0;
+  }
+  else
+  {
+    i1 = write_tape_block(pTape, &file);
+  }
+
+  if(i1)
+  {
+    fprintf(stderr, "ERROR - write_tape_block() returns %d, errno=%d (%xH)\n",
+            i1, errno, errno);
+
+    iRval = i1;
+    goto the_exit_point;
+  }
+
+  // next I must write a DATA_MARKER
+
+  if(fwrite(DATA_MARKER, 4, 1, pTape) != 1) // write two data markers here to mark EOT
+  {
+data_marker_error:
+    fprintf(stderr, "ERROR - can't write data marker, errno=%d (%xH)\n",
+            errno, errno);
+
+    iRval = -1;
+    goto the_exit_point;
+  }
+
+  if(bTextMode) // is it a text file?  check the name, then the first block
+  {
+    bText = is_text_file_name(szFileName);
+
+    if(!bText)
+    {
+      memset(buf, 0, sizeof(buf));
+      bText = is_text_data(buf, fread(buf, 1, sizeof(buf), pInput));
+
+      fseeko(pInput, 0, SEEK_SET);
+    }
+  }
+
+  if(bText)
+  {
+    // text files are converted as they're read, so the block count comes from the
+    // converted size and not the size of the host file
+
+    if(DEBUG_OUTPUT_INFO)
+      fprintf(stderr, "*INFO* - \"%s\" converted as text\n", szFileName);
+
+    memset(&tc, 0, sizeof(tc));
+    tc.bToRT11 = 1;
+    cbText = 0;
+
+    if(pqwTextHash) // for '-w', which can't compare the tape with the host file
+      *pqwTextHash = FNV1A_HASH_INIT;
+
+    do
+    {
+      cb1 = fread(buf, 1, sizeof(buf), pInput);
+
+      if(cb1 < (int)sizeof(buf) && ferror(pInput))
+      {
+        fprintf(stderr, "READ ERROR on input file \"%s\", errno=%d (%xH)\n",
+                szFileName, errno, errno);
+        iRval = -2;
+
+        goto the_exit_point;
+      }
+
+      cbText += text_convert(&tc, buf, cb1, textbuf + cbText); // cb1 == 0 flushes a trailing <CR>
+
+      while(cbText >= 512 || (cb1 <= 0 && cbText > 0)) // last block is padded with zeros
+      {
+        if(cbText < 512)
+          memset(textbuf + cbText, 0, 512 - cbText);
+
+        if(pqwTextHash)
+          *pqwTextHash = fnv1a_hash(*pqwTextHash, textbuf, 512);
+
+        i2 = write_file_data_block(pTape, &file, &eof, textbuf, &nSectionBlocks, pVS);
+        if(i2)
+        {
+          fprintf(stderr, "ERROR - write_tape_block() returns %d, errno=%d (%xH)\n",
+                  i2, errno, errno);
+
+          iRval = i2;
+          goto the_exit_point;
+        }
+
+        if(cbText <= 512)
+        {
+          cbText = 0;
+        }
+        else
+        {
+          cbText -= 512;
+          memmove(textbuf, textbuf + 512, cbText);
+        }
+      }
+    } while(cb1 > 0);
+
+    goto write_the_eof;
+  }
+
+  // next, read 512 byte blocks of the file and write them until I'm done reading it
+
+  fseeko(pInput, 0, SEEK_END);
+  lFileSize = ftello(pInput);
+  fseeko(pInput, 0, SEEK_SET);
+
+  nBlocks = (lFileSize + 511) / 512; // calc # of blocks that I'll need
+
+  // the holes in a sparse file are not read.  They're written as zero blocks.
+
+  for(i1=0, nBytes=0; i1 < nBlocks; i1++, nBytes += 512)
+  {
+    memset(buf, 0, sizeof(buf));
+
+    if(lFileSize > nBytes + 512)
+    {
+      cb1 = 512;
+    }
+    else
+    {
+      cb1 = (int)(lFileSize - nBytes);
+    }
+
+    if(nBytes >= lDataEnd)
+      find_file_data(fileno(pInput), nBytes, lFileSize, &lData, &lDataEnd);
+
+    if(nBytes + cb1 <= lData) // in a hole
+    {
+      bSeek = 1;
+      i2 = 1;
+    }
+    else
+    {
+      if(bSeek) // just past a hole
+      {
+        fseeko(pInput, nBytes, SEEK_SET);
+        bSeek = 0;
+      }
+
+      i2 = fread(buf, cb1, 1, pInput);
+    }
+
+    if(i2 != 1)
+    {
+      fprintf(stderr, "READ ERROR on input file \"%s\", i2=%d  errno=%d (%xH)\n",
+              szFileName, i2, errno, errno);
+      iRval = -2;
+
+      goto the_exit_point;
+    }
+
+    i2 = write_file_data_block(pTape, &file, &eof, buf, &nSectionBlocks, pVS);
+    if(i2)
+    {
+      fprintf(stderr, "ERROR - write_tape_block() returns %d, errno=%d (%xH)\n",
+              i2, errno, errno);
+
+      iRval = i2;
+      goto the_exit_point;
+    }
+  }
+
+  // next I must write a DATA_MARKER
+
+write_the_eof:
+  if(fwrite(DATA_MARKER, 4, 1, pTape) != 1) // write two data markers here to mark EOT
+  {
+    goto data_marker_error;
+  }
+
+  // update the block count (for the last section) and write EOF
+  snprintf(tbuf, sizeof(tbuf), "%06d", nSectionBlocks);
+  memcpy(eof.block_count, tbuf, sizeof(eof.block_count));
+
+  i1 = write_tape_block(pTape, &eof);
+  if(i1)
+  {
+    fprintf(stderr, "ERROR - write_tape_block() returns %d, errno=%d (%xH)\n",
+            i1, errno, errno);
+
+    iRval = i1;
+    goto the_exit_point;
+  }
+
+  if(fwrite(DATA_MARKER, 4, 1, pTape) != 1 || // write two data markers here to mark EOT
+     write_end_of_tape(pTape))
+  {
+    goto data_marker_error;
+  }
+
+  iRval = 0;
+
+the_exit_point:
+  fclose(pInput);
+  return iRval;
+}
+
+int do_initialize_tape(FILE *pTape, const char *szFileName, int iDriveSize, const char *pLabel)
+{
+int i1;
+off_t lFileSize = 0, lTargetSize = (off_t)1024 * 1024 * iDriveSize, lPos;
+RT11_VOL_HEADER *pHdr;
+char buf[512]; // what I write from
+
+  // build a header
+
+  memset(buf, ' ', sizeof(buf)); // rather than zeros, use white space (no harm)
+
+  pHdr = (RT11_VOL_HEADER *)buf;
+
+  memcpy(pHdr->label_identifier, "VOL", sizeof(pHdr->label_identifier));
+  pHdr->label_number = '1';
+  memcpy(pHdr->volume_identifier, "RT11A ", sizeof(pHdr->volume_identifier));
+  pHdr->accessibility = ' ';
+  memset(pHdr->reserved26, ' ', sizeof(pHdr->reserved26));
+  memcpy(pHdr->owner_identifier, "D%B", sizeof(pHdr->owner_identifier));
+  memcpy(pHdr->owner_name, pLabel, sizeof(pHdr->owner_name));
+  pHdr->DEC_standard_version = '1';
+  memset(pHdr->reserved28, ' ', sizeof(pHdr->reserved28));
+  pHdr->label_standard_version = '3';
+
+  // tape marker, header, tape marker
+
+  if((i1 = fwrite("\x00\x02\x00\x00", 4, 1, pTape)) != 1 ||
+     (i1 = fwrite(buf, sizeof(buf), 1, pTape)) != 1 ||
+     (i1 = fwrite("\x00\x02\x00\x00", 4, 1, pTape)) != 1)
+  {
+write_error:
+    fprintf(stderr, "ERROR:  fwrite() returns %d, errno=%d (%xH)\n",
+            i1, errno, errno);
+
+    return -1; // the caller closes 'pTape'
+  }
+
+  lPos = ftello(pTape); // current file postion
+
+  // always write at least one empty buffer minus the size of the marker * 2
+
+  memset(buf, 0, sizeof(buf));
+
+  if((i1 = fwrite(buf, sizeof(buf) - 8, 1, pTape)) != 1)
+    goto write_error;
+
+  lFileSize = sizeof(buf) * 2; // tape and marker and remaining 0 bytes
+
+  // the rest of the tape is zeros.  Rather than writing them, the file is cut off here
+  // (in case it had anything in it) and then extended, which leaves a hole, so that it
+  // only takes up as much disk space as the files that are written to it.
+
+  if(lFileSize < lTargetSize &&
+     (fflush(pTape) ||
+      ftruncate(fileno(pTape), lFileSize) ||
+      ftruncate(fileno(pTape), lTargetSize)))
+  {
+    fprintf(stderr, "ERROR:  unable to set the size of \"%s\", errno=%d (%xH)\n",
+            szFileName, errno, errno);
+
+    return -1;
+  }
+
+  // set the file pointer to "right after the header"
+
+  fseeko(pTape, lPos, SEEK_SET);
+
+  return 0; // I am done
+}
+
+int initialize_tape(const char *szFileName, int iDriveSize, int bOverwrite, const char *pLabel)
+{
+int iRval;
+FILE *pTape;
+
+
+  if(!pLabel || !*pLabel) // would be padded with white space if done right
+    pLabel = "dectape   ";
+
+  if(iDriveSize < 0) // zero is 'as small as possible'
+  {
+    fprintf(stderr, "Invalid drive size %d\n", iDriveSize);
+
+    usage();
+
+    return -1;
+  }
+
+  // STEP 1:  does the file exist??
+
+  if(FileExists(szFileName))
+  {
+    if(!bOverwrite && !QueryYesNo("Overwrite existing file"))
+      return 1; // you said 'no'
+
+    // make sure file is zero bytes long
+
+    if(truncate(szFileName, 0)) // zero bytes long
+    {
+      fprintf(stderr, "Unable to write (truncate) to \"%s\", errno=%d (%xH)\n",
+              szFileName, errno, errno);
+
+      return -1;
+    }
+  }
+
+  pTape = fopen(szFileName, "w");
+  if(!pTape)
+  {
+    fprintf(stderr, "Unable to open \"%s\", errno=%d (%xH)\n",
+            szFileName, errno, errno);
+
+    return -1;
+  }
+
+  iRval = do_initialize_tape(pTape, szFileName, iDriveSize, pLabel);
+
+  fclose(pTape);
+
+  return iRval;
+}
+
+
+// a tape file doesn't need to be any bigger than its end of tape marker, plus a few
+// zero bytes after it.  'lEndOfTape' is the position of the end of tape marker.  The
+// file is cut off (or extended, with a hole) to that size plus 'cbHeadroom' bytes.
+
+#define TAPE_TAIL_BYTES 512 /* zeros after the end of tape marker */
+
+int fit_tape_size(FILE *pTape, const char *szFileName, off_t lEndOfTape, int cbHeadroom)
+{
+off_t lSize = lEndOfTape + 4 + TAPE_TAIL_BYTES + cbHeadroom;
+
+  if(fflush(pTape) || ftruncate(fileno(pTape), lSize))
+  {
+    fprintf(stderr, "ERROR - unable to set the size of \"%s\", errno=%d (%xH)\n",
+            szFileName, errno, errno);
+
+    return -1;
+  }
+
+  if(DEBUG_OUTPUT_INFO)
+    fprintf(stderr, "*INFO* - \"%s\" is now %lld bytes\n", szFileName, (long long)lSize);
+
+  return 0;
+}
+
+// cuts off everything after the end of the tape (see '-X')
+int shrink_tape(const char *szFileName, int cbHeadroom)
+{
+int iRval;
+FILE *pTape;
+struct stat st;
+
+  pTape = fopen(szFileName, "r+");
+
+  if(!pTape || fstat(fileno(pTape), &st))
+  {
+    fprintf(stderr, "Unable to open tape file \"%s\"\n", szFileName);
+
+    if(pTape)
+      fclose(pTape);
+
+    return -1;
+  }
+
+  setvbuf(pTape, NULL, _IOFBF, TAPE_BUFSIZE);
+
+  // this leaves the file pointer at the end of tape marker (or at the start, if empty)
+
+  iRval = read_the_tape(pTape, szFileName, NULL, 0, 0, 0, 0, 1, NULL, 0, NULL, NULL);
+
+  if(iRval < 0)
+  {
+    fprintf(stderr, "ERROR - unable to find end of tape (not changed)\n");
+  }
+  else
+  {
+    iRval = fit_tape_size(pTape, szFileName, ftello(pTape), cbHeadroom);
+
+    if(!iRval)
+      printf("\"%s\" %lld -> %lld bytes\n", szFileName, (long long)st.st_size,
+             (long long)(ftello(pTape) + 4 + TAPE_TAIL_BYTES + cbHeadroom));
+  }
+
+  fclose(pTape);
+
+  return iRval;
+}
+
+// extends a tape file to 'iDriveSize' MB (see '-E').  The new part is a hole, so it
+// doesn't take up any disk space until it's written.
+int grow_tape(const char *szFileName, int iDriveSize)
+{
+off_t lSize = (off_t)1024 * 1024 * iDriveSize;
+struct stat st;
+
+  if(stat(szFileName, &st))
+  {
+    fprintf(stderr, "Unable to open tape file \"%s\", errno=%d (%xH)\n", szFileName, errno, errno);
+    return -1;
+  }
+
+  if(st.st_size >= lSize)
+  {
+    printf("\"%s\" is already %lld bytes\n", szFileName, (long long)st.st_size);
+    return 0;
+  }
+
+  if(truncate(szFileName, lSize))
+  {
+    fprintf(stderr, "ERROR - unable to set the size of \"%s\", errno=%d (%xH)\n",
+            szFileName, errno, errno);
+
+    return -1;
+  }
+
+  printf("\"%s\" %lld -> %lld bytes\n", szFileName, (long long)st.st_size, (long long)lSize);
+
+  return 0;
+}
+
+// TEXT CONVERSION
+//
+// RT11 text files have <CR><LF> line endings, and the end of the text is either the
+// end of the file, the first ^Z, or the NULL padding in the last block.  Host text
+// files have <LF> line endings and no padding.  'text_convert()' converts a buffer
+// in either direction, keeping track of a <CR> at the end of one buffer so that it
+// can be matched with an <LF> at the start of the next one.
+
+// find the first byte in [p1,pEnd) that matches one of 'nMatch' (up to 4) bytes
+// in 'pMatch', or 'pEnd' if there are none.  This checks 8 bytes at a time,
+// and only looks at individual bytes for a word that has a match in it.
+const uint8_t *find_first_of(const uint8_t *p1, const uint8_t *pEnd, const char *pMatch, int nMatch)
+{
+int i1;
+uint64_t aRep[4], w1, w2, wMask;
+const uint64_t ONES = 0x0101010101010101ULL, HIGHS = 0x8080808080808080ULL;
+
+  if(nMatch > 4)
+    nMatch = 4;
+
+  // leading bytes up to an 8-byte boundary
+  while(p1 < pEnd && ((uintptr_t)p1 & 7))
+  {
+    for(i1=0; i1 < nMatch; i1++)
+    {
+      if(*p1 == (uint8_t)pMatch[i1])
+        return p1;
+    }
+
+    p1++;
+  }
+
+  for(i1=0; i1 < nMatch; i1++)
+    aRep[i1] = ONES * (uint8_t)pMatch[i1];
+
+  while(p1 + 8 <= pEnd)
+  {
+    memcpy(&w1, p1, 8);
+
+    for(i1=0, wMask=0; i1 < nMatch; i1++)
+    {
+      w2 = w1 ^ aRep[i1]; // a matching byte becomes zero
+      wMask |= (w2 - ONES) & ~w2 & HIGHS;
+    }
+
+    if(wMask)
+      break; // one of these 8 bytes matches; the byte loop below finds it
+
+    p1 += 8;
+  }
+
+  while(p1 < pEnd)
+  {
+    for(i1=0; i1 < nMatch; i1++)
+    {
+      if(*p1 == (uint8_t)pMatch[i1])
+        return p1;
+    }
+
+    p1++;
+  }
+
+  return pEnd;
+}
+
+// convert 'cbIn' bytes from 'pIn' into 'pOut', which must have room for 2 * cbIn + 1 bytes.
+// returns the number of bytes written to 'pOut'.  NULL bytes are always discarded,
+// and nothing after a ^Z is converted.  Call with 'cbIn' of 0 at the end of the text
+// to write any remaining <CR>.
+size_t text_convert(TEXT_CONVERT *pTC, const uint8_t *pIn, size_t cbIn, uint8_t *pOut)
+{
+const uint8_t *p1, *p2, *pEnd = pIn + cbIn;
+uint8_t *pO = pOut;
+
+  if(!cbIn)
+  {
+    if(pTC->bCR)
+      *(pO++) = '\r'; // the text ended with a <CR>
+
+    pTC->bCR = 0;
+
+    return pO - pOut;
+  }
+
+  for(p1=pIn; p1 < pEnd && !pTC->bEnd; p1 = p2 + 1)
+  {
+    p2 = find_first_of(p1, pEnd, "\n\r\0\x1a", 4);
+
+    if(p2 > p1)
+    {
+      if(pTC->bCR) // a <CR> followed by text is kept as-is (overstrike)
+        *(pO++) = '\r';
+
+      pTC->bCR = 0;
+
+      memcpy(pO, p1, p2 - p1);
+      pO += p2 - p1;
+    }
+
+    if(p2 >= pEnd)
+      break;
+
+    if(*p2 == '\n') // <LF> or <CR><LF> becomes <CR><LF> for RT11, or <LF> for the host
+    {
+      if(pTC->bToRT11)
+        *(pO++) = '\r';
+
+      *(pO++) = '\n';
+      pTC->bCR = 0;
+    }
+    else if(*p2 == '\r')
+    {
+      if(pTC->bCR) // <CR><CR>
+        *(pO++) = '\r';
+
+      pTC->bCR = 1;
+    }
+    else if(*p2 == '\x1a')
+    {
+      pTC->bEnd = 1; // ^Z is the end of the text
+    }
+
+    // NULL bytes are padding or fill, and are always discarded
+  }
+
+  return pO - pOut;
+}
+
+// is 'szFileName' a text file, according to its extension?
+int is_text_file_name(const char *szFileName)
+{
+const char *p1, *p2, *pExt;
+int cbExt;
+
+  pExt = strrchr(szFileName, '/');
+  pExt = strchr(pExt ? pExt : szFileName, '.');
+
+  if(!pExt)
+    return 0;
+
+  pExt++;
+
+  while(*pExt == ' ') // tape file names are padded, i.e. 'FOO   .MAC'
+    pExt++;
+
+  for(cbExt=0; pExt[cbExt] > ' ' && pExt[cbExt] != '.'; cbExt++)
+    { }
+
+  if(!cbExt)
+    return 0;
+
+  for(p1=szTextExtensions; *p1; p1 = *p2 ? p2 + 1 : p2)
+  {
+    p2 = p1;
+    while(*p2 && *p2 != ',')
+      p2++;
+
+    if(p2 - p1 == cbExt && !strncasecmp(p1, pExt, cbExt))
+      return 1;
+  }
+
+  return 0;
+}
+
+// does the data look like text?  Trailing NULL padding is allowed (last block on the tape)
+int is_text_data(const uint8_t *pData, int cbData)
+{
+int i1;
+
+  while(cbData > 0 && !pData[cbData - 1])
+    cbData--;
+
+  if(!cbData)
+    return 0; // empty, or all zeros.  call it binary
+
+  for(i1=0; i1 < cbData; i1++)
+  {
+    if(pData[i1] >= ' ' && pData[i1] < 0x7f)
+      continue;
+
+    if(pData[i1] != '\t' && pData[i1] != '\r' && pData[i1] != '\n' &&
+       pData[i1] != '\f' && pData[i1] != '\x1a')
+    {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+
+
+// PAPER TAPE CONVERSION
+//
+// Text that goes through the paper tape reader (PTR) should have <CR><LF> line
+// endings, some NULL 'leader' in front, a ^Z to mark the end of the text, and
+// some NULL 'trailer' after it.  Output captured from the paper tape punch (PTP)
+// has all of that, and it needs to be stripped off again for the host.
+
+#define PAPER_TAPE_LEADER  64  /* NULL bytes of leader and trailer when punching */
+#define PAPER_TAPE_BUFSIZE 65536
+
+// bToReader != 0 converts host text to PTR format, otherwise PTP output to host text
+// if 'szOutput' is NULL, the file is converted in place via a temporary file
+
+int paper_tape_convert(const char *szInput, const char *szOutput, int bToReader)
+{
+int iRval = -1;
+size_t cbRead, cbOut;
+FILE *pIn, *pOut;
+uint8_t *pBuf, *pOutBuf;
+TEXT_CONVERT tc;
+struct stat st;
+char szTemp[PATH_MAX + 8];
+static const uint8_t aLeader[PAPER_TAPE_LEADER] = { 0 };
+
+
+  pIn = fopen(szInput, "r");
+  if(!pIn)
+  {
+    fprintf(stderr, "Unable to open \"%s\", errno=%d (%xH)\n",
+            szInput, errno, errno);
+
+    return -1;
+  }
+
+  if(!szOutput) // convert in place
+  {
+    snprintf(szTemp, sizeof(szTemp), "%s.tmp~", szInput);
+    pOut = fopen(szTemp, "w");
+  }
+  else
+  {
+    pOut = fopen(szOutput, "w");
+  }
+
+  pBuf = (uint8_t *)malloc(PAPER_TAPE_BUFSIZE * 3 + 1);
+
+  if(!pOut || !pBuf)
+  {
+    fprintf(stderr, "Unable to open \"%s\", errno=%d (%xH)\n",
+            szOutput ? szOutput : szTemp, errno, errno);
+
+    goto the_exit_point;
+  }
+
+  pOutBuf = pBuf + PAPER_TAPE_BUFSIZE;
+
+  memset(&tc, 0, sizeof(tc));
+  tc.bToRT11 = bToReader;
+
+  if(bToReader && fwrite(aLeader, sizeof(aLeader), 1, pOut) != 1)
+    goto write_error;
+
+  // a single streaming pass.  Leader, trailer, and anything after the ^Z are dropped
+  // by 'text_convert()' along with the line ending conversion.
+
+  while(!tc.bEnd && (cbRead = fread(pBuf, 1, PAPER_TAPE_BUFSIZE, pIn)) > 0)
+  {
+    cbOut = text_convert(&tc, pBuf, cbRead, pOutBuf);
+
+    if(cbOut && fwrite(pOutBuf, cbOut, 1, pOut) != 1)
+      goto write_error;
+  }
+
+  if(ferror(pIn))
+  {
+    fprintf(stderr, "READ ERROR on input file \"%s\", errno=%d (%xH)\n",
+            szInput, errno, errno);
+
+    goto the_exit_point;
+  }
+
+  cbOut = text_convert(&tc, NULL, 0, pOutBuf); // trailing <CR>, if any
+
+  if(cbOut && fwrite(pOutBuf, cbOut, 1, pOut) != 1)
+    goto write_error;
+
+  if(bToReader &&
+     (fputc('\x1a', pOut) == EOF ||
+      fwrite(aLeader, sizeof(aLeader), 1, pOut) != 1)) // ^Z and trailer
+  {
+    goto write_error;
+  }
+
+  if(fflush(pOut))
+  {
+write_error:
+    fprintf(stderr, "ERROR - unable to write to \"%s\" - errno=%d (%xH)\n",
+            szOutput ? szOutput : szTemp, errno, errno);
+
+    goto the_exit_point;
+  }
+
+  // converted in place, it keeps the original file's permissions (and its owner, when
+  // that's allowed)
+
+  if(!szOutput)
+  {
+    if(fstat(fileno(pIn), &st) || fchmod(fileno(pOut), st.st_mode & 07777))
+    {
+      fprintf(stderr, "ERROR - unable to set the permissions of \"%s\" - errno=%d (%xH)\n",
+              szTemp, errno, errno);
+
+      goto the_exit_point;
+    }
+
+    if(fchown(fileno(pOut), st.st_uid, st.st_gid) && DEBUG_OUTPUT_WARN)
+      fprintf(stderr, "*WARN* - unable to set the owner of \"%s\" - errno=%d (%xH)\n",
+              szTemp, errno, errno);
+  }
+
+  iRval = 0;
+
+the_exit_point:
+
+  if(pBuf)
+    free(pBuf);
+
+  fclose(pIn);
+
+  if(pOut)
+  {
+    fclose(pOut);
+
+    if(!szOutput)
+    {
+      if(!iRval && rename(szTemp, szInput))
+      {
+        fprintf(stderr, "ERROR - unable to rename \"%s\" to \"%s\" - errno=%d (%xH)\n",
+                szTemp, szInput, errno, errno);
+
+        iRval = -1;
+      }
+
+      if(iRval)
+        unlink(szTemp);
+    }
+  }
+
+  return iRval;
+}
+
+
+// LINE PRINTER FOLLOW MODE
+//
+// simh writes line printer (LPT) output to a host file as it's flushed.  Rather
+// than re-reading the whole file, remember how much has already been read and
+// only read what was added since.  On Linux, 'inotify' tells me when that happens,
+// and everywhere else I check the file size once per second.
+//
+// The output is normalized as it's read (<CR><LF> becomes <LF>, overstrikes using
+// <CR> or <BS> are merged into a single line) and split into pages on <FF>.  Pages
+// are written to 'JOBnnnn.TXT' files in the output directory, and a new job file is
+// started for a banner page, or whenever the printer has been idle for a while.
+
+#define LPT_MAX_LINE     1024 /* maximum (normalized) line length */
+#define LPT_IDLE_SECONDS 10   /* no output for this long ends the current job */
+#define LPT_BUFSIZE      65536
+
+typedef struct _LPT_FOLLOW_
+{
+  const char *szOutDir;
+  FILE *pJob;                 // current job file (NULL if none)
+  int iJob;                   // current job number
+  int nPages;                 // pages written to the current job
+  char *pPage;                // current page, normalized
+  size_t cbPage, cbPageMax;
+  int iCol, cbLine;           // current print column, length of 'szLine'
+  char szLine[LPT_MAX_LINE];  // current line, with overstrikes merged
+} LPT_FOLLOW;
+
+static volatile int bFollowQuit = 0;
+
+static void follow_signal_handler(int iSig)
+{
+  bFollowQuit = 1;
+}
+
+int lpt_add_to_page(LPT_FOLLOW *pF, const char *pData, size_t cbData)
+{
+char *p1;
+size_t cbNew;
+
+  if(pF->cbPage + cbData > pF->cbPageMax)
+  {
+    cbNew = pF->cbPageMax ? pF->cbPageMax * 2 : 16384;
+
+    while(cbNew < pF->cbPage + cbData)
+      cbNew *= 2;
+
+    p1 = (char *)realloc(pF->pPage, cbNew);
+    if(!p1)
+    {
+      fprintf(stderr, "ERROR - unable to allocate %ld bytes for page buffer\n", (long)cbNew);
+      return -1;
+    }
+
+    pF->pPage = p1;
+    pF->cbPageMax = cbNew;
+  }
+
+  memcpy(pF->pPage + pF->cbPage, pData, cbData);
+  pF->cbPage += cbData;
+
+  return 0;
+}
+
+int lpt_end_line(LPT_FOLLOW *pF)
+{
+  while(pF->cbLine > 0 && pF->szLine[pF->cbLine - 1] == ' ') // trim trailing white space
+    pF->cbLine--;
+
+  pF->szLine[pF->cbLine++] = '\n';
+
+  if(lpt_add_to_page(pF, pF->szLine, pF->cbLine))
+    return -1;
+
+  pF->cbLine = 0;
+  pF->iCol = 0;
+
+  return 0;
+}
+
+// a banner page is mostly block letters, i.e. lines made of runs of the same character
+int lpt_is_banner_page(const char *pPage, size_t cbPage)
+{
+const char *p1, *p2, *pEnd = pPage + cbPage;
+int nLines = 0, nBlockLines = 0, bBlock;
+
+  for(p1=pPage; p1 < pEnd; p1 = p2 + 1)
+  {
+    p2 = memchr(p1, '\n', pEnd - p1);
+    if(!p2)
+      p2 = pEnd;
+
+    if(p2 == p1)
+      continue; // blank lines don't count either way
+
+    nLines++;
+
+    for(bBlock=1; p1 < p2 && bBlock; p1++)
+    {
+      if(*p1 != ' ' && p1 + 1 < p2 && p1[1] != ' ' && p1[1] != *p1)
+        bBlock = 0; // two different characters next to each other
+    }
+
+    if(bBlock)
+      nBlockLines++;
+  }
+
+  return nBlockLines >= 5 && nBlockLines * 10 >= nLines * 6; // at least 60%
+}
+
+int lpt_close_job(LPT_FOLLOW *pF)
+{
+int iRval = 0;
+
+  if(pF->pJob)
+  {
+    if(fclose(pF->pJob))
+      iRval = -1;
+
+    pF->pJob = NULL;
+
+    printf("JOB%04d.TXT  %d page%s\n", pF->iJob, pF->nPages, pF->nPages == 1 ? "" : "s");
+    fflush(stdout);
+  }
+
+  return iRval;
+}
+
+int lpt_open_job(LPT_FOLLOW *pF)
+{
+char tbuf[PATH_MAX + 32];
+
+  do
+  {
+    pF->iJob++;
+    snprintf(tbuf, sizeof(tbuf), "%s/JOB%04d.TXT", pF->szOutDir, pF->iJob);
+  } while(FileExists(tbuf));
+
+  pF->pJob = fopen(tbuf, "w");
+  if(!pF->pJob)
+  {
+    fprintf(stderr, "Unable to open \"%s\", errno=%d (%xH)\n",
+            tbuf, errno, errno);
+
+    return -1;
+  }
+
+  pF->nPages = 0;
+
+  if(DEBUG_OUTPUT_INFO)
+    fprintf(stderr, "*INFO* - starting \"%s\"\n", tbuf);
+
+  return 0;
+}
+
+// write the current page (if any) to the job file.  'bFormFeed' is non-zero when
+// the page ended with a <FF>, and zero when it's a partial page (printer went idle)
+int lpt_end_page(LPT_FOLLOW *pF, int bFormFeed)
+{
+  if(pF->cbLine > 0 && lpt_end_line(pF))
+    return -1;
+
+  if(!pF->cbPage && !bFormFeed)
+    return 0;
+
+  if(pF->pJob && pF->nPages > 0 && lpt_is_banner_page(pF->pPage, pF->cbPage))
+  {
+    if(lpt_close_job(pF)) // banner page starts a new job
+      return -1;
+  }
+
+  if(!pF->pJob && lpt_open_job(pF))
+    return -1;
+
+  if((pF->cbPage && fwrite(pF->pPage, pF->cbPage, 1, pF->pJob) != 1) ||
+     (bFormFeed && fputc('\f', pF->pJob) == EOF) ||
+     fflush(pF->pJob))
+  {
+    fprintf(stderr, "ERROR - unable to write to JOB%04d.TXT - errno=%d (%xH)\n",
+            pF->iJob, errno, errno);
+
+    return -1;
+  }
+
+  pF->nPages++;
+  pF->cbPage = 0;
+
+  return 0;
+}
+
+int lpt_process(LPT_FOLLOW *pF, const uint8_t *pData, size_t cbData)
+{
+const uint8_t *pEnd = pData + cbData;
+char c1;
+
+  for(; pData < pEnd; pData++)
+  {
+    c1 = (char)*pData;
+
+    switch(c1)
+    {
+      case '\n':
+        if(lpt_end_line(pF))
+          return -1;
+        break;
+
+      case '\r': // back to the start of the line, to overstrike it (or <CR><LF>)
+        pF->iCol = 0;
+        break;
+
+      case '\b':
+        if(pF->iCol > 0)
+          pF->iCol--;
+        break;
+
+      case '\f':
+        if(lpt_end_page(pF, 1))
+          return -1;
+        break;
+
+      case '\t':
+        do
+        {
+          if(pF->iCol >= pF->cbLine && pF->iCol < LPT_MAX_LINE - 1)
+            pF->szLine[pF->cbLine++] = ' ';
+
+          pF->iCol++;
+        } while(pF->iCol & 7);
+        break;
+
+      default:
+        if((unsigned char)c1 < ' ' || c1 == '\x7f') // NULL fill and other control chars
+          break;
+
+        if(pF->iCol >= LPT_MAX_LINE - 1)
+          break; // line is too long, discard the rest
+
+        while(pF->cbLine < pF->iCol) // overstrike went past the end of the line
+          pF->szLine[pF->cbLine++] = ' ';
+
+        if(pF->iCol == pF->cbLine)
+        {
+          pF->szLine[pF->cbLine++] = c1;
+        }
+        else if(pF->szLine[pF->iCol] == ' ' || pF->szLine[pF->iCol] == '_')
+        {
+          pF->szLine[pF->iCol] = c1; // overstrike replaces blanks and underscores
+        }
+
+        pF->iCol++;
+    }
+  }
+
+  return 0;
+}
+
+int follow_printer_file(const char *szCaptureFile, const char *szOutDir)
+{
+int iRval = -1, iFD, iNotify = -1, bIdle = 1;
+off_t lOffset = 0;
+ssize_t cbRead;
+time_t tmLastData;
+struct stat st;
+uint8_t *pBuf;
+LPT_FOLLOW fol;
+
+
+  memset(&fol, 0, sizeof(fol));
+  fol.szOutDir = szOutDir;
+
+  if(!IsDirectory(szOutDir) && mkdir(szOutDir, 0777))
+  {
+    fprintf(stderr, "Unable to create directory \"%s\", errno=%d (%xH)\n",
+            szOutDir, errno, errno);
+
+    return -1;
+  }
+
+  iFD = open(szCaptureFile, O_RDONLY);
+  if(iFD < 0)
+  {
+    fprintf(stderr, "Unable to open \"%s\", errno=%d (%xH)\n",
+            szCaptureFile, errno, errno);
+
+    return -1;
+  }
+
+  pBuf = (uint8_t *)malloc(LPT_BUFSIZE);
+  if(!pBuf)
+  {
+    close(iFD);
+    return -1;
+  }
+
+#ifdef __linux__
+  iNotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+  if(iNotify >= 0 &&
+     inotify_add_watch(iNotify, szCaptureFile, IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB) < 0)
+  {
+    close(iNotify);
+    iNotify = -1;
+  }
+
+  if(iNotify < 0 && DEBUG_OUTPUT_WARN)
+    fprintf(stderr, "WARNING - inotify not available, errno=%d (%xH), polling instead\n", errno, errno);
+#endif // __linux__
+
+  signal(SIGINT, follow_signal_handler);
+  signal(SIGTERM, follow_signal_handler);
+
+  fprintf(stderr, "Following \"%s\" - press CTRL+C to stop\n", szCaptureFile);
+
+  tmLastData = time(NULL);
+
+  while(!bFollowQuit)
+  {
+    if(fstat(iFD, &st))
+    {
+      fprintf(stderr, "Unable to 'stat' \"%s\", errno=%d (%xH)\n",
+              szCaptureFile, errno, errno);
+      goto the_exit_point;
+    }
+
+    if(st.st_size < lOffset) // file was truncated (LPT re-attached), start over
+    {
+      if(DEBUG_OUTPUT_INFO)
+        fprintf(stderr, "*INFO* - \"%s\" was truncated\n", szCaptureFile);
+
+      if(lpt_end_page(&fol, 0) || lpt_close_job(&fol))
+        goto the_exit_point;
+
+      lOffset = 0;
+      bIdle = 1;
+    }
+
+    while(st.st_size > lOffset) // only read the new part of the file
+    {
+      cbRead = pread(iFD, pBuf, LPT_BUFSIZE, lOffset);
+
+      if(cbRead < 0 && errno == EINTR)
+        continue;
+
+      if(cbRead <= 0)
+        break;
+
+      if(lpt_process(&fol, pBuf, cbRead))
+        goto the_exit_point;
+
+      lOffset += cbRead;
+      tmLastData = time(NULL);
+      bIdle = 0;
+    }
+
+    if(!bIdle && time(NULL) - tmLastData >= LPT_IDLE_SECONDS)
+    {
+      // the printer has been idle for a while.  finish the current job
+
+      if(lpt_end_page(&fol, 0) || lpt_close_job(&fol))
+        goto the_exit_point;
+
+      bIdle = 1;
+    }
+
+#ifdef __linux__
+    if(iNotify >= 0)
+    {
+      struct pollfd pfd;
+      char evbuf[4096];
+
+      pfd.fd = iNotify;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+
+      if(poll(&pfd, 1, bIdle ? -1 : 1000) > 0) // wake up once a second when not idle
+      {
+        while(read(iNotify, evbuf, sizeof(evbuf)) > 0)
+          { } // drain the events; I only care that something happened
+      }
+
+      continue;
+    }
+#endif // __linux__
+
+    sleep(1);
+  }
+
+  // interrupted - write whatever's left, and finish the job
+
+  iRval = lpt_end_page(&fol, 0);
+
+  if(lpt_close_job(&fol))
+    iRval = -1;
+
+the_exit_point:
+
+  if(fol.pJob)
+    lpt_close_job(&fol);
+
+  if(fol.pPage)
+    free(fol.pPage);
+
+  if(iNotify >= 0)
+    close(iNotify);
+
+  free(pBuf);
+  close(iFD);
+
+  return iRval;
+}
+
+
+// DIRECTORY WATCH MODE
+//
+// Keeps a tape file up to date with a host directory while the files in it are being
+// edited.  The whole tape is written once, and after that only the files that changed
+// are added to the end of it (the newest copy of a file is the last one on the tape).
+// On Linux, 'inotify' says when something in the directory changed, and everywhere
+// else the directory is checked once per second.  Either way, nothing is done until
+// the directory has been quiet for a moment, so that saving a bunch of files at once
+// only updates the tape once.  The files are added the same way as '-s' (see
+// 'commit_tape_files()') so the emulator never sees a half written file.  When the
+// old copies (and deleted files) take up too much of the tape, it's written again.
+
+#define WATCH_SETTLE_MS       500 /* the directory has to be quiet this long */
+#define WATCH_COMPACT_PERCENT 50  /* rewrite when old copies are this much of the live data */
+
+typedef struct _WATCH_FILE_
+{
+  char szName[NAME_MAX + 1];  // host file name (in the directory)
+  uint64_t qwStat;            // 'stat_fingerprint()' when it was written to the tape
+  off_t lSize;
+  off_t cbTape;               // (about) how much of the tape its newest copy uses
+  int bSeen;                  // found in the latest directory scan
+  int bChanged;               // new or changed in the latest directory scan
+  int bEvent;                 // inotify named it since the last scan
+} WATCH_FILE;
+
+typedef struct _WATCH_
+{
+  const char *szDir;
+  const char *szTape;
+  int iDriveSize;
+  const char *szLabel;
+  int bTextMode;
+  WATCH_FILE *pFiles;
+  int nFiles, nMaxFiles;
+  off_t cbLive;               // tape used by the newest copy of each file
+  off_t cbSuperseded;         // tape used by old copies, and deleted files
+  off_t lEnd;                 // position of the end of tape marker (where the next file goes)
+  int iLastSeq;               // sequence number of the last file on the tape
+} WATCH;
+
+static volatile int bWatchQuit = 0;
+
+static void watch_signal_handler(int iSig)
+{
+  bWatchQuit = 1;
+}
+
+// how much of the tape a file uses - header, data blocks, EOF, and the markers
+static off_t watch_tape_bytes(off_t lSize)
+{
+  return 520 + 4 + ((lSize + 511) / 512) * 520 + 4 + 520 + 4;
+}
+
+static WATCH_FILE *watch_find(WATCH *pW, const char *szName)
+{
+int i1;
+
+  for(i1=0; i1 < pW->nFiles; i1++)
+  {
+    if(!strcmp(pW->pFiles[i1].szName, szName))
+      return pW->pFiles + i1;
+  }
+
+  return NULL;
+}
+
+// scans the directory, marking files that are new or have changed, and dropping the
+// ones that are gone.  Returns the number of new or changed files, or < 0 on error.
+int watch_scan(WATCH *pW)
+{
+void *pD;
+int i1, cbDir, nChanged = 0;
+unsigned long dwMode;
+WATCH_FILE *pF;
+struct stat st, stTape;
+char tbuf[PATH_MAX * 2];
+
+  if(stat(pW->szTape, &stTape)) // the tape could be in the same directory
+    memset(&stTape, 0, sizeof(stTape));
+
+  // '*.*' like 'write_the_tape()', or a file without an extension would be appended now
+  // and then left off the tape when it's written again
+
+  snprintf(tbuf, sizeof(tbuf), "%s/*.*", pW->szDir);
+
+  pD = WBAllocDirectoryList(tbuf);
+
+  if(!pD)
+  {
+    fprintf(stderr, "ERROR - unable to get directory list for \"%s\", errno=%d (%xH)\n",
+            pW->szDir, errno, errno);
+
+    return -1;
+  }
+
+  for(i1=0; i1 < pW->nFiles; i1++)
+  {
+    pW->pFiles[i1].bSeen = 0;
+    pW->pFiles[i1].bChanged = 0;
+  }
+
+  cbDir = snprintf(tbuf, sizeof(tbuf), "%s/", pW->szDir);
+
+  while(!WBNextDirectoryEntry(pD, tbuf + cbDir, sizeof(tbuf) - cbDir - 1, &dwMode))
+  {
+    if(!S_ISREG(dwMode) || stat(tbuf, &st) || !S_ISREG(st.st_mode) ||
+       (st.st_dev == stTape.st_dev && st.st_ino == stTape.st_ino) ||
+       strlen(tbuf + cbDir) > NAME_MAX)
+    {
+      continue; // same files as 'write_the_tape()', and not the tape itself
+    }
+
+    pF = watch_find(pW, tbuf + cbDir);
+
+    if(!pF)
+    {
+      if(pW->nFiles >= pW->nMaxFiles)
+      {
+        pF = (WATCH_FILE *)realloc(pW->pFiles, sizeof(*pF) * (pW->nMaxFiles + 64));
+
+        if(!pF)
+        {
+          WBDestroyDirectoryList(pD);
+          return -1;
+        }
+
+        pW->pFiles = pF;
+        pW->nMaxFiles += 64;
+      }
+
+      pF = pW->pFiles + pW->nFiles++;
+
+      memset(pF, 0, sizeof(*pF));
+      strcpy(pF->szName, tbuf + cbDir);
+
+      pF->bChanged = 1;
+    }
+    else if(pF->bEvent || pF->qwStat != stat_fingerprint(&st))
+    {
+      pF->bChanged = 1;
+    }
+
+    pF->bSeen = 1;
+    pF->bEvent = 0;
+    pF->qwStat = stat_fingerprint(&st);
+    pF->lSize = st.st_size;
+
+    if(pF->bChanged)
+      nChanged++;
+  }
+
+  WBDestroyDirectoryList(pD);
+
+  // the files that are gone are still on the tape, but they don't count
+
+  for(i1=0; i1 < pW->nFiles; )
+  {
+    if(pW->pFiles[i1].bSeen)
+    {
+      i1++;
+      continue;
+    }
+
+    fprintf(stderr, "  REMOVED   \"%s\"\n", pW->pFiles[i1].szName);
+
+    pW->cbLive -= pW->pFiles[i1].cbTape;
+    pW->cbSuperseded += pW->pFiles[i1].cbTape;
+
+    pW->pFiles[i1] = pW->pFiles[--(pW->nFiles)];
+  }
+
+  return nChanged;
+}
+
+// writes the whole tape again, as a new file that replaces the old one all at once
+int watch_rewrite(WATCH *pW)
+{
+int i1, iRval;
+FILE *pTape;
+char tbuf[PATH_MAX + 8];
+
+  snprintf(tbuf, sizeof(tbuf), "%s.tmp~", pW->szTape);
+
+  pTape = fopen(tbuf, "w+");
+
+  if(!pTape)
+  {
+    fprintf(stderr, "Unable to open tape file \"%s\", errno=%d (%xH)\n", tbuf, errno, errno);
+    return -1;
+  }
+
+  setvbuf(pTape, NULL, _IOFBF, TAPE_BUFSIZE);
+
+  iRval = write_the_tape(pTape, tbuf, pW->szDir, 0, pW->iDriveSize, pW->szLabel, pW->bTextMode,
+                         NULL, NULL, 0, NULL, 0);
+
+  // where the end of tape is, and the last sequence number, so that 'watch_append()'
+  // can go straight there.  The whole tape was just written, so reading it once more
+  // (from the cache) is cheap by comparison.
+
+  if(!iRval && (fseeko(pTape, 0, SEEK_SET) ||
+                read_the_tape(pTape, tbuf, NULL, 0, 0, 0, 0, 1, &(pW->iLastSeq), 0, NULL, NULL)))
+  {
+    iRval = -1;
+  }
+
+  pW->lEnd = ftello(pTape);
+
+  if(!iRval && !pW->iDriveSize)
+    iRval = fit_tape_size(pTape, tbuf, pW->lEnd, 0);
+
+  if(fclose(pTape) || iRval || rename(tbuf, pW->szTape))
+  {
+    fprintf(stderr, "ERROR - unable to write tape file \"%s\", errno=%d (%xH)\n",
+            pW->szTape, errno, errno);
+
+    unlink(tbuf);
+    return -1;
+  }
+
+  pW->cbLive = 0;
+  pW->cbSuperseded = 0;
+
+  for(i1=0; i1 < pW->nFiles; i1++)
+  {
+    pW->pFiles[i1].cbTape = watch_tape_bytes(pW->pFiles[i1].lSize);
+    pW->cbLive += pW->pFiles[i1].cbTape;
+  }
+
+  fprintf(stderr, "  WROTE     \"%s\", %d files\n", pW->szTape, pW->nFiles);
+
+  return 0;
+}
+
+// adds the files that changed to the end of the tape
+int watch_append(WATCH *pW)
+{
+int i1, iRval = -1, iSeq = 0, bFirst = 1;
+off_t lCommit = 0;
+FILE *pTape;
+char tbuf[PATH_MAX * 2];
+
+  pTape = fopen(pW->szTape, "r+");
+
+  if(!pTape)
+  {
+    fprintf(stderr, "Unable to open tape file \"%s\", errno=%d (%xH)\n", pW->szTape, errno, errno);
+    return -1;
+  }
+
+  setvbuf(pTape, NULL, _IOFBF, TAPE_BUFSIZE);
+
+  // the end of tape is known from the last rewrite or append, so the tape isn't read
+
+  iSeq = pW->iLastSeq;
+
+  if(fseeko(pTape, pW->lEnd, SEEK_SET))
+  {
+    fprintf(stderr, "ERROR - unable to find end of tape \"%s\"\n", pW->szTape);
+    goto the_exit_point;
+  }
+
+  for(i1=0; i1 < pW->nFiles; i1++)
+  {
+    if(!pW->pFiles[i1].bChanged)
+      continue;
+
+    snprintf(tbuf, sizeof(tbuf), "%s/%s", pW->szDir, pW->pFiles[i1].szName);
+
+    if(bFirst)
+      lCommit = ftello(pTape);
+
+    if(write_single_file_to_tape(pTape, tbuf, &iSeq, pW->bTextMode, NULL, bFirst, NULL, NULL))
+      goto the_exit_point;
+
+    bFirst = 0;
+
+    if(pW->pFiles[i1].cbTape) // the old copy is still there
+    {
+      pW->cbLive -= pW->pFiles[i1].cbTape;
+      pW->cbSuperseded += pW->pFiles[i1].cbTape;
+    }
+
+    pW->pFiles[i1].cbTape = watch_tape_bytes(pW->pFiles[i1].lSize);
+    pW->cbLive += pW->pFiles[i1].cbTape;
+
+    fprintf(stderr, "  UPDATED   \"%s\"\n", pW->pFiles[i1].szName);
+  }
+
+  if(!bFirst && commit_tape_files(pTape, lCommit, NULL, iSeq, tbuf))
+    goto the_exit_point;
+
+  pW->lEnd = ftello(pTape); // 'commit_tape_files()' leaves it at the end of tape marker
+  pW->iLastSeq = iSeq;
+
+  iRval = 0;
+
+the_exit_point:
+  if(fclose(pTape))
+    iRval = -1;
+
+  return iRval;
+}
+
+int watch_directory(const char *szDir, const char *szTape, int iDriveSize, const char *szLabel, int bTextMode)
+{
+int iRval = -1, iNotify = -1, nChanged;
+WATCH w;
+
+  memset(&w, 0, sizeof(w));
+  w.szDir = szDir;
+  w.szTape = szTape;
+  w.iDriveSize = iDriveSize;
+  w.szLabel = szLabel;
+  w.bTextMode = bTextMode;
+
+#ifdef __linux__
+  iNotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+  if(iNotify >= 0 &&
+     inotify_add_watch(iNotify, szDir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM |
+                                       IN_DELETE | IN_ATTRIB | IN_MODIFY) < 0)
+  {
+    close(iNotify);
+    iNotify = -1;
+  }
+
+  if(iNotify < 0 && DEBUG_OUTPUT_WARN)
+    fprintf(stderr, "WARNING - inotify not available, errno=%d (%xH), polling instead\n", errno, errno);
+#endif // __linux__
+
+  signal(SIGINT, watch_signal_handler);
+  signal(SIGTERM, watch_signal_handler);
+
+  // start with a tape that has everything on it
+
+  if(watch_scan(&w) < 0 || watch_rewrite(&w))
+    goto the_exit_point;
+
+  fprintf(stderr, "Watching \"%s\" - press CTRL+C to stop\n", szDir);
+
+  while(!bWatchQuit)
+  {
+#ifdef __linux__
+    if(iNotify >= 0)
+    {
+      struct pollfd pfd;
+      char evbuf[4096];
+      const struct inotify_event *pEv;
+      ssize_t cbRead, cb1;
+      WATCH_FILE *pF;
+      int nEvents = 0;
+
+      pfd.fd = iNotify;
+      pfd.events = POLLIN;
+
+      // wait for something to happen, then for it to stop happening
+
+      while(!bWatchQuit && poll(&pfd, 1, nEvents ? WATCH_SETTLE_MS : -1) > 0)
+      {
+        // a file that's named is checked again even if 'stat()' can't tell that it
+        // changed (it was written twice within the file system's time resolution)
+
+        while((cbRead = read(iNotify, evbuf, sizeof(evbuf))) > 0)
+        {
+          for(cb1=0; cb1 < cbRead; cb1 += sizeof(*pEv) + pEv->len)
+          {
+            pEv = (const struct inotify_event *)(evbuf + cb1);
+            nEvents++;
+
+            if(pEv->len && (pF = watch_find(&w, pEv->name)))
+              pF->bEvent = 1;
+          }
+        }
+
+        pfd.revents = 0;
+      }
+
+      if(!nEvents)
+        continue;
+    }
+    else
+#endif // __linux__
+    {
+      sleep(1);
+    }
+
+    if(bWatchQuit)
+      break;
+
+    nChanged = watch_scan(&w);
+
+    if(nChanged < 0 || (nChanged > 0 && watch_append(&w)))
+      goto the_exit_point;
+
+    if(w.cbSuperseded > 0 &&
+       w.cbSuperseded * 100 >= w.cbLive * WATCH_COMPACT_PERCENT &&
+       watch_rewrite(&w))
+    {
+      goto the_exit_point;
+    }
+  }
+
+  iRval = 0;
+
+the_exit_point:
+  if(iNotify >= 0)
+    close(iNotify);
+
+  if(w.pFiles)
+    free(w.pFiles);
+
+  return iRval;
+}
+
+
+static const short aDays[13]=
+{
+  1,
+  1 + 31,
+  1 + 31 + 28,
+  1 + 31 + 28 + 31,
+  1 + 31 + 28 + 31 + 30,
+  1 + 31 + 28 + 31 + 30 + 31,
+  1 + 31 + 28 + 31 + 30 + 31 + 30,
+  1 + 31 + 28 + 31 + 30 + 31 + 30 + 31,
+  1 + 31 + 28 + 31 + 30 + 31 + 30 + 31 + 31,
+  1 + 31 + 28 + 31 + 30 + 31 + 30 + 31 + 31 + 30,
+  1 + 31 + 28 + 31 + 30 + 31 + 30 + 31 + 31 + 30 + 31,
+  1 + 31 + 28 + 31 + 30 + 31 + 30 + 31 + 31 + 30 + 31 + 30,
+  1 + 31 + 28 + 31 + 30 + 31 + 30 + 31 + 31 + 30 + 31 + 30 + 31
+};
+static const short aDaysLeap[13]=
+{
+  1,
+  1 + 31,
+  1 + 31 + 29,
+  1 + 31 + 29 + 31,
+  1 + 31 + 29 + 31 + 30,
+  1 + 31 + 29 + 31 + 30 + 31,
+  1 + 31 + 29 + 31 + 30 + 31 + 30,
+  1 + 31 + 29 + 31 + 30 + 31 + 30 + 31,
+  1 + 31 + 29 + 31 + 30 + 31 + 30 + 31 + 31,
+  1 + 31 + 29 + 31 + 30 + 31 + 30 + 31 + 31 + 30,
+  1 + 31 + 29 + 31 + 30 + 31 + 30 + 31 + 31 + 30 + 31,
+  1 + 31 + 29 + 31 + 30 + 31 + 30 + 31 + 31 + 30 + 31 + 30,
+  1 + 31 + 29 + 31 + 30 + 31 + 30 + 31 + 31 + 30 + 31 + 30 + 31
+};
+
+int days_since_year_start(int iYear, int iMonth, int iDay)
+{
+const short *pD;
+
+  if((iYear % 400) == 0 ||
+     ((iYear % 4) == 0 && (iYear % 100) != 0)) // leap year
+  {
+    pD = aDaysLeap;
+  }
+  else
+  {
+    pD = aDays;
+  }
+
+  if(iMonth >= 1 && iMonth <= 12)
+    return pD[iMonth - 1] + iDay - 1;
+
+  return 0; // an error, really
+}
+
+void mdy_from_days_since_year_start(int iYear, int nDays, int *piMonth, int *piDay)
+{
+const short *pD;
+
+  if((iYear % 400) == 0 ||
+     ((iYear % 4) == 0 && (iYear % 100) != 0)) // leap year
+  {
+    pD = aDaysLeap;
+  }
+  else
+  {
+    pD = aDays;
+  }
+
+  for(*piMonth=1; *piMonth < 12; (*piMonth)++) // month is 1-based, as is day in year
+  {
+    if(nDays < pD[*piMonth]) // found entry with more days than current one
+      break;
+  }
+
+  *piDay = 1 + nDays - pD[*piMonth - 1]; // day is also 1-based
+
+  if(*piMonth < 1 || *piMonth > 12 || *piDay < 1 || *piDay > 31)
+  {
+    fprintf(stderr, "ERROR - insane month/days from year start:  iYear=%d  nDays=%d  iMonth=%d  iDay=%d\n",
+            iYear, nDays, *piMonth, *piDay);
+  }
+}
+
+void rt11_date(const char *pDate, int *piYear, int *piDayInYear)
+{
+int iYear, iDay;
+
+  // ignore first character if it's a space, otherwise # of years since 1900
+  // format the date from the following information:
+  //
+  // YYYddd  where 'YYY' is years since 1900, and 'ddd' is days since Jan 1 (inclusive)
+
+  if(*pDate >= '0' && *pDate <= '9')
+    iYear = 1900 + 100 * (*pDate - '0');
+  else
+    iYear = 1900;
+
+  iYear += 10 * (pDate[1] - '0') + (pDate[2] - '0');
+
+  iDay = 100 * (pDate[3] - '0')
+       + 10 * (pDate[4] - '0')
+       + (pDate[5] - '0');
+
+  if(iDay < 1 || iDay > 366)
+  {
+    fprintf(stderr, "ERROR - insane 'day' value: \"%s\" --> iYear=%d, iDay=%d\n",
+            pDate, iYear, iDay);
+  }
+
+  if(piYear)
+    *piYear = iYear;
+
+  if(piDayInYear)
+    *piDayInYear = iDay;
+}
+
+const char *rt11_date_string(const char *pDate)
+{
+int iYear, iDay, iMonth;
+static char szRval[16];
+static const char * const aszMonthNames[13]=
+{
+  "???","Jan","Feb","Mar","Apr","May","Jun","Jul","Aug","Sep","Oct","Nov","Dec"
+};
+
+  rt11_date(pDate, &iYear, &iDay);
+  mdy_from_days_since_year_start(iYear, iDay, &iMonth, &iDay);
+
+  if(iDay < 1 || iDay > 30 || iMonth < 1 || iMonth > 12)
+  {
+    fprintf(stderr, "ERROR - insane dates - \"%s\" --> iYear=%d, iMonth=%d iDay=%d\n",
+            pDate, iYear, iMonth, iDay);
+  }
+
+  snprintf(szRval, sizeof(szRval), "%02d-%s-%02d",
+           (iDay % 100),
+           aszMonthNames[iMonth], // 1-based month
+           (iYear % 100));
+
+  return szRval;
+}
+
+
+void format_rt11_file_name(const char *szSourceFile, char *pBuf, int cbBuf)
+{
+int i1;
+const char *p1c;
+char *p1, *p2;
+char tbuf[64];
+char name[7];
+char ext[4];
+
+  memset(tbuf, 0, sizeof(tbuf));
+
+  // the filename must be a 6.3 name, upper case.
+  p1c = strrchr(szSourceFile, '/'); // if it has a directory in it, find the '/'
+  if(p1c)
+    p1c++;
+  else
+    p1c = szSourceFile;
+
+  memset(tbuf, 0, sizeof(tbuf));
+  memset(name, 0, sizeof(name));
+  memset(ext, 0, sizeof(ext));
+
+  strncpy(tbuf, p1c, sizeof(tbuf)-1);
+
+  // convert to upper case.  Name must be RAD50 char, 0-9 A-Z $ ? or space,
+  // in the format NNNNNN.EEE  with trailing white space to justify
+
+  p1 = tbuf;
+  while(*p1 && *p1 != '.')
+  {
+    char c1 = toupper(*p1);
+    if((c1 < '0' && c1 > '9') &&
+       (c1 < 'A' && c1 > 'Z') &&
+       (c1 != '$' && c1 != '?' && c1 != ' '))
+    {
+      c1 = '?'; // sub in '?' for bad chars
+    }
+
+    *(p1++) = c1;
+  }
+
+  i1 = p1 - tbuf;
+  if(i1 > 6)
+    i1 = 6;
+
+  if(i1 > 0)
+    memcpy(name, tbuf, i1);
+
+  if(i1 < 6)
+    memset(name + i1, ' ', 6 - i1);
+
+  name[6] = 0;
+
+  if(!*p1) // no extension
+  {
+    p2 = p1;
+  }
+  else
+  {
+    p1++;
+    p2 = p1;
+
+//    fprintf(stderr, "    HERE:  \"%s\"\n", p1);
+
+    while(*p1)
+    {
+      char c1 = toupper(*p1);
+      if((c1 < '0' && c1 > '9') &&
+         (c1 < 'A' && c1 > 'Z') &&
+         (c1 != '$' && c1 != '?' && c1 != ' '))
+      {
+        c1 = '?'; // sub in '?' for bad chars
+      }
+
+      *(p1++) = c1;
+    }
+
+//    fprintf(stderr, "    HERE:  \"%s\" len=%d\n", p2, p1 - p2);
+  }
+
+  i1 = p1 - p2;
+  if(i1 > 3)
+    i1 = 3;
+
+  if(i1 > 0)
+    memcpy(ext, p2, i1);
+
+  if(i1 < 3)
+    memset(ext + i1, ' ', 3 - i1);
+
+  ext[3] = 0;
+
+//  fprintf(stderr, "    TEMPORARY:  %s becomes \"%s.%s\"\n",
+//          szSourceFile, name, ext);
+
+  // format file name into output buffer
+
+  if(cbBuf > 6)
+  {
+    memcpy(pBuf, name, 6);
+    pBuf += 6;
+    cbBuf -= 6;
+  }
+  else if(cbBuf > 0)
+  {
+    memcpy(pBuf, name, cbBuf);
+    cbBuf = 0;
+  }
+
+  if(cbBuf > 0)
+  {
+    *(pBuf++) = '.';
+    cbBuf --;
+  }
+
+  if(cbBuf > 3)
+  {
+    memcpy(pBuf, ext, 3);
+    pBuf += 3;
+    cbBuf -= 3;
+  }
+  else if(cbBuf > 0)
+  {
+    memcpy(pBuf, ext, cbBuf);
+    cbBuf = 0;
+  }
+
+  if(cbBuf > 0)
+    *pBuf = 0;
+}
+
+
+// PARALLEL WORK
+//
+// Runs 'pfnWork' for items 0 through 'nItems - 1' on up to 'nThreads' threads (including
+// the calling one).  Each thread takes the next item as soon as it's done with one, so
+// it doesn't matter if some items take much longer than others.
+
+typedef struct _PARALLEL_WORK_
+{
+  void (*pfnWork)(void *pContext, int iItem);
+  void *pContext;
+  int nItems;
+  int iNext;              // next item to work on
+  pthread_mutex_t mutex;  // protects 'iNext'
+} PARALLEL_WORK;
+
+static void *parallel_work_thread(void *pArg)
+{
+PARALLEL_WORK *pPW = (PARALLEL_WORK *)pArg;
+int iItem;
+
+  while(1)
+  {
+    pthread_mutex_lock(&(pPW->mutex));
+    iItem = pPW->iNext++;
+    pthread_mutex_unlock(&(pPW->mutex));
+
+    if(iItem >= pPW->nItems)
+      break;
+
+    pPW->pfnWork(pPW->pContext, iItem);
+  }
+
+  return NULL;
+}
+
+int run_in_parallel(int nThreads, int nItems, void (*pfnWork)(void *pContext, int iItem), void *pContext)
+{
+int i1, nStarted;
+pthread_t *pThreads;
+PARALLEL_WORK pw;
+
+  if(nThreads > nItems)
+    nThreads = nItems;
+
+  pw.pfnWork = pfnWork;
+  pw.pContext = pContext;
+  pw.nItems = nItems;
+  pw.iNext = 0;
+
+  if(nThreads <= 1)
+  {
+    for(i1=0; i1 < nItems; i1++)
+      pfnWork(pContext, i1);
+
+    return 0;
+  }
+
+  pThreads = (pthread_t *)malloc(sizeof(*pThreads) * (nThreads - 1));
+
+  if(!pThreads)
+    return -1;
+
+  pthread_mutex_init(&(pw.mutex), NULL);
+
+  for(nStarted=0; nStarted < nThreads - 1; nStarted++)
+  {
+    if(pthread_create(&(pThreads[nStarted]), NULL, parallel_work_thread, &pw))
+      break; // the threads that did start (and this one) will do the work
+  }
+
+  parallel_work_thread(&pw);
+
+  for(i1=0; i1 < nStarted; i1++)
+    pthread_join(pThreads[i1], NULL);
+
+  pthread_mutex_destroy(&(pw.mutex));
+  free(pThreads);
+
+  return 0;
+}
+
+// the default number of threads, one per CPU
+int default_thread_count(void)
+{
+long lCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return lCPUs > 0 ? (int)lCPUs : 1;
+}
+
+
+// TAPE WALKER
+//
+// 'walk_tape()' reads a tape from the beginning, calling back for each file header,
+// data block, and EOF record.  It's simpler than 'read_the_tape()' (no output and no
+// special cases other than the boot block), for things that only need to look at the
+// files on a tape.  'ZEROED.ZZZ' shows up as a file with sequence number 0.
+
+struct _TAPE_WALK_ // typedef'd as TAPE_WALK
+{
+  // each callback returns non-zero to stop.  Any of them can be NULL.
+  int (*pfnFile)(void *pContext, const RT11_FILE_HEADER *pFile, off_t lPos);
+  int (*pfnData)(void *pContext, const uint8_t *pData);
+  int (*pfnEOF)(void *pContext, const RT11_FILE_EOF *pEOF, int nBlocks);
+  void *pContext;
+  int bTape;          // on return, non-zero if it has a volume header or a file
+};
+
+// returns 0 at the end of the tape, or after a callback returns non-zero, and
+// a negative value if the tape is damaged (the callbacks got everything before that)
+int walk_tape(FILE *pTape, TAPE_WALK *pW)
+{
+int i1, nBlocks, bFirst = 1;
+off_t lPos;
+RT11_FILE_HEADER file;
+RT11_FILE_EOF eof;
+uint8_t data[512];
+
+  pW->bTape = 0;
+
+  fseeko(pTape, 0, SEEK_SET);
+
+  while(1)
+  {
+    lPos = ftello(pTape);
+
+    i1 = read_tape_block(pTape, &file);
+
+    if(i1 > 0)
+      return 0; // end of tape
+
+    if(i1 < 0)
+      return pW->bTape ? -1 : 0; // not a tape unless I've seen a header
+
+    if(bFirst && !memcmp(file.label_identifier, "VOL", 3))
+    {
+      pW->bTape = 1;
+      continue;
+    }
+
+    if(memcmp(file.label_identifier, "HDR", 3) || file.label_number != '1')
+    {
+      if(bFirst && pW->bTape) // a boot block
+      {
+        bFirst = 0;
+        continue;
+      }
+
+      return pW->bTape ? -1 : 0;
+    }
+
+    pW->bTape = 1;
+    bFirst = 0;
+
+    if(pW->pfnFile && pW->pfnFile(pW->pContext, &file, lPos))
+      return 0;
+
+    // data marker, data blocks, data marker, EOF1, data marker
+
+    if(fread(data, 4, 1, pTape) != 1 || memcmp(data, DATA_MARKER, 4))
+      return -1;
+
+    for(nBlocks=0; !(i1 = read_tape_block(pTape, data)); nBlocks++)
+    {
+      if(pW->pfnData && pW->pfnData(pW->pContext, data))
+        return 0;
+    }
+
+    if(i1 < 0 || read_tape_block(pTape, &eof) ||
+       memcmp(eof.label_identifier, "EOF", 3) ||
+       fread(data, 4, 1, pTape) != 1 || memcmp(data, DATA_MARKER, 4))
+    {
+      return -1;
+    }
+
+    if(pW->pfnEOF && pW->pfnEOF(pW->pContext, &eof, nBlocks))
+      return 0;
+  }
+}
+
+// returns non-zero if 'pFile' is the next section of the file 'pPrev'
+int is_next_file_section(const RT11_FILE_HEADER *pPrev, const RT11_FILE_HEADER *pFile)
+{
+char tbuf[8], tbuf2[8];
+
+  if(memcmp(pPrev->file_identifier, pFile->file_identifier, sizeof(pFile->file_identifier)) ||
+     memcmp(pPrev->file_sequence_number, pFile->file_sequence_number, sizeof(pFile->file_sequence_number)))
+  {
+    return 0;
+  }
+
+  memcpy(tbuf, pPrev->file_section_number, sizeof(pPrev->file_section_number));
+  tbuf[sizeof(pPrev->file_section_number)] = 0;
+
+  memcpy(tbuf2, pFile->file_section_number, sizeof(pFile->file_section_number));
+  tbuf2[sizeof(pFile->file_section_number)] = 0;
+
+  return atoi(tbuf2) == atoi(tbuf) + 1;
+}
+
+
+// TAPE CATALOG
+//
+// A catalog is an index of the files on a whole library of tape files, so that a file
+// can be found without reading every tape.  Each tape is read once, and the catalog
+// keeps its 'stat_fingerprint()' and size so that only new or changed tapes are read
+// again when the catalog is updated.  Tapes are read in parallel.
+//
+// The catalog file is a header, the tape table, the tape file names, and then the file
+// entries, sorted by name.  File names are packed as RAD50 (3 words for a 6.3 name, the
+// same as RT11 does), so that looking up a name is a binary search of the entries.
+
+#define CATALOG_MAGIC "DTCATLG1"
+
+typedef struct _CATALOG_HEADER_
+{
+  char szMagic[8];     // CATALOG_MAGIC
+  uint32_t nTapes;     // entries in the tape table
+  uint32_t nEntries;   // file entries
+  uint64_t cbNames;    // size of the tape file names, following the tape table
+} CATALOG_HEADER;
+
+typedef struct _CATALOG_TAPE_RECORD_
+{
+  uint64_t qwStat;     // 'stat_fingerprint()' of the tape file (an older catalog has the
+                       // modification time here, so its tapes are all read again once)
+  int64_t lSize;       // size of the tape file
+  uint32_t dwName;     // offset of the tape file name in the names
+  uint32_t nEntries;   // number of files on the tape
+} CATALOG_TAPE_RECORD;
+
+typedef struct _CATALOG_ENTRY_
+{
+  uint64_t lOffset;    // position of the (first) HDR1 for the file on the tape
+  uint32_t dwDate;     // creation date as YYYYDDD, or 0 if there isn't one
+  uint32_t nBlocks;    // blocks in the file (all sections)
+  uint32_t iTape;      // index into the tape table
+  uint16_t wName[3];   // RAD50 file name (2 words) and extension
+  uint16_t wSeq;       // file sequence number
+} CATALOG_ENTRY;
+
+typedef struct _CATALOG_TAPE_
+{
+  char *szName;              // full path of the tape file
+  uint64_t qwStat;
+  int64_t lSize;
+  CATALOG_ENTRY *pEntries;   // files on the tape
+  int nEntries, nMaxEntries;
+  int bRead;                 // new or changed, so it must be read
+  int bTape;                 // non-zero if it's a tape (or still might be)
+} CATALOG_TAPE;
+
+typedef struct _CATALOG_
+{
+  CATALOG_TAPE *pTapes;
+  int nTapes, nMaxTapes;
+  int nSorted;               // the first 'nSorted' tapes are sorted by name
+} CATALOG;
+
+static const char szRAD50[] = " ABCDEFGHIJKLMNOPQRSTUVWXYZ$.%0123456789";
+
+// packs up to 3 characters as a RAD50 word.  Characters that aren't in the RAD50
+// character set are stored as '%'.
+uint16_t rad50_word(const char *pText, int cbText)
+{
+int i1, iChar;
+uint16_t wRval = 0;
+const char *p1;
+
+  for(i1=0; i1 < 3; i1++)
+  {
+    iChar = 0; // space
+
+    if(i1 < cbText && pText[i1] && pText[i1] != ' ')
+    {
+      p1 = strchr(szRAD50 + 1, toupper((unsigned char)pText[i1]));
+      iChar = p1 ? (int)(p1 - szRAD50) : 29;
+    }
+
+    wRval = wRval * 40 + iChar;
+  }
+
+  return wRval;
+}
+
+// packs a file name like "NAME.EXT" or a tape file identifier "NAME  .EXT" as RAD50
+void rad50_file_name(const char *pName, int cbName, uint16_t wName[3])
+{
+int cbBase, cbExt;
+const char *pExt;
+
+  while(cbName > 0 && pName[cbName - 1] == ' ')
+    cbName--;
+
+  pExt = cbName > 0 ? (const char *)memchr(pName, '.', cbName) : NULL;
+  cbBase = pExt ? (int)(pExt - pName) : cbName;
+  cbExt = pExt ? cbName - cbBase - 1 : 0;
+
+  while(cbBase > 0 && pName[cbBase - 1] == ' ')
+    cbBase--;
+
+  wName[0] = rad50_word(pName, cbBase);
+  wName[1] = cbBase > 3 ? rad50_word(pName + 3, cbBase - 3) : 0;
+  wName[2] = pExt ? rad50_word(pExt + 1, cbExt) : 0;
+}
+
+// unpacks a RAD50 file name as "NAME.EXT" (no spaces).  'pBuf' must be at least 12 bytes.
+char *rad50_to_file_name(const uint16_t wName[3], char *pBuf)
+{
+int i1, i2;
+unsigned int w1;
+char *p1 = pBuf;
+char tbuf[3];
+
+  for(i1=0; i1 < 3; i1++)
+  {
+    if(i1 == 2 && wName[2])
+      *(p1++) = '.';
+
+    for(i2=2, w1=wName[i1]; i2 >= 0; i2--, w1 /= 40) // most significant character first
+      tbuf[i2] = szRAD50[w1 % 40];
+
+    for(i2=0; i2 < 3; i2++)
+    {
+      if(tbuf[i2] != ' ')
+        *(p1++) = tbuf[i2];
+    }
+  }
+
+  *p1 = 0;
+
+  return pBuf;
+}
+
+// the RT11 creation date ("YYYddd", years since 1900) as YYYYDDD, or 0 if there isn't one
+uint32_t catalog_date(const char *pDate)
+{
+int i1, iYear, iDay;
+
+  for(i1=1; i1 < 6; i1++)
+  {
+    if(pDate[i1] < '0' || pDate[i1] > '9')
+      return 0;
+  }
+
+  iYear = 1900 + (pDate[0] >= '0' && pDate[0] <= '9' ? 100 * (pDate[0] - '0') : 0)
+        + 10 * (pDate[1] - '0') + (pDate[2] - '0');
+  iDay = 100 * (pDate[3] - '0') + 10 * (pDate[4] - '0') + (pDate[5] - '0');
+
+  if(iDay < 1 || iDay > 366)
+    return 0;
+
+  return (uint32_t)(iYear * 1000 + iDay);
+}
+
+int catalog_add_entry(CATALOG_TAPE *pT, const CATALOG_ENTRY *pEntry)
+{
+CATALOG_ENTRY *pNew;
+
+  if(pT->nEntries >= pT->nMaxEntries)
+  {
+    pNew = (CATALOG_ENTRY *)realloc(pT->pEntries, sizeof(*pNew) * (pT->nMaxEntries + 64));
+
+    if(!pNew)
+      return -1;
+
+    pT->pEntries = pNew;
+    pT->nMaxEntries += 64;
+  }
+
+  pT->pEntries[pT->nEntries++] = *pEntry;
+
+  return 0;
+}
+
+typedef struct _CATALOG_READ_
+{
+  CATALOG_TAPE *pT;
+  RT11_FILE_HEADER prev;   // the previous file header, for file sections
+  int bPrev, bContinued;
+  CATALOG_ENTRY entry;     // the current file
+} CATALOG_READ;
+
+static int catalog_read_file(void *pContext, const RT11_FILE_HEADER *pFile, off_t lPos)
+{
+CATALOG_READ *pCR = (CATALOG_READ *)pContext;
+char tbuf[8];
+
+  pCR->bContinued = pCR->bPrev && is_next_file_section(&(pCR->prev), pFile);
+  pCR->prev = *pFile;
+  pCR->bPrev = 1;
+
+  if(pCR->bContinued) // the next section of the same file adds to the same entry
+    return 0;
+
+  memcpy(tbuf, pFile->file_sequence_number, sizeof(pFile->file_sequence_number));
+  tbuf[sizeof(pFile->file_sequence_number)] = 0;
+
+  memset(&(pCR->entry), 0, sizeof(pCR->entry));
+  rad50_file_name(pFile->file_identifier, sizeof(pFile->file_identifier), pCR->entry.wName);
+
+  pCR->entry.wSeq = (uint16_t)atoi(tbuf);
+  pCR->entry.lOffset = (uint64_t)lPos;
+  pCR->entry.dwDate = catalog_date(pFile->creation_date);
+
+  return 0;
+}
+
+static int catalog_read_eof(void *pContext, const RT11_FILE_EOF *pEOF, int nBlocks)
+{
+CATALOG_READ *pCR = (CATALOG_READ *)pContext;
+
+  if(!pCR->entry.wSeq) // 'ZEROED.ZZZ'
+    return 0;
+
+  if(pCR->bContinued && pCR->pT->nEntries > 0)
+  {
+    pCR->pT->pEntries[pCR->pT->nEntries - 1].nBlocks += nBlocks;
+    return 0;
+  }
+
+  pCR->entry.nBlocks = (uint32_t)nBlocks;
+
+  return catalog_add_entry(pCR->pT, &(pCR->entry));
+}
+
+// reads the file headers from one tape.  This runs on a worker thread (see
+// 'run_in_parallel()'), so it only uses its own 'CATALOG_TAPE' and 'FILE'.
+void catalog_read_tape(void *pContext, int iItem)
+{
+CATALOG_TAPE *pT = ((CATALOG *)pContext)->pTapes + iItem;
+FILE *pTape;
+CATALOG_READ cr;
+TAPE_WALK walk;
+
+  if(!pT->bRead)
+    return;
+
+  pT->nEntries = 0;
+  pT->bTape = 0;
+
+  pTape = fopen(pT->szName, "r");
+
+  if(!pTape)
+  {
+    fprintf(stderr, "Unable to open tape file \"%s\" - errno=%d (%xH)\n",
+            pT->szName, errno, errno);
+    return;
+  }
+
+  setvbuf(pTape, NULL, _IOFBF, 65536);
+
+  memset(&cr, 0, sizeof(cr));
+  cr.pT = pT;
+
+  memset(&walk, 0, sizeof(walk));
+  walk.pfnFile = catalog_read_file;
+  walk.pfnEOF = catalog_read_eof;
+  walk.pContext = &cr;
+
+  if(walk_tape(pTape, &walk) && DEBUG_OUTPUT_WARN) // keep what I have so far
+    fprintf(stderr, "*WARN* - \"%s\" is damaged at position %lld\n",
+            pT->szName, (long long)ftello(pTape));
+
+  pT->bTape = walk.bTape;
+
+  fclose(pTape);
+}
+
+static int catalog_tape_compare(const void *p1, const void *p2)
+{
+  return strcmp(((const CATALOG_TAPE *)p1)->szName, ((const CATALOG_TAPE *)p2)->szName);
+}
+
+int rad50_name_compare(const uint16_t wName1[3], const uint16_t wName2[3])
+{
+int i1;
+
+  for(i1=0; i1 < 3; i1++)
+  {
+    if(wName1[i1] != wName2[i1])
+      return wName1[i1] < wName2[i1] ? -1 : 1;
+  }
+
+  return 0;
+}
+
+static int catalog_entry_compare(const void *p1, const void *p2)
+{
+const CATALOG_ENTRY *pE1 = (const CATALOG_ENTRY *)p1;
+const CATALOG_ENTRY *pE2 = (const CATALOG_ENTRY *)p2;
+int i1;
+
+  i1 = rad50_name_compare(pE1->wName, pE2->wName);
+
+  if(i1)
+    return i1;
+
+  if(pE1->dwDate != pE2->dwDate)
+    return pE1->dwDate < pE2->dwDate ? -1 : 1;
+
+  if(pE1->iTape != pE2->iTape)
+    return pE1->iTape < pE2->iTape ? -1 : 1;
+
+  return (int)pE1->wSeq - (int)pE2->wSeq;
+}
+
+void catalog_free(CATALOG *pC)
+{
+int i1;
+
+  for(i1=0; i1 < pC->nTapes; i1++)
+  {
+    free(pC->pTapes[i1].szName);
+
+    if(pC->pTapes[i1].pEntries)
+      free(pC->pTapes[i1].pEntries);
+  }
+
+  if(pC->pTapes)
+    free(pC->pTapes);
+
+  memset(pC, 0, sizeof(*pC));
+}
+
+CATALOG_TAPE *catalog_add_tape(CATALOG *pC, const char *szName)
+{
+CATALOG_TAPE *pNew;
+
+  if(pC->nTapes >= pC->nMaxTapes)
+  {
+    pNew = (CATALOG_TAPE *)realloc(pC->pTapes, sizeof(*pNew) * (pC->nMaxTapes + 256));
+
+    if(!pNew)
+      return NULL;
+
+    pC->pTapes = pNew;
+    pC->nMaxTapes += 256;
+  }
+
+  pNew = pC->pTapes + pC->nTapes;
+  memset(pNew, 0, sizeof(*pNew));
+
+  pNew->szName = strdup(szName);
+
+  if(!pNew->szName)
+    return NULL;
+
+  pNew->bTape = 1;
+  pC->nTapes++;
+
+  return pNew;
+}
+
+// maps an existing catalog file into memory, and checks that it's valid.  Returns the
+// address and size (for 'munmap()'), or NULL if it can't be read.
+void *catalog_map(const char *szCatalog, size_t *pcbCatalog)
+{
+int iFD;
+struct stat st;
+void *pRval;
+const CATALOG_HEADER *pH;
+
+  iFD = open(szCatalog, O_RDONLY | O_CLOEXEC);
+
+  if(iFD < 0)
+    return NULL;
+
+  if(fstat(iFD, &st) || st.st_size < (off_t)sizeof(CATALOG_HEADER))
+  {
+    close(iFD);
+    return NULL;
+  }
+
+  pRval = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, iFD, 0);
+  close(iFD);
+
+  if(pRval == MAP_FAILED)
+    return NULL;
+
+  pH = (const CATALOG_HEADER *)pRval;
+
+  if(memcmp(pH->szMagic, CATALOG_MAGIC, sizeof(pH->szMagic)) ||
+     sizeof(*pH) + (uint64_t)pH->nTapes * sizeof(CATALOG_TAPE_RECORD) + pH->cbNames
+       + (uint64_t)pH->nEntries * sizeof(CATALOG_ENTRY) != (uint64_t)st.st_size)
+  {
+    fprintf(stderr, "ERROR - \"%s\" is not a valid catalog file\n", szCatalog);
+
+    munmap(pRval, st.st_size);
+    return NULL;
+  }
+
+  *pcbCatalog = st.st_size;
+
+  return pRval;
+}
+
+// the (aligned) sections of a mapped catalog file
+#define CATALOG_TAPES(pH) ((const CATALOG_TAPE_RECORD *)((const CATALOG_HEADER *)(pH) + 1))
+#define CATALOG_NAMES(pH) ((const char *)(CATALOG_TAPES(pH) + (pH)->nTapes))
+#define CATALOG_ENTRIES(pH) ((const CATALOG_ENTRY *)(CATALOG_NAMES(pH) + (pH)->cbNames))
+
+// reads an existing catalog into 'pC', with the entries for each tape
+int catalog_load(const char *szCatalog, CATALOG *pC)
+{
+uint32_t dw1;
+size_t cbCatalog = 0;
+const CATALOG_HEADER *pH;
+const CATALOG_TAPE_RECORD *pTR;
+const CATALOG_ENTRY *pE;
+CATALOG_TAPE *pT;
+
+  pH = (const CATALOG_HEADER *)catalog_map(szCatalog, &cbCatalog);
+
+  if(!pH)
+    return FileExists(szCatalog) ? -1 : 0; // a new catalog is empty
+
+  pTR = CATALOG_TAPES(pH);
+
+  for(dw1=0; dw1 < pH->nTapes; dw1++, pTR++)
+  {
+    pT = catalog_add_tape(pC, CATALOG_NAMES(pH) + pTR->dwName);
+
+    if(!pT)
+      goto memory_error;
+
+    pT->qwStat = pTR->qwStat;
+    pT->lSize = pTR->lSize;
+  }
+
+  for(dw1=0, pE=CATALOG_ENTRIES(pH); dw1 < pH->nEntries; dw1++, pE++)
+  {
+    if(pE->iTape >= (uint32_t)pC->nTapes ||
+       catalog_add_entry(pC->pTapes + pE->iTape, pE))
+    {
+      goto memory_error;
+    }
+  }
+
+  pC->nSorted = pC->nTapes; // they're saved in order
+
+  munmap((void *)pH, cbCatalog);
+
+  return 0;
+
+memory_error:
+  fprintf(stderr, "ERROR - unable to load catalog \"%s\"\n", szCatalog);
+
+  munmap((void *)pH, cbCatalog);
+
+  return -1;
+}
+
+// adds a tape file (or all of the files in a directory, and its subdirectories) to the
+// catalog.  Tapes that are already in the catalog are read again if they've changed.
+int catalog_add_path(CATALOG *pC, const char *szPath)
+{
+int iRval = 0;
+struct stat st;
+DIR *pDir;
+struct dirent *pDE;
+CATALOG_TAPE key, *pT;
+char szFull[PATH_MAX], tbuf[PATH_MAX * 2];
+
+  if(!realpath(szPath, szFull) || stat(szFull, &st))
+  {
+    fprintf(stderr, "Unable to find \"%s\" - errno=%d (%xH)\n", szPath, errno, errno);
+    return -1;
+  }
+
+  if(S_ISDIR(st.st_mode))
+  {
+    pDir = opendir(szFull);
+
+    if(!pDir)
+    {
+      fprintf(stderr, "Unable to read directory \"%s\" - errno=%d (%xH)\n", szFull, errno, errno);
+      return -1;
+    }
+
+    while((pDE = readdir(pDir)) != NULL)
+    {
+      if(pDE->d_name[0] == '.') // includes '.' and '..'
+        continue;
+
+      snprintf(tbuf, sizeof(tbuf), "%s/%s", szFull, pDE->d_name);
+
+      // symlinks to directories aren't followed (the same as 'find'), since one that
+      // points back up the tree would never end
+
+      if(!lstat(tbuf, &st) && S_ISLNK(st.st_mode) && IsDirectory(tbuf))
+        continue;
+
+      if(catalog_add_path(pC, tbuf))
+        iRval = -1;
+    }
+
+    closedir(pDir);
+
+    return iRval;
+  }
+
+  if(!S_ISREG(st.st_mode))
+    return 0;
+
+  key.szName = szFull;
+  pT = (CATALOG_TAPE *)bsearch(&key, pC->pTapes, pC->nSorted, sizeof(key), catalog_tape_compare);
+
+  if(!pT)
+  {
+    pT = catalog_add_tape(pC, szFull);
+
+    if(!pT)
+      return -1;
+
+    pT->bRead = 1;
+  }
+
+  if(pT->qwStat != stat_fingerprint(&st))
+    pT->bRead = 1;
+
+  pT->qwStat = stat_fingerprint(&st);
+  pT->lSize = (int64_t)st.st_size;
+
+  return 0;
+}
+
+// writes the catalog, sorted, replacing the old one
+int catalog_save(const char *szCatalog, CATALOG *pC)
+{
+int i1, i2, iRval = -1;
+uint32_t cbName;
+FILE *pOut;
+CATALOG_HEADER hdr;
+CATALOG_TAPE_RECORD tr;
+CATALOG_ENTRY *pEntries = NULL;
+char tbuf[PATH_MAX + 8];
+
+  // only the tapes that ARE tapes, sorted by name
+
+  for(i1=0, i2=0; i1 < pC->nTapes; i1++)
+  {
+    if(pC->pTapes[i1].bTape)
+    {
+      pC->pTapes[i2++] = pC->pTapes[i1];
+    }
+    else
+    {
+      free(pC->pTapes[i1].szName);
+
+      if(pC->pTapes[i1].pEntries)
+        free(pC->pTapes[i1].pEntries);
+    }
+  }
+
+  pC->nTapes = i2;
+  qsort(pC->pTapes, pC->nTapes, sizeof(*(pC->pTapes)), catalog_tape_compare);
+  pC->nSorted = pC->nTapes;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.szMagic, CATALOG_MAGIC, sizeof(hdr.szMagic));
+  hdr.nTapes = pC->nTapes;
+
+  for(i1=0; i1 < pC->nTapes; i1++)
+  {
+    hdr.nEntries += pC->pTapes[i1].nEntries;
+    hdr.cbNames += strlen(pC->pTapes[i1].szName) + 1;
+  }
+
+  hdr.cbNames = (hdr.cbNames + 7) & ~(uint64_t)7; // keeps the entries aligned
+
+  pEntries = (CATALOG_ENTRY *)malloc(sizeof(*pEntries) * (hdr.nEntries + 1));
+
+  if(!pEntries)
+    return -1;
+
+  for(i1=0, i2=0; i1 < pC->nTapes; i1++)
+  {
+    memcpy(pEntries + i2, pC->pTapes[i1].pEntries, sizeof(*pEntries) * pC->pTapes[i1].nEntries);
+
+    for(cbName=0; cbName < (uint32_t)pC->pTapes[i1].nEntries; cbName++)
+      pEntries[i2++].iTape = i1; // the index after sorting
+  }
+
+  qsort(pEntries, hdr.nEntries, sizeof(*pEntries), catalog_entry_compare);
+
+  snprintf(tbuf, sizeof(tbuf), "%s.tmp~", szCatalog);
+
+  pOut = fopen(tbuf, "w");
+
+  if(!pOut)
+  {
+    fprintf(stderr, "Unable to create \"%s\" - errno=%d (%xH)\n", tbuf, errno, errno);
+    goto the_exit_point;
+  }
+
+  fwrite(&hdr, sizeof(hdr), 1, pOut);
+
+  for(i1=0, cbName=0; i1 < pC->nTapes; i1++)
+  {
+    memset(&tr, 0, sizeof(tr));
+    tr.qwStat = pC->pTapes[i1].qwStat;
+    tr.lSize = pC->pTapes[i1].lSize;
+    tr.dwName = cbName;
+    tr.nEntries = pC->pTapes[i1].nEntries;
+
+    fwrite(&tr, sizeof(tr), 1, pOut);
+
+    cbName += strlen(pC->pTapes[i1].szName) + 1;
+  }
+
+  for(i1=0; i1 < pC->nTapes; i1++)
+    fwrite(pC->pTapes[i1].szName, strlen(pC->pTapes[i1].szName) + 1, 1, pOut);
+
+  for(; cbName < hdr.cbNames; cbName++)
+    fputc(0, pOut);
+
+  fwrite(pEntries, sizeof(*pEntries), hdr.nEntries, pOut);
+
+  if(ferror(pOut) | fclose(pOut))
+  {
+    fprintf(stderr, "ERROR - unable to write \"%s\" - errno=%d (%xH)\n", tbuf, errno, errno);
+    unlink(tbuf);
+    goto the_exit_point;
+  }
+
+  if(rename(tbuf, szCatalog))
+  {
+    fprintf(stderr, "ERROR - unable to rename \"%s\" - errno=%d (%xH)\n", tbuf, errno, errno);
+    unlink(tbuf);
+    goto the_exit_point;
+  }
+
+  iRval = 0;
+
+the_exit_point:
+  free(pEntries);
+
+  return iRval;
+}
+
+// builds or updates a catalog from tape files and directories of tape files
+int catalog_build(const char *szCatalog, char * const *pPaths, int nPaths, int nThreads)
+{
+int i1, iRval = 0, nRead = 0, nFiles = 0;
+struct stat st;
+CATALOG cat;
+CATALOG_TAPE *pT;
+
+  memset(&cat, 0, sizeof(cat));
+
+  if(catalog_load(szCatalog, &cat))
+    return -1;
+
+  // tapes that are already in the catalog are read again if they've changed, and
+  // dropped if they're gone
+
+  for(i1=0; i1 < cat.nTapes; i1++)
+  {
+    pT = cat.pTapes + i1;
+
+    if(stat(pT->szName, &st))
+    {
+      pT->bTape = 0;
+    }
+    else if(pT->qwStat != stat_fingerprint(&st))
+    {
+      pT->bRead = 1;
+      pT->qwStat = stat_fingerprint(&st);
+      pT->lSize = (int64_t)st.st_size;
+    }
+  }
+
+  for(i1=0; i1 < nPaths; i1++)
+  {
+    if(catalog_add_path(&cat, pPaths[i1]))
+      iRval = -1;
+  }
+
+  for(i1=0; i1 < cat.nTapes; i1++)
+    nRead += cat.pTapes[i1].bRead;
+
+  if(DEBUG_OUTPUT_INFO)
+    fprintf(stderr, "*INFO* - reading %d of %d files, %d threads\n", nRead, cat.nTapes, nThreads);
+
+  run_in_parallel(nThreads, cat.nTapes, catalog_read_tape, &cat);
+
+  for(i1=0, nRead=0; i1 < cat.nTapes; i1++)
+    nRead += cat.pTapes[i1].bRead && cat.pTapes[i1].bTape; // only count the tapes
+
+  if(catalog_save(szCatalog, &cat))
+  {
+    iRval = -2;
+  }
+  else
+  {
+    for(i1=0; i1 < cat.nTapes; i1++)
+      nFiles += cat.pTapes[i1].nEntries;
+
+    printf("CATALOG \"%s\" - %d tapes, %d files (%d tapes read)\n",
+           szCatalog, cat.nTapes, nFiles, nRead);
+  }
+
+  catalog_free(&cat);
+
+  return iRval;
+}
+
+// parses "YYYY", "YYYY-MM" or "YYYY-MM-DD" as YYYYDDD, the first day of the year or
+// month (or the last one, for 'bEnd')
+int parse_catalog_date(const char *pDate, int bEnd, uint32_t *pdwDate)
+{
+int iYear = 0, iMonth = 1, iDay = 1, nFields;
+
+  nFields = sscanf(pDate, "%d-%d-%d", &iYear, &iMonth, &iDay);
+
+  if(nFields < 1 || iYear < 1900 || iMonth < 1 || iMonth > 12 || iDay < 1 || iDay > 31)
+  {
+    fprintf(stderr, "Invalid date \"%s\" (use YYYY, YYYY-MM or YYYY-MM-DD)\n", pDate);
+    return -1;
+  }
+
+  if(bEnd && (nFields == 1 || (nFields == 2 && iMonth == 12)))
+    *pdwDate = iYear * 1000 + 999; // the end of the year
+  else if(bEnd && nFields == 2)
+    *pdwDate = iYear * 1000 + days_since_year_start(iYear, iMonth + 1, 1) - 1;
+  else
+    *pdwDate = iYear * 1000 + days_since_year_start(iYear, iMonth, iDay);
+
+  return 0;
+}
+
+// lists the files in a catalog that match a name (or wildcard pattern) and a date range
+// "FROM:TO", "FROM:", ":TO" or just "DATE".  Either one can be NULL to match anything.
+int catalog_query(const char *szCatalog, const char *szName, const char *szDates)
+{
+uint32_t dw1, dwFrom = 0, dwTo = 0xffffffff, nFound = 0, iFirst, iEnd, iMid;
+int i1, bExact = 0;
+size_t cbCatalog = 0;
+const CATALOG_HEADER *pH;
+const CATALOG_ENTRY *pE;
+const char *p1;
+uint16_t wName[3];
+char szPattern[64], szFile[16], tbuf[16];
+
+  if(szDates && *szDates)
+  {
+    p1 = strchr(szDates, ':');
+
+    if((*szDates != ':' && parse_catalog_date(szDates, 0, &dwFrom)) ||
+       (p1 && p1[1] && parse_catalog_date(p1 + 1, 1, &dwTo)) ||
+       (!p1 && parse_catalog_date(szDates, 1, &dwTo)))
+    {
+      return -1;
+    }
+  }
+
+  if(szName)
+  {
+    for(i1=0; szName[i1] && i1 < (int)sizeof(szPattern) - 1; i1++)
+      szPattern[i1] = toupper((unsigned char)szName[i1]);
+
+    szPattern[i1] = 0;
+
+    bExact = !strpbrk(szPattern, "*?[");
+  }
+
+  pH = (const CATALOG_HEADER *)catalog_map(szCatalog, &cbCatalog);
+
+  if(!pH)
+  {
+    fprintf(stderr, "Unable to read catalog \"%s\"\n", szCatalog);
+    return -2;
+  }
+
+  pE = CATALOG_ENTRIES(pH);
+  iFirst = 0;
+  iEnd = pH->nEntries;
+
+  if(bExact) // binary search for the first entry with the name, since they're sorted
+  {
+    rad50_file_name(szPattern, strlen(szPattern), wName);
+
+    while(iFirst < iEnd)
+    {
+      iMid = iFirst + (iEnd - iFirst) / 2;
+
+      if(rad50_name_compare(pE[iMid].wName, wName) < 0)
+      {
+        iFirst = iMid + 1;
+      }
+      else
+      {
+        iEnd = iMid;
+      }
+    }
+
+    iEnd = pH->nEntries;
+  }
+
+  for(dw1=iFirst; dw1 < iEnd; dw1++)
+  {
+    if(bExact && rad50_name_compare(pE[dw1].wName, wName))
+      break; // past the last one
+
+    if(pE[dw1].dwDate < dwFrom || pE[dw1].dwDate > dwTo ||
+       (szDates && *szDates && !pE[dw1].dwDate))
+    {
+      continue;
+    }
+
+    rad50_to_file_name(pE[dw1].wName, szFile);
+
+    if(szName && !bExact && fnmatch(szPattern, szFile, 0))
+      continue;
+
+    if(!nFound++)
+    {
+      fputs("  FILE NAME   CREATE DATE  BLOCKS   SEQ  TAPE FILE\n"
+            "  ==========  ===========  ======  ====  =========\n", stdout);
+    }
+
+    tbuf[0] = 0;
+
+    if(pE[dw1].dwDate)
+      snprintf(tbuf, sizeof(tbuf), "%3d%03d", (int)(pE[dw1].dwDate / 1000 - 1900) % 1000,
+               (int)(pE[dw1].dwDate % 1000));
+
+    printf("  %-10s  %-11s  %6u  %4u  %s\n", szFile,
+           tbuf[0] ? rt11_date_string(tbuf) : "",
+           pE[dw1].nBlocks, pE[dw1].wSeq,
+           CATALOG_NAMES(pH) + CATALOG_TAPES(pH)[pE[dw1].iTape].dwName);
+  }
+
+  printf("\n%u FILE(S) FOUND\n\n", nFound);
+
+  munmap((void *)pH, cbCatalog);
+
+  return 0;
+}
+
+
+// CONTENT SEARCH
+//
+// Finds a string in the files on one or more tapes without extracting them.  The data
+// blocks are collected into a large buffer and searched with 'memmem()', and the end
+// of the buffer is kept for the next search so that a match that crosses a block (or
+// file section) boundary is still found.  Each tape is searched on its own thread, and
+// the output is printed in the same order as the tapes.
+
+#define SEARCH_BUFSIZE (64 * 1024)
+
+typedef struct _TAPE_SEARCH_
+{
+  char * const *pTapes;
+  const char *pPattern;
+  size_t cbPattern;
+  char **ppOutput;         // output for each tape (from 'open_memstream()')
+  size_t *pcbOutput;
+} TAPE_SEARCH;
+
+typedef struct _SEARCH_TAPE_
+{
+  const TAPE_SEARCH *pS;
+  const char *szTape;
+  FILE *pOut;
+  RT11_FILE_HEADER prev;   // the previous file header, for file sections
+  int bPrev;
+  char szFile[16];         // the current file name
+  uint8_t *pBuf;           // data to search, SEARCH_BUFSIZE + 512 + 'cbPattern' bytes
+  size_t cbBuf;
+  off_t lBufPos;           // position of 'pBuf' in the file
+} SEARCH_TAPE;
+
+// searches the buffer, then keeps the last 'cbPattern - 1' bytes, which can't have
+// a whole match in them, at the start of it
+static void search_buffer(SEARCH_TAPE *pST)
+{
+const uint8_t *p1, *pEnd;
+size_t cbKeep;
+
+  p1 = pST->pBuf;
+  pEnd = pST->pBuf + pST->cbBuf;
+
+  while(p1 < pEnd &&
+        (p1 = (const uint8_t *)memmem(p1, pEnd - p1, pST->pS->pPattern, pST->pS->cbPattern)) != NULL)
+  {
+    fprintf(pST->pOut, "%s  %-10s  %lld\n", pST->szTape, pST->szFile,
+            (long long)(pST->lBufPos + (p1 - pST->pBuf)));
+
+    p1++;
+  }
+
+  cbKeep = pST->cbBuf < pST->pS->cbPattern ? pST->cbBuf : pST->pS->cbPattern - 1;
+
+  memmove(pST->pBuf, pEnd - cbKeep, cbKeep);
+
+  pST->lBufPos += pST->cbBuf - cbKeep;
+  pST->cbBuf = cbKeep;
+}
+
+static int search_file(void *pContext, const RT11_FILE_HEADER *pFile, off_t lPos)
+{
+SEARCH_TAPE *pST = (SEARCH_TAPE *)pContext;
+uint16_t wName[3];
+
+  if(!pST->bPrev || !is_next_file_section(&(pST->prev), pFile))
+  {
+    pST->cbBuf = 0; // a new file
+    pST->lBufPos = 0;
+
+    rad50_file_name(pFile->file_identifier, sizeof(pFile->file_identifier), wName);
+    rad50_to_file_name(wName, pST->szFile);
+  }
+
+  pST->prev = *pFile;
+  pST->bPrev = 1;
+
+  return 0;
+}
+
+static int search_data(void *pContext, const uint8_t *pData)
+{
+SEARCH_TAPE *pST = (SEARCH_TAPE *)pContext;
+
+  memcpy(pST->pBuf + pST->cbBuf, pData, 512);
+  pST->cbBuf += 512;
+
+  if(pST->cbBuf >= SEARCH_BUFSIZE)
+    search_buffer(pST);
+
+  return 0;
+}
+
+static int search_eof(void *pContext, const RT11_FILE_EOF *pEOF, int nBlocks)
+{
+  search_buffer((SEARCH_TAPE *)pContext); // the end stays in the buffer for the next section
+
+  return 0;
+}
+
+// searches one tape, on a worker thread (see 'run_in_parallel()')
+void search_tape(void *pContext, int iItem)
+{
+TAPE_SEARCH *pS = (TAPE_SEARCH *)pContext;
+FILE *pTape;
+SEARCH_TAPE st;
+TAPE_WALK walk;
+
+  memset(&st, 0, sizeof(st));
+  st.pS = pS;
+  st.szTape = pS->pTapes[iItem];
+
+  st.pOut = open_memstream(&(pS->ppOutput[iItem]), &(pS->pcbOutput[iItem]));
+  st.pBuf = (uint8_t *)malloc(SEARCH_BUFSIZE + 512 + pS->cbPattern);
+  pTape = fopen(st.szTape, "r");
+
+  if(!st.pOut || !st.pBuf || !pTape)
+  {
+    fprintf(stderr, "Unable to search tape file \"%s\" - errno=%d (%xH)\n",
+            st.szTape, errno, errno);
+    goto the_exit_point;
+  }
+
+  setvbuf(pTape, NULL, _IOFBF, TAPE_BUFSIZE);
+
+  memset(&walk, 0, sizeof(walk));
+  walk.pfnFile = search_file;
+  walk.pfnData = search_data;
+  walk.pfnEOF = search_eof;
+  walk.pContext = &st;
+
+  if(walk_tape(pTape, &walk))
+  {
+    fprintf(stderr, "WARNING - \"%s\" is damaged at position %lld, not all of it was searched\n",
+            st.szTape, (long long)ftello(pTape));
+  }
+  else if(!walk.bTape)
+  {
+    fprintf(stderr, "WARNING - \"%s\" is not a tape file\n", st.szTape);
+  }
+
+the_exit_point:
+  if(pTape)
+    fclose(pTape);
+
+  if(st.pBuf)
+    free(st.pBuf);
+
+  if(st.pOut)
+    fclose(st.pOut);
+}
+
+// prints the tape, file name, and position in the file of each match
+int search_tapes(const char *szPattern, char * const *pTapes, int nTapes, int nThreads)
+{
+int i1;
+TAPE_SEARCH ts;
+
+  if(!*szPattern)
+  {
+    fputs("ERROR - nothing to search for\n", stderr);
+    return -1;
+  }
+
+  memset(&ts, 0, sizeof(ts));
+  ts.pTapes = pTapes;
+  ts.pPattern = szPattern;
+  ts.cbPattern = strlen(szPattern);
+  ts.ppOutput = (char **)calloc(nTapes, sizeof(char *));
+  ts.pcbOutput = (size_t *)calloc(nTapes, sizeof(size_t));
+
+  if(!ts.ppOutput || !ts.pcbOutput)
+    return -1;
+
+  run_in_parallel(nThreads, nTapes, search_tape, &ts);
+
+  for(i1=0; i1 < nTapes; i1++)
+  {
+    if(ts.ppOutput[i1])
+    {
+      fwrite(ts.ppOutput[i1], 1, ts.pcbOutput[i1], stdout);
+      free(ts.ppOutput[i1]);
+    }
+  }
+
+  free(ts.ppOutput);
+  free(ts.pcbOutput);
+
+  return 0;
+}
+
+
+// TAPE DIFF
+//
+// Compares the files on two tapes, matching them by file name (the n'th file with a
+// given name on one tape matches the n'th one on the other).  A file with a different
+// size has changed.  Only when the sizes are the same is the data read, and hashed, to
+// find out.  A checksum manifest ('tapefile.sum', see '-K') has the hash for every file,
+// so when the manifest is up to date with the tape (it has the tape's 'stat_fingerprint()'),
+// the tape itself isn't read at all.
+
+#define MANIFEST_ID "DECTAPE-SUM 2"
+
+typedef struct _DIFF_FILE_
+{
+  char szIdentifier[18];   // the file identifier, "NAME  .EXT" (17 characters)
+  char szDate[7];          // the creation date
+  long long nBlocks;       // blocks in all sections
+  uint64_t qwHash;         // FNV-1a hash of the data, if 'bHash'
+  int bHash;               // the data needs to be (or has been) hashed
+  int iMatch;              // the matching file on the other tape, or -1
+} DIFF_FILE;
+
+typedef struct _DIFF_TAPE_
+{
+  const char *szName;
+  DIFF_FILE *pFiles;
+  int nFiles, nMaxFiles;
+  int bManifest;           // files (and hashes) came from the manifest
+  int bHashAll;            // hash every file (for writing a manifest)
+  int iRval;
+  int bHashing;            // second pass, hashing data
+  RT11_FILE_HEADER prev;   // the previous file header, for file sections
+  int bPrev;
+  int iCurrent, iNext;     // current file, next file
+} DIFF_TAPE;
+
+uint64_t fnv1a_hash(uint64_t qwHash, const uint8_t *pData, size_t cbData)
+{
+size_t i1;
+
+  for(i1=0; i1 < cbData; i1++)
+  {
+    qwHash ^= pData[i1];
+    qwHash *= 0x100000001b3ULL;
+  }
+
+  return qwHash;
+}
+
+static int diff_file(void *pContext, const RT11_FILE_HEADER *pFile, off_t lPos)
+{
+DIFF_TAPE *pDT = (DIFF_TAPE *)pContext;
+DIFF_FILE *pNew;
+int bContinued;
+char tbuf[8];
+
+  bContinued = pDT->bPrev && is_next_file_section(&(pDT->prev), pFile);
+  pDT->prev = *pFile;
+  pDT->bPrev = 1;
+
+  if(bContinued)
+    return 0;
+
+  memcpy(tbuf, pFile->file_sequence_number, sizeof(pFile->file_sequence_number));
+  tbuf[sizeof(pFile->file_sequence_number)] = 0;
+
+  if(!atoi(tbuf)) // 'ZEROED.ZZZ'
+  {
+    pDT->iCurrent = -1;
+    return 0;
+  }
+
+  pDT->iCurrent = pDT->iNext++;
+
+  if(pDT->bHashing)
+    return 0;
+
+  if(pDT->nFiles >= pDT->nMaxFiles)
+  {
+    pNew = (DIFF_FILE *)realloc(pDT->pFiles, sizeof(*pNew) * (pDT->nMaxFiles + 64));
+
+    if(!pNew)
+      return -1;
+
+    pDT->pFiles = pNew;
+    pDT->nMaxFiles += 64;
+  }
+
+  pNew = pDT->pFiles + pDT->nFiles++;
+  memset(pNew, 0, sizeof(*pNew));
+
+  memcpy(pNew->szIdentifier, pFile->file_identifier, sizeof(pFile->file_identifier));
+  memcpy(pNew->szDate, pFile->creation_date, sizeof(pFile->creation_date));
+  pNew->iMatch = -1;
+  pNew->qwHash = FNV1A_HASH_INIT;
+  pNew->bHash = pDT->bHashAll;
+
+  return 0;
+}
+
+static int diff_data(void *pContext, const uint8_t *pData)
+{
+DIFF_TAPE *pDT = (DIFF_TAPE *)pContext;
+DIFF_FILE *pF;
+
+  if(pDT->iCurrent >= 0 && pDT->iCurrent < pDT->nFiles)
+  {
+    pF = pDT->pFiles + pDT->iCurrent;
+
+    if(pF->bHash)
+      pF->qwHash = fnv1a_hash(pF->qwHash, pData, 512);
+  }
+
+  return 0;
+}
+
+static int diff_eof(void *pContext, const RT11_FILE_EOF *pEOF, int nBlocks)
+{
+DIFF_TAPE *pDT = (DIFF_TAPE *)pContext;
+
+  if(!pDT->bHashing && pDT->iCurrent >= 0)
+    pDT->pFiles[pDT->iCurrent].nBlocks += nBlocks;
+
+  return 0;
+}
+
+// reads the manifest for a tape, if there is one and it's up to date
+int diff_read_manifest(DIFF_TAPE *pDT)
+{
+FILE *pIn;
+struct stat st;
+long long nBlocks;
+unsigned long long qwHash, qwStat = 0;
+DIFF_FILE *pNew;
+char tbuf[PATH_MAX + 8];
+
+  snprintf(tbuf, sizeof(tbuf), "%s.sum", pDT->szName);
+
+  if(stat(pDT->szName, &st))
+    return -1;
+
+  pIn = fopen(tbuf, "r");
+
+  if(!pIn)
+    return -1;
+
+  if(!fgets(tbuf, sizeof(tbuf), pIn) ||
+     strncmp(tbuf, MANIFEST_ID " ", sizeof(MANIFEST_ID)) ||
+     sscanf(tbuf + sizeof(MANIFEST_ID), "%llx", &qwStat) != 1 ||
+     qwStat != (unsigned long long)stat_fingerprint(&st))
+  {
+    if(DEBUG_OUTPUT_INFO)
+      fprintf(stderr, "*INFO* - manifest for \"%s\" is out of date\n", pDT->szName);
+
+    fclose(pIn);
+    return -1;
+  }
+
+  // each line is 'hash blocks date identifier', the date and identifier have fixed widths
+
+  while(fgets(tbuf, sizeof(tbuf), pIn))
+  {
+    if(sscanf(tbuf, "%llx %lld", &qwHash, &nBlocks) != 2 || strlen(tbuf) < 16 + 1 + 11 + 1 + 6 + 1 + 17)
+      continue;
+
+    if(pDT->nFiles >= pDT->nMaxFiles)
+    {
+      pNew = (DIFF_FILE *)realloc(pDT->pFiles, sizeof(*pNew) * (pDT->nMaxFiles + 64));
+
+      if(!pNew)
+        break;
+
+      pDT->pFiles = pNew;
+      pDT->nMaxFiles += 64;
+    }
+
+    pNew = pDT->pFiles + pDT->nFiles++;
+    memset(pNew, 0, sizeof(*pNew));
+
+    memcpy(pNew->szDate, tbuf + 16 + 1 + 11 + 1, 6);
+    memcpy(pNew->szIdentifier, tbuf + 16 + 1 + 11 + 1 + 6 + 1, 17);
+    pNew->nBlocks = nBlocks;
+    pNew->qwHash = (uint64_t)qwHash;
+    pNew->bHash = 1;
+    pNew->iMatch = -1;
+  }
+
+  fclose(pIn);
+
+  pDT->bManifest = 1;
+
+  return 0;
+}
+
+int diff_write_manifest(DIFF_TAPE *pDT)
+{
+FILE *pOut;
+struct stat st;
+int i1;
+char tbuf[PATH_MAX + 8];
+
+  snprintf(tbuf, sizeof(tbuf), "%s.sum", pDT->szName);
+
+  if(stat(pDT->szName, &st) || !(pOut = fopen(tbuf, "w")))
+  {
+    fprintf(stderr, "Unable to write \"%s\" - errno=%d (%xH)\n", tbuf, errno, errno);
+    return -1;
+  }
+
+  fprintf(pOut, MANIFEST_ID " %016llx\n", (unsigned long long)stat_fingerprint(&st));
+
+  for(i1=0; i1 < pDT->nFiles; i1++)
+  {
+    fprintf(pOut, "%016llx %11lld %-6.6s %-17.17s\n",
+            (unsigned long long)pDT->pFiles[i1].qwHash, pDT->pFiles[i1].nBlocks,
+            pDT->pFiles[i1].szDate, pDT->pFiles[i1].szIdentifier);
+  }
+
+  if(ferror(pOut) | fclose(pOut))
+  {
+    fprintf(stderr, "ERROR - unable to write \"%s\" - errno=%d (%xH)\n", tbuf, errno, errno);
+    return -1;
+  }
+
+  return 0;
+}
+
+// reads (or hashes, on the second pass) the files on one tape, on a worker thread
+void diff_read_tape(void *pContext, int iItem)
+{
+DIFF_TAPE *pDT = ((DIFF_TAPE *)pContext) + iItem;
+FILE *pTape;
+TAPE_WALK walk;
+int i1;
+
+  if(!pDT->bHashing && !pDT->bHashAll && !diff_read_manifest(pDT))
+    return; // no need to read the tape
+
+  if(pDT->bHashing)
+  {
+    for(i1=0; i1 < pDT->nFiles && !pDT->pFiles[i1].bHash; i1++)
+    { }
+
+    if(pDT->bManifest || i1 >= pDT->nFiles) // nothing to hash
+      return;
+  }
+
+  pTape = fopen(pDT->szName, "r");
+
+  if(!pTape)
+  {
+    fprintf(stderr, "Unable to open tape file \"%s\" - errno=%d (%xH)\n",
+            pDT->szName, errno, errno);
+
+    pDT->iRval = -2;
+    return;
+  }
+
+  setvbuf(pTape, NULL, _IOFBF, TAPE_BUFSIZE);
+
+  memset(&walk, 0, sizeof(walk));
+  walk.pfnFile = diff_file;
+  walk.pfnData = pDT->bHashing || pDT->bHashAll ? diff_data : NULL;
+  walk.pfnEOF = diff_eof;
+  walk.pContext = pDT;
+
+  pDT->bPrev = 0;
+  pDT->iCurrent = -1;
+  pDT->iNext = 0;
+
+  if(walk_tape(pTape, &walk) || !walk.bTape)
+  {
+    fprintf(stderr, "ERROR - \"%s\" is not a valid tape (at position %lld)\n",
+            pDT->szName, (long long)ftello(pTape));
+
+    pDT->iRval = -3;
+  }
+
+  fclose(pTape);
+}
+
+// writes checksum manifests for tapes, 'tapefile.sum'
+int write_manifests(char * const *pTapes, int nTapes, int nThreads)
+{
+DIFF_TAPE *pTapeList;
+int i1, iRval = 0;
+
+  pTapeList = (DIFF_TAPE *)calloc(nTapes, sizeof(*pTapeList));
+
+  if(!pTapeList)
+    return -1;
+
+  for(i1=0; i1 < nTapes; i1++)
+  {
+    pTapeList[i1].szName = pTapes[i1];
+    pTapeList[i1].bHashAll = 1;
+  }
+
+  run_in_parallel(nThreads, nTapes, diff_read_tape, pTapeList);
+
+  for(i1=0; i1 < nTapes; i1++)
+  {
+    if(pTapeList[i1].iRval || diff_write_manifest(pTapeList + i1))
+      iRval = -1;
+    else if(DEBUG_OUTPUT_WARN)
+      fprintf(stderr, "*WARN* - \"%s.sum\" - %d files\n", pTapes[i1], pTapeList[i1].nFiles);
+
+    if(pTapeList[i1].pFiles)
+      free(pTapeList[i1].pFiles);
+  }
+
+  free(pTapeList);
+
+  return iRval;
+}
+
+static void diff_print_file(const char *szWhat, const DIFF_FILE *pF)
+{
+  printf("  %-8s  %-17.17s  %-9.9s  %6lld\n", szWhat, pF->szIdentifier,
+         rt11_date_string(pF->szDate), pF->nBlocks);
+}
+
+// lists the files that were added, removed, or changed from one tape to another
+int diff_tapes(const char *szTape1, const char *szTape2, int nThreads)
+{
+DIFF_TAPE dt[2];
+DIFF_FILE *pF1, *pF2;
+int i1, i2, iRval = 0, nAdded = 0, nRemoved = 0, nChanged = 0, nSame = 0;
+
+  memset(dt, 0, sizeof(dt));
+  dt[0].szName = szTape1;
+  dt[1].szName = szTape2;
+
+  run_in_parallel(nThreads, 2, diff_read_tape, dt);
+
+  if(dt[0].iRval || dt[1].iRval)
+  {
+    iRval = -1;
+    goto the_exit_point;
+  }
+
+  // match the files by name.  Files that are the same size need their data compared.
+
+  for(i1=0; i1 < dt[0].nFiles; i1++)
+  {
+    pF1 = dt[0].pFiles + i1;
+
+    for(i2=0; i2 < dt[1].nFiles; i2++)
+    {
+      pF2 = dt[1].pFiles + i2;
+
+      if(pF2->iMatch < 0 && !memcmp(pF1->szIdentifier, pF2->szIdentifier, 17))
+      {
+        pF1->iMatch = i2;
+        pF2->iMatch = i1;
+
+        if(pF1->nBlocks == pF2->nBlocks && !dt[0].bManifest)
+          pF1->bHash = 1;
+
+        if(pF1->nBlocks == pF2->nBlocks && !dt[1].bManifest)
+          pF2->bHash = 1;
+
+        break;
+      }
+    }
+  }
+
+  dt[0].bHashing = dt[1].bHashing = 1;
+
+  run_in_parallel(nThreads, 2, diff_read_tape, dt);
+
+  if(dt[0].iRval || dt[1].iRval)
+  {
+    iRval = -1;
+    goto the_exit_point;
+  }
+
+  printf("TAPE 1:  %s%s\nTAPE 2:  %s%s\n\n",
+         szTape1, dt[0].bManifest ? " (manifest)" : "",
+         szTape2, dt[1].bManifest ? " (manifest)" : "");
+
+  for(i1=0; i1 < dt[0].nFiles; i1++)
+  {
+    pF1 = dt[0].pFiles + i1;
+
+    if(pF1->iMatch < 0)
+    {
+      diff_print_file("REMOVED", pF1);
+      nRemoved++;
+      continue;
+    }
+
+    pF2 = dt[1].pFiles + pF1->iMatch;
+
+    if(pF1->nBlocks != pF2->nBlocks || pF1->qwHash != pF2->qwHash)
+    {
+      diff_print_file("CHANGED", pF1);
+      diff_print_file("     TO", pF2);
+      nChanged++;
+    }
+    else
+    {
+      if(iVerbosity > 0 || memcmp(pF1->szDate, pF2->szDate, 6))
+        diff_print_file(memcmp(pF1->szDate, pF2->szDate, 6) ? "NEW DATE" : "SAME", pF2);
+
+      nSame++;
+    }
+  }
+
+  for(i2=0; i2 < dt[1].nFiles; i2++)
+  {
+    if(dt[1].pFiles[i2].iMatch < 0)
+    {
+      diff_print_file("ADDED", dt[1].pFiles + i2);
+      nAdded++;
+    }
+  }
+
+  printf("\n%d ADDED, %d REMOVED, %d CHANGED, %d THE SAME\n\n", nAdded, nRemoved, nChanged, nSame);
+
+the_exit_point:
+  for(i1=0; i1 < 2; i1++)
+  {
+    if(dt[i1].pFiles)
+      free(dt[i1].pFiles);
+  }
+
+  return iRval;
+}
+
+
+// SALVAGE
+//
+// Recovers what it can from a damaged tape.  Rather than reading the tape in order and
+// giving up at the first bad record, the whole tape file is mapped into memory and
+// searched (in chunks, on several threads) for HDR1 and EOF1 records.  Those are used
+// to rebuild the list of files.  The data records for each file are the valid records
+// between its HDR1 and EOF1.  Where the records are damaged, the next valid record is
+// found and the missing blocks are left as zeros in the output file.  Data records that
+// have no HDR1 (it was damaged) are recovered as 'LOSTnnnn.BIN', or with the name from
+// the EOF1 if there is one.  Damaged regions are listed along with the files.
+
+#define LABEL_CHUNK_SIZE (16 * 1024 * 1024)
+
+struct _LABEL_MARK_
+{
+  off_t lPos;              // position of the record (its first tape marker)
+  int bEOF;                // non-zero for EOF1, zero for HDR1
+};
+
+typedef struct _LABEL_CHUNK_
+{
+  const uint8_t *pTape;    // the (mapped) tape file
+  off_t cbTape;
+  off_t lStart, lEnd;      // records that start in this range
+  LABEL_MARK *pMarks;    // HDR1 and EOF1 records found, in order
+  int nMarks, nMaxMarks;
+} LABEL_CHUNK;
+
+typedef struct _SALVAGE_
+{
+  const uint8_t *pTape;
+  off_t cbTape;
+  const char *pOutPath;    // NULL to only list the files
+  int iOutDir, bOverwrite, bConfirm;
+  OUTPUT_FILE out;
+  char szOutName[32];
+  RT11_FILE_HEADER file;   // the current file
+  int bFile;               // 'file' is valid
+  long long nBlocks;       // blocks recovered for the current file
+  long long nLost;         // blocks lost in the current file
+  int bNoEOF;              // the current file has a section with no EOF1
+  int nFiles, nDamaged, nLostFiles;
+} SALVAGE;
+
+// returns non-zero if there's a valid tape record (marker, 512 bytes, marker) at 'lPos'
+int is_tape_record(const uint8_t *pTape, off_t cbTape, off_t lPos)
+{
+  return lPos >= 0 && lPos + 520 <= cbTape &&
+         !memcmp(pTape + lPos, TAPE_MARKER, 4) &&
+         !memcmp(pTape + lPos + 516, TAPE_MARKER, 4);
+}
+
+// finds the next valid tape record at or after 'lStart' that ends by 'lEnd', or -1
+off_t find_tape_record(const uint8_t *pTape, off_t cbTape, off_t lStart, off_t lEnd)
+{
+const uint8_t *p1;
+
+  while(lStart + 520 <= lEnd)
+  {
+    p1 = (const uint8_t *)memmem(pTape + lStart, lEnd - lStart - 516, TAPE_MARKER, 4);
+
+    if(!p1)
+      break;
+
+    lStart = p1 - pTape;
+
+    if(is_tape_record(pTape, cbTape, lStart))
+      return lStart;
+
+    lStart++;
+  }
+
+  return -1;
+}
+
+static int salvage_add_mark(LABEL_CHUNK *pC, off_t lPos, int bEOF)
+{
+LABEL_MARK *pNew;
+
+  if(pC->nMarks >= pC->nMaxMarks)
+  {
+    pNew = (LABEL_MARK *)realloc(pC->pMarks, sizeof(*pNew) * (pC->nMaxMarks + 256));
+
+    if(!pNew)
+      return -1;
+
+    pC->pMarks = pNew;
+    pC->nMaxMarks += 256;
+  }
+
+  pC->pMarks[pC->nMarks].lPos = lPos;
+  pC->pMarks[pC->nMarks].bEOF = bEOF;
+  pC->nMarks++;
+
+  return 0;
+}
+
+// finds the HDR1 and EOF1 records that start in one chunk, on a worker thread
+void label_scan_chunk(void *pContext, int iItem)
+{
+LABEL_CHUNK *pC = ((LABEL_CHUNK *)pContext) + iItem;
+const uint8_t *pHDR, *pEOF, *pEnd;
+static const uint8_t aHDR1[8] = { 0, 2, 0, 0, 'H', 'D', 'R', '1' };
+static const uint8_t aEOF1[8] = { 0, 2, 0, 0, 'E', 'O', 'F', '1' };
+
+  // a record that starts in this chunk can extend past the end of it
+
+  pEnd = pC->pTape + (pC->lEnd + 7 < pC->cbTape ? pC->lEnd + 7 : pC->cbTape);
+
+  pHDR = (const uint8_t *)memmem(pC->pTape + pC->lStart, pEnd - pC->pTape - pC->lStart, aHDR1, 8);
+  pEOF = (const uint8_t *)memmem(pC->pTape + pC->lStart, pEnd - pC->pTape - pC->lStart, aEOF1, 8);
+
+  while(pHDR || pEOF) // merge them, in order
+  {
+    if(pHDR && (!pEOF || pHDR < pEOF))
+    {
+      if(is_tape_record(pC->pTape, pC->cbTape, pHDR - pC->pTape) &&
+         salvage_add_mark(pC, pHDR - pC->pTape, 0))
+      {
+        break;
+      }
+
+      pHDR = (const uint8_t *)memmem(pHDR + 1, pEnd - pHDR - 1, aHDR1, 8);
+    }
+    else
+    {
+      if(is_tape_record(pC->pTape, pC->cbTape, pEOF - pC->pTape) &&
+         salvage_add_mark(pC, pEOF - pC->pTape, 1))
+      {
+        break;
+      }
+
+      pEOF = (const uint8_t *)memmem(pEOF + 1, pEnd - pEOF - 1, aEOF1, 8);
+    }
+  }
+}
+
+// finds all of the HDR1 and EOF1 records on a (mapped) tape, in order, searching it in
+// chunks on 'nThreads' threads.  Returns the number found (in '*ppMarks', which the
+// caller frees), or -1 on error.
+int find_label_records(const uint8_t *pTape, off_t cbTape, int nThreads, LABEL_MARK **ppMarks)
+{
+int i1, nChunks, nMarks = 0;
+LABEL_CHUNK *pChunks;
+LABEL_MARK *pMarks = NULL;
+
+  nChunks = (int)((cbTape + LABEL_CHUNK_SIZE - 1) / LABEL_CHUNK_SIZE);
+  pChunks = (LABEL_CHUNK *)calloc(nChunks + 1, sizeof(*pChunks));
+
+  if(!pChunks)
+    return -1;
+
+  for(i1=0; i1 < nChunks; i1++)
+  {
+    pChunks[i1].pTape = pTape;
+    pChunks[i1].cbTape = cbTape;
+    pChunks[i1].lStart = (off_t)i1 * LABEL_CHUNK_SIZE;
+    pChunks[i1].lEnd = i1 < nChunks - 1 ? pChunks[i1].lStart + LABEL_CHUNK_SIZE : cbTape;
+  }
+
+  run_in_parallel(nThreads, nChunks, label_scan_chunk, pChunks);
+
+  for(i1=0; i1 < nChunks; i1++)
+    nMarks += pChunks[i1].nMarks;
+
+  pMarks = (LABEL_MARK *)malloc(sizeof(*pMarks) * (nMarks + 1));
+
+  for(i1=0, nMarks=0; pMarks && i1 < nChunks; i1++)
+  {
+    if(pChunks[i1].nMarks)
+      memcpy(pMarks + nMarks, pChunks[i1].pMarks, sizeof(*pMarks) * pChunks[i1].nMarks);
+
+    nMarks += pChunks[i1].nMarks;
+  }
+
+  for(i1=0; i1 < nChunks; i1++)
+  {
+    if(pChunks[i1].pMarks)
+      free(pChunks[i1].pMarks);
+  }
+
+  free(pChunks);
+
+  *ppMarks = pMarks;
+
+  return pMarks ? nMarks : -1;
+}
+
+static void salvage_damage(SALVAGE *pS, off_t lStart, off_t lEnd, const char *szWhy)
+{
+  printf("  ** DAMAGED %lld-%lld (%lld bytes) %s **\n",
+         (long long)lStart, (long long)lEnd, (long long)(lEnd - lStart), szWhy);
+
+  pS->nDamaged++;
+}
+
+// ends the current file, closing the output file and listing it
+static void salvage_end_file(SALVAGE *pS)
+{
+  if(!pS->bFile)
+    return;
+
+  if(pS->out.iFD >= 0 &&
+     output_file_close(&(pS->out), 1,
+                       catalog_date(pS->file.creation_date) ? pS->file.creation_date : NULL))
+  {
+    fprintf(stderr, "ERROR - unable to write to \"%s/%s\" - errno=%d (%xH)\n",
+            pS->pOutPath, pS->szOutName, errno, errno);
+  }
+
+  printf("  %-17.17s  %-9.9s  %6lld  %s\n",
+         pS->file.file_identifier,
+         catalog_date(pS->file.creation_date) ? rt11_date_string(pS->file.creation_date) : "",
+         pS->nBlocks,
+         pS->nLost ? "DAMAGED" : pS->bNoEOF ? "NO EOF" : "OK");
+
+  if(pS->nLost)
+    printf("      (%lld blocks lost)\n", pS->nLost);
+
+  pS->bFile = 0;
+  pS->nFiles++;
+}
+
+// starts a new file ('pFile' is the HDR1, or a made up one)
+static void salvage_start_file(SALVAGE *pS, const RT11_FILE_HEADER *pFile)
+{
+  salvage_end_file(pS);
+
+  pS->file = *pFile;
+  pS->bFile = 1;
+  pS->nBlocks = 0;
+  pS->nLost = 0;
+  pS->bNoEOF = 0;
+
+  if(pS->pOutPath)
+  {
+    pS->out.iFD = do_open_output_file(pS->iOutDir, pS->pOutPath, pFile->file_identifier,
+                                      pS->bOverwrite, pS->bConfirm,
+                                      pS->szOutName, sizeof(pS->szOutName));
+
+    if(pS->out.iFD < 0)
+    {
+      fprintf(stderr, "Unable to open \"%s/%-17.17s\" - errno=%d (%xH)\n",
+              pS->pOutPath, pFile->file_identifier, errno, errno);
+    }
+  }
+}
+
+// recovers the data records from 'lStart' to 'lEnd' into the current file.  Damaged
+// records are skipped, and the blocks that were lost are left as zeros.
+static void salvage_data(SALVAGE *pS, off_t lStart, off_t lEnd)
+{
+off_t lPos, lNext;
+long long nLost;
+char tbuf[32];
+
+  snprintf(tbuf, sizeof(tbuf), "in %-17.17s", pS->file.file_identifier);
+
+  for(lPos=lStart; lPos + 520 <= lEnd; )
+  {
+    if(is_tape_record(pS->pTape, pS->cbTape, lPos))
+    {
+      if(pS->out.iFD >= 0)
+      {
+        if(is_zero_block(pS->pTape + lPos + 4, 512))
+          output_file_skip(&(pS->out), 512);
+        else
+          output_file_write(&(pS->out), pS->pTape + lPos + 4, 512);
+      }
+
+      pS->nBlocks++;
+      lPos += 520;
+
+      continue;
+    }
+
+    lNext = find_tape_record(pS->pTape, pS->cbTape, lPos + 1, lEnd);
+
+    if(lNext < 0)
+      break;
+
+    nLost = (lNext - lPos + 519) / 520;
+
+    salvage_damage(pS, lPos, lNext, tbuf);
+
+    if(pS->out.iFD >= 0)
+      output_file_skip(&(pS->out), 512 * nLost);
+
+    pS->nLost += nLost;
+    lPos = lNext;
+  }
+
+  if(lPos < lEnd) // what's left isn't a whole record
+  {
+    salvage_damage(pS, lPos, lEnd, tbuf);
+
+    nLost = (lEnd - lPos + 519) / 520;
+
+    if(pS->out.iFD >= 0)
+      output_file_skip(&(pS->out), 512 * nLost);
+
+    pS->nLost += nLost;
+  }
+}
+
+// data with no HDR1.  If there are any records, they're recovered as a 'lost' file,
+// using the name from the EOF1 if there is one.
+static void salvage_lost_data(SALVAGE *pS, off_t lStart, off_t lEnd, const RT11_FILE_EOF *pEOF)
+{
+off_t lFirst;
+RT11_FILE_HEADER file;
+char tbuf[32];
+
+  if(lStart >= lEnd)
+    return;
+
+  lFirst = find_tape_record(pS->pTape, pS->cbTape, lStart, lEnd);
+
+  if(lFirst < 0)
+  {
+    if(!pEOF || lEnd - lStart > 4) // otherwise it's just the data marker
+      salvage_damage(pS, lStart, lEnd, "no records");
+
+    return;
+  }
+
+  salvage_end_file(pS);
+
+  // a record followed by a data marker is the header, with the label damaged
+
+  if(lFirst == lStart && lFirst + 524 < lEnd && !memcmp(pS->pTape + lFirst + 520, DATA_MARKER, 4))
+  {
+    lFirst += 524;
+    salvage_damage(pS, lStart, lFirst, "header");
+  }
+  else if(lFirst > lStart)
+  {
+    salvage_damage(pS, lStart, lFirst, "no header");
+  }
+
+  memset(&file, ' ', sizeof(file));
+
+  if(pEOF)
+  {
+    memcpy(&file, pEOF, sizeof(file));
+  }
+  else
+  {
+    // never the same name twice, so one can't be copied over another with '-o' or '-q'
+
+    snprintf(tbuf, sizeof(tbuf), "LOST%04d.BIN", ++(pS->nLostFiles));
+    memcpy(file.file_identifier, tbuf, strlen(tbuf) < sizeof(file.file_identifier)
+                                       ? strlen(tbuf) : sizeof(file.file_identifier));
+  }
+
+  salvage_start_file(pS, &file);
+
+  pS->bNoEOF = !pEOF;
+
+  if(lEnd - 4 >= lFirst && !memcmp(pS->pTape + lEnd - 4, DATA_MARKER, 4))
+    lEnd -= 4;
+
+  salvage_data(pS, lFirst, lEnd);
+
+  salvage_end_file(pS);
+}
+
+int salvage_tape(const char *szTapeFile, const char *pOutPath, int bOverwrite, int bConfirm, int nThreads)
+{
+int iFD = -1, i1, cb1, iRval = -1, nMarks = 0, bFirst = 1;
+struct stat st;
+uint8_t *pTape = NULL;
+LABEL_MARK *pMarks = NULL;
+SALVAGE sv;
+RT11_FILE_HEADER file;
+RT11_FILE_EOF eof;
+off_t lPos, lData, lEnd;
+char tbuf[8];
+
+  memset(&sv, 0, sizeof(sv));
+  sv.out.iFD = -1;
+  sv.iOutDir = -1;
+  sv.pOutPath = pOutPath;
+  sv.bOverwrite = bOverwrite;
+  sv.bConfirm = bConfirm;
+
+  iFD = open(szTapeFile, O_RDONLY | O_CLOEXEC);
+
+  if(iFD < 0 || fstat(iFD, &st))
+  {
+    fprintf(stderr, "Unable to open tape file \"%s\" - errno=%d (%xH)\n", szTapeFile, errno, errno);
+    goto the_exit_point;
+  }
+
+  if(st.st_size < 520)
+  {
+    fprintf(stderr, "\"%s\" is too small to be a tape file\n", szTapeFile);
+    goto the_exit_point;
+  }
+
+  pTape = (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, iFD, 0);
+
+  if(pTape == (uint8_t *)MAP_FAILED)
+  {
+    pTape = NULL;
+    fprintf(stderr, "Unable to map tape file \"%s\" - errno=%d (%xH)\n", szTapeFile, errno, errno);
+    goto the_exit_point;
+  }
+
+  madvise(pTape, st.st_size, MADV_SEQUENTIAL);
+
+  sv.pTape = pTape;
+  sv.cbTape = st.st_size;
+
+  if(pOutPath)
+  {
+    sv.iOutDir = open(pOutPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    sv.out.pBuf = (uint8_t *)malloc(OUTPUT_BUFSIZE);
+
+    if(sv.iOutDir < 0 || !sv.out.pBuf)
+    {
+      fprintf(stderr, "Unable to open output directory \"%s\" - errno=%d (%xH)\n",
+              pOutPath, errno, errno);
+      goto the_exit_point;
+    }
+  }
+
+  // find all of the HDR1 and EOF1 records, in parallel
+
+  nMarks = find_label_records(pTape, st.st_size, nThreads, &pMarks);
+
+  if(nMarks < 0)
+    goto the_exit_point;
+
+  if(DEBUG_OUTPUT_INFO)
+    fprintf(stderr, "*INFO* - %d HDR1/EOF1 records found\n", nMarks);
+
+  // rebuild the files from the HDR1 and EOF1 records, in order
+
+  lPos = 0;
+
+  if(is_tape_record(pTape, st.st_size, 0) && !memcmp(pTape + 4, "VOL1", 4))
+  {
+    printf("RT11 TAPE  '%-3.3s' '%-10.10s'\n",
+           ((RT11_VOL_HEADER *)(pTape + 4))->owner_identifier,
+           ((RT11_VOL_HEADER *)(pTape + 4))->owner_name);
+
+    lPos = 520;
+  }
+  else
+  {
+    salvage_damage(&sv, 0, 520, "no volume header");
+  }
+
+  fputs("  FILE NAME          CREATE DATE  BLOCKS  STATUS\n"
+        "  =================  ===========  ======  ======\n", stdout);
+
+  for(i1=0; i1 < nMarks; i1++)
+  {
+    if(pMarks[i1].bEOF) // an EOF1 without an HDR1
+    {
+      memcpy(&eof, pTape + pMarks[i1].lPos + 4, sizeof(eof));
+
+      salvage_lost_data(&sv, lPos, pMarks[i1].lPos, &eof);
+
+      lPos = pMarks[i1].lPos + 520 + 4;
+      continue;
+    }
+
+    // anything between the end of the last file and this one?
+
+    if(bFirst && (pMarks[i1].lPos == lPos + 520 || pMarks[i1].lPos == lPos + 524) &&
+       is_tape_record(pTape, st.st_size, lPos))
+      fputs("  *BOOT BLOCK DETECTED*\n", stdout);
+    else
+      salvage_lost_data(&sv, lPos, pMarks[i1].lPos, NULL);
+
+    bFirst = 0;
+
+    memcpy(&file, pTape + pMarks[i1].lPos + 4, sizeof(file));
+
+    if(!sv.bFile || !is_next_file_section(&(sv.file), &file))
+    {
+      memcpy(tbuf, file.file_sequence_number, sizeof(file.file_sequence_number));
+      tbuf[sizeof(file.file_sequence_number)] = 0;
+
+      if(!atoi(tbuf)) // 'ZEROED.ZZZ'
+        salvage_end_file(&sv);
+      else
+        salvage_start_file(&sv, &file);
+    }
+    else
+    {
+      sv.file = file; // the next section of the same file
+    }
+
+    // the data is between the HDR1 and the next HDR1 or EOF1, without the data markers
+
+    lData = pMarks[i1].lPos + 520;
+    lEnd = i1 + 1 < nMarks ? pMarks[i1 + 1].lPos : st.st_size;
+
+    if(lData + 4 <= lEnd && !memcmp(pTape + lData, DATA_MARKER, 4))
+      lData += 4;
+    else
+      salvage_damage(&sv, lData, lData + 4, "missing data marker");
+
+    if(lEnd - 4 >= lData && !memcmp(pTape + lEnd - 4, DATA_MARKER, 4))
+      lEnd -= 4;
+
+    if(i1 + 1 >= nMarks || !pMarks[i1 + 1].bEOF)
+    {
+      // no EOF1.  The data ends at the first thing that isn't a data record.
+
+      for(lPos=lData; lPos < lEnd && is_tape_record(pTape, st.st_size, lPos); lPos += 520)
+      { }
+
+      // at the end of the tape file, what follows should be zeros (if it was cut off, it isn't)
+
+      cb1 = lEnd - lPos < 520 ? (int)(lEnd - lPos) : 520;
+
+      if(cb1 > 0 && !is_zero_block(pTape + lPos, cb1))
+        salvage_damage(&sv, lPos, i1 + 1 < nMarks ? lEnd : lPos + cb1, "no EOF1");
+
+      lEnd = lPos;
+      sv.bNoEOF = 1;
+    }
+
+    if(sv.bFile)
+      salvage_data(&sv, lData, lEnd);
+
+    if(i1 + 1 < nMarks && pMarks[i1 + 1].bEOF)
+    {
+      i1++; // the EOF1 for this file
+
+      memcpy(&eof, pTape + pMarks[i1].lPos + 4, sizeof(eof));
+
+      if(memcmp(eof.file_identifier, file.file_identifier, sizeof(eof.file_identifier)))
+        salvage_damage(&sv, pMarks[i1].lPos, pMarks[i1].lPos + 520, "EOF1 does not match HDR1");
+
+      lPos = pMarks[i1].lPos + 520 + 4;
+    }
+    else
+    {
+      lPos = lEnd;
+
+      if(lPos + 4 <= st.st_size && !memcmp(pTape + lPos, DATA_MARKER, 4))
+        lPos += 4;
+    }
+  }
+
+  salvage_end_file(&sv);
+
+  // after the end of the tape, there should only be zeros (or old data that
+  // was written over, which doesn't have any records in it)
+
+  if(lPos < st.st_size && find_tape_record(pTape, st.st_size, lPos, st.st_size) >= 0)
+    salvage_lost_data(&sv, lPos, st.st_size, NULL);
+
+  printf("\n%d FILES RECOVERED, %d DAMAGED REGIONS\n\n", sv.nFiles, sv.nDamaged);
+
+  iRval = sv.nDamaged ? 1 : 0;
+
+the_exit_point:
+  if(sv.out.iFD >= 0)
+    output_file_close(&(sv.out), 0, NULL);
+
+  if(sv.out.pBuf)
+    free(sv.out.pBuf);
+
+  if(sv.iOutDir >= 0)
+    close(sv.iOutDir);
+
+  if(pMarks)
+    free(pMarks);
+
+  if(pTape)
+    munmap(pTape, st.st_size);
+
+  if(iFD >= 0)
+    close(iFD);
+
+  return iRval;
+}
+
+
+// PARALLEL VALIDATION
+//
+// Validating a large tape reads every record, which takes a while when it's done one
+// record at a time.  Instead, the HDR1 and EOF1 records are found first (see
+// 'find_label_records()') which gives the position of every file, and then the data
+// records for each file are checked on several threads.  The output is the same as
+// 'read_the_tape()' with 'bValidate'.  If anything on the tape is not what it should
+// be, the tape is validated again by 'read_the_tape()' so that the errors are reported
+// exactly the same way.
+
+typedef struct _VALIDATE_FILE_
+{
+  off_t lHDR;              // position of the HDR1 record
+  off_t lEOF;              // position of the EOF1 record
+  int iSeq;                // file sequence number (counting files on the tape)
+  int bZeroed;             // 'ZEROED.ZZZ' (no data)
+  int bOK;                 // the data records are all valid
+  long nBlocks;            // data records in this file section
+} VALIDATE_FILE;
+
+typedef struct _VALIDATE_
+{
+  const uint8_t *pTape;
+  off_t cbTape;
+  VALIDATE_FILE *pFiles;
+} VALIDATE;
+
+// checks the data records for one file section, on a worker thread.  There must be a
+// data marker after the HDR1, then 512 byte records, then a data marker and the EOF1.
+void validate_file(void *pContext, int iItem)
+{
+VALIDATE *pV = (VALIDATE *)pContext;
+VALIDATE_FILE *pF = pV->pFiles + iItem;
+off_t lPos;
+
+  pF->bOK = 0;
+  pF->nBlocks = 0;
+
+  lPos = pF->lHDR + 520;
+
+  if(memcmp(pV->pTape + lPos, DATA_MARKER, 4))
+    return;
+
+  lPos += 4;
+
+  if(pF->bZeroed) // a 2nd data marker, and no data
+  {
+    pF->bOK = lPos + 4 == pF->lEOF && !memcmp(pV->pTape + lPos, DATA_MARKER, 4);
+    return;
+  }
+
+  while(lPos + 4 <= pF->lEOF && memcmp(pV->pTape + lPos, DATA_MARKER, 4))
+  {
+    if(!is_tape_record(pV->pTape, pV->cbTape, lPos))
+      return;
+
+    lPos += 520;
+    pF->nBlocks++;
+  }
+
+  pF->bOK = lPos + 4 == pF->lEOF;
+}
+
+// validates a tape, finding the files first and then checking them in parallel.
+// Returns 0 if the tape is valid, or 1 if it has to be validated by 'read_the_tape()'
+// (it has errors, or is not a simple tape).  Nothing is output unless it returns 0.
+int validate_tape_parallel(const char *szTapeFile, int nThreads)
+{
+int iFD = -1, i1, iRval = 1, iSeq, nMarks = 0, nFiles = 0, bContinued = 0;
+struct stat st;
+uint8_t *pTape = NULL;
+LABEL_MARK *pMarks = NULL;
+VALIDATE v;
+const RT11_VOL_HEADER *pVol;
+const RT11_FILE_HEADER *pFile;
+const RT11_FILE_EOF *pEOF;
+off_t lPos;
+char tbuf[512];
+
+  memset(&v, 0, sizeof(v));
+
+  iFD = open(szTapeFile, O_RDONLY | O_CLOEXEC);
+
+  if(iFD < 0 || fstat(iFD, &st) || st.st_size < 520 + 4)
+    goto the_exit_point;
+
+  pTape = (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, iFD, 0);
+
+  if(pTape == (uint8_t *)MAP_FAILED)
+  {
+    pTape = NULL;
+    goto the_exit_point;
+  }
+
+  pVol = (const RT11_VOL_HEADER *)(pTape + 4);
+
+  if(!is_tape_record(pTape, st.st_size, 0) ||
+     memcmp(pVol->label_identifier, "VOL", 3) || pVol->label_number != '1')
+  {
+    goto the_exit_point; // including an empty tape, or one with no volume header
+  }
+
+  nMarks = find_label_records(pTape, st.st_size, nThreads, &pMarks);
+
+  if(nMarks < 0)
+    goto the_exit_point;
+
+  v.pTape = pTape;
+  v.cbTape = st.st_size;
+  v.pFiles = (VALIDATE_FILE *)calloc(nMarks / 2 + 1, sizeof(*v.pFiles));
+
+  if(!v.pFiles)
+    goto the_exit_point;
+
+  // follow the files from one to the next, the same way 'read_the_tape()' does.  Any
+  // HDR1 or EOF1 records that are not where a file starts or ends are inside file data.
+
+  lPos = 520;
+  iSeq = -1;
+
+  if(is_tape_record(pTape, st.st_size, lPos) && memcmp(pTape + lPos + 4, "HDR", 3))
+  {
+    lPos += 520; // boot block
+    iSeq = 0;
+  }
+
+  for(i1=0; ; )
+  {
+    while(i1 < nMarks && pMarks[i1].lPos < lPos)
+      i1++;
+
+    if(i1 >= nMarks || pMarks[i1].lPos != lPos || pMarks[i1].bEOF)
+    {
+      // this has to be the end of the tape
+
+      if(lPos + 4 > st.st_size || memcmp(pTape + lPos, DATA_MARKER, 4))
+        goto the_exit_point;
+
+      break;
+    }
+
+    pFile = (const RT11_FILE_HEADER *)(pTape + lPos + 4);
+
+    if(nFiles > 0)
+    {
+      bContinued = is_next_file_section((const RT11_FILE_HEADER *)(pTape + v.pFiles[nFiles - 1].lHDR + 4),
+                                        pFile) &&
+                   !v.pFiles[nFiles - 1].bZeroed;
+    }
+
+    if(iSeq < 0)
+      iSeq = 0;
+
+    if(!bContinued)
+      iSeq++;
+
+    memset(tbuf, 0, sizeof(tbuf));
+    memcpy(tbuf, pFile->file_sequence_number, sizeof(pFile->file_sequence_number));
+
+    v.pFiles[nFiles].lHDR = lPos;
+    v.pFiles[nFiles].bZeroed = iSeq == 1 && atoi(tbuf) == 0;
+    v.pFiles[nFiles].iSeq = iSeq;
+
+    if(v.pFiles[nFiles].bZeroed)
+      iSeq = 0;
+
+    // the EOF1 is the first one after the HDR1 (the data is checked later)
+
+    for(i1++; i1 < nMarks && !pMarks[i1].bEOF; i1++)
+    { }
+
+    if(i1 >= nMarks)
+      goto the_exit_point;
+
+    v.pFiles[nFiles].lEOF = pMarks[i1].lPos;
+
+    lPos = pMarks[i1].lPos + 520; // there has to be a data marker after the EOF1
+
+    if(lPos + 4 > st.st_size || memcmp(pTape + lPos, DATA_MARKER, 4))
+      goto the_exit_point;
+
+    lPos += 4;
+    nFiles++;
+  }
+
+  if(DEBUG_OUTPUT_INFO)
+    fprintf(stderr, "*INFO* - %d HDR1/EOF1 records, %d files\n", nMarks, nFiles);
+
+  // check the data for every file, in parallel
+
+  run_in_parallel(nThreads, nFiles, validate_file, &v);
+
+  for(i1=0; i1 < nFiles; i1++)
+  {
+    if(!v.pFiles[i1].bOK)
+      goto the_exit_point;
+  }
+
+  // everything is where it should be, so the output is the same as 'read_the_tape()'
+
+  printf("RT11 TAPE  '%-3.3s' '%-10.10s' V%c Label V%c\n",
+         pVol->owner_identifier, pVol->owner_name,
+         pVol->DEC_standard_version, pVol->label_standard_version);
+
+  if(is_tape_record(pTape, st.st_size, 520) && memcmp(pTape + 524, "HDR", 3))
+    fputs("  *BOOT BLOCK DETECTED*\n", stdout);
+
+  for(i1=0; i1 < nFiles; i1++)
+  {
+    pFile = (const RT11_FILE_HEADER *)(pTape + v.pFiles[i1].lHDR + 4);
+    pEOF = (const RT11_FILE_EOF *)(pTape + v.pFiles[i1].lEOF + 4);
+
+    memset(tbuf, 0, sizeof(tbuf));
+    memcpy(tbuf, pFile->file_sequence_number, sizeof(pFile->file_sequence_number));
+
+    if(v.pFiles[i1].bZeroed)
+    {
+      fputs("  ** FOUND ZEROED.ZZZ **\n", stdout);
+    }
+    else if(v.pFiles[i1].iSeq != atoi(tbuf))
+    {
+      fprintf(stderr, "WARNING: Invalid file seq number in header - %d vs %d\n",
+              v.pFiles[i1].iSeq, atoi(tbuf));
+    }
+
+    memset(tbuf, 0, sizeof(tbuf));
+    memcpy(tbuf, pEOF->block_count, sizeof(pEOF->block_count));
+
+    if(memcmp(pEOF->file_identifier, pFile->file_identifier, sizeof(pEOF->file_identifier)) ||
+       atoi(tbuf) != v.pFiles[i1].nBlocks)
+    {
+      printf("    *EOF HEADER MISMATCH* \"%-17.17s\"  %s\n",
+             pEOF->file_identifier, tbuf);
+    }
+  }
+
+  fputs("** TAPE VALIDATED **\n", stdout);
+
+  iRval = 0;
+
+the_exit_point:
+  if(v.pFiles)
+    free(v.pFiles);
+
+  if(pMarks)
+    free(pMarks);
+
+  if(pTape)
+    munmap(pTape, st.st_size);
+
+  if(iFD >= 0)
+    close(iFD);
+
+  return iRval;
+}
+
+
+// ARCHIVE STORE
+//
+// A directory that holds a whole library of tapes, where data that is the same on more
+// than one tape (or more than once on a tape) is only stored once.  The records on a
+// tape are read with 'read_tape_block()', and the 512 byte blocks from them (not the
+// tape markers) make up a data stream that is cut into chunks wherever the data itself
+// says so (a "gear" rolling hash over the last 64 bytes).  Because of that, inserting
+// or removing a file only changes the chunks near it, and the rest line up with what's
+// already stored.  Each chunk is a file named for its hash, so the chunk directory is
+// the hash index:
+//
+//   store/chunks/3f/3f09c1a2b4d5e6f7     a chunk (a "-1" is added when two chunks that
+//                                        are different have the same hash)
+//   store/tapes/name.mft                 the manifest for tape file 'name'
+//
+// The manifest has the tape layout (how many records, then how many data markers, and
+// so on) followed by the list of chunks, which is everything needed to write the same
+// tape file again, byte for byte.  Each tape is read by its own thread.
+
+#define ARCHIVE_ID          "DECTAPE-ARCHIVE 1"
+#define ARCHIVE_MIN_CHUNK   2048
+#define ARCHIVE_MAX_CHUNK   65536
+#define ARCHIVE_CHUNK_MASK  (0x1fffULL << 51) /* 13 bits, about 8k per chunk */
+
+typedef struct _ARCHIVE_CHUNK_
+{
+  char szName[32];            // hash (16 hex digits) and maybe "-n"
+  int cbChunk;
+} ARCHIVE_CHUNK;
+
+typedef struct _ARCHIVE_RUN_
+{
+  char cType;                 // 'R' records, 'M' data markers, 'Z' zero bytes, 'X' other bytes
+  off_t lCount;
+} ARCHIVE_RUN;
+
+typedef struct _ARCHIVE_TAPE_
+{
+  const char *szStore;
+  const char *szTape;
+  ARCHIVE_RUN *pRuns;
+  int nRuns, nMaxRuns;
+  ARCHIVE_CHUNK *pChunks;
+  int nChunks, nMaxChunks;
+  off_t cbTape;
+  int nNewChunks;
+  off_t cbNew;                // bytes in new chunks
+  uint8_t *pBuf;              // chunk being built (ARCHIVE_MAX_CHUNK bytes)
+  int cbBuf;
+  uint64_t qwGear;            // rolling hash
+  int iRval;
+} ARCHIVE_TAPE;
+
+static uint64_t aqwGear[256];
+
+static void archive_init_gear(void)
+{
+uint64_t qw = 0x9e3779b97f4a7c15ULL;
+uint64_t qwZ;
+int i1;
+
+  for(i1=0; i1 < 256; i1++) // splitmix64, so the table is always the same
+  {
+    qwZ = (qw += 0x9e3779b97f4a7c15ULL);
+    qwZ = (qwZ ^ (qwZ >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    qwZ = (qwZ ^ (qwZ >> 27)) * 0x94d049bb133111ebULL;
+    aqwGear[i1] = qwZ ^ (qwZ >> 31);
+  }
+}
+
+// the file name of a tape in the store, without the path
+static const char *archive_tape_name(const char *szTape)
+{
+const char *p1 = strrchr(szTape, '/');
+
+  return p1 ? p1 + 1 : szTape;
+}
+
+static int archive_add_run(ARCHIVE_TAPE *pA, char cType, off_t lCount)
+{
+ARCHIVE_RUN *pR;
+
+  if(pA->nRuns && pA->pRuns[pA->nRuns - 1].cType == cType)
+  {
+    pA->pRuns[pA->nRuns - 1].lCount += lCount;
+    return 0;
+  }
+
+  if(pA->nRuns >= pA->nMaxRuns)
+  {
+    pR = (ARCHIVE_RUN *)realloc(pA->pRuns, sizeof(*pR) * (pA->nMaxRuns + 256));
+
+    if(!pR)
+      return -1;
+
+    pA->pRuns = pR;
+    pA->nMaxRuns += 256;
+  }
+
+  pA->pRuns[pA->nRuns].cType = cType;
+  pA->pRuns[pA->nRuns].lCount = lCount;
+  pA->nRuns++;
+
+  return 0;
+}
+
+// compares a stored chunk with 'pData'.  1 if the same, 0 if not, -1 if there is no such chunk
+static int archive_compare_chunk(const char *szPath, const uint8_t *pData, int cbData)
+{
+FILE *pF;
+uint8_t buf[ARCHIVE_MAX_CHUNK + 1];
+int cb1;
+
+  pF = fopen(szPath, "r");
+
+  if(!pF)
+    return -1;
+
+  cb1 = fread(buf, 1, sizeof(buf), pF);
+  fclose(pF);
+
+  return cb1 == cbData && !memcmp(buf, pData, cbData);
+}
+
+// stores the chunk in 'pA->pBuf' (unless it's already there) and adds it to the list
+static int archive_store_chunk(ARCHIVE_TAPE *pA, int iItem)
+{
+ARCHIVE_CHUNK *pC;
+uint64_t qwHash;
+int i1, iSuffix, cbDir;
+FILE *pF;
+char tbuf[PATH_MAX], szTemp[PATH_MAX + 32];
+
+  if(pA->nChunks >= pA->nMaxChunks)
+  {
+    pC = (ARCHIVE_CHUNK *)realloc(pA->pChunks, sizeof(*pC) * (pA->nMaxChunks + 1024));
+
+    if(!pC)
+      return -1;
+
+    pA->pChunks = pC;
+    pA->nMaxChunks += 1024;
+  }
+
+  pC = pA->pChunks + pA->nChunks;
+  pC->cbChunk = pA->cbBuf;
+
+  qwHash = fnv1a_hash(0xcbf29ce484222325ULL, pA->pBuf, pA->cbBuf);
+
+  cbDir = snprintf(tbuf, sizeof(tbuf), "%s/chunks/%02x", pA->szStore, (int)(qwHash >> 56));
+
+  if(mkdir(tbuf, 0777) && errno != EEXIST)
+  {
+    fprintf(stderr, "ERROR - unable to create \"%s\", errno=%d (%xH)\n", tbuf, errno, errno);
+    return -1;
+  }
+
+  // a new chunk is written to a temporary file, and then linked to its real name, which
+  // fails if another thread stored the same chunk first
+
+  for(iSuffix=0; ; )
+  {
+    if(iSuffix)
+      snprintf(pC->szName, sizeof(pC->szName), "%016llx-%d", (unsigned long long)qwHash, iSuffix);
+    else
+      snprintf(pC->szName, sizeof(pC->szName), "%016llx", (unsigned long long)qwHash);
+
+    snprintf(tbuf + cbDir, sizeof(tbuf) - cbDir, "/%s", pC->szName);
+
+    i1 = archive_compare_chunk(tbuf, pA->pBuf, pA->cbBuf);
+
+    if(i1 > 0)
+      break; // already stored
+
+    if(!i1)
+    {
+      iSuffix++; // same hash, different data
+      continue;
+    }
+
+    snprintf(szTemp, sizeof(szTemp), "%s.%d~", tbuf, iItem);
+
+    pF = fopen(szTemp, "w");
+
+    if(!pF || fwrite(pA->pBuf, pA->cbBuf, 1, pF) != 1 || fclose(pF))
+    {
+      fprintf(stderr, "ERROR - unable to write chunk \"%s\", errno=%d (%xH)\n", szTemp, errno, errno);
+
+      if(pF)
+        unlink(szTemp);
+
+      return -1;
+    }
+
+    i1 = link(szTemp, tbuf);
+    unlink(szTemp);
+
+    if(!i1)
+    {
+      pA->nNewChunks++;
+      pA->cbNew += pA->cbBuf;
+      break;
+    }
+
+    if(errno != EEXIST)
+    {
+      fprintf(stderr, "ERROR - unable to store chunk \"%s\", errno=%d (%xH)\n", tbuf, errno, errno);
+      return -1;
+    }
+
+    // somebody else stored it just now - compare it again
+  }
+
+  pA->nChunks++;
+  pA->cbBuf = 0;
+  pA->qwGear = 0;
+
+  return 0;
+}
+
+// adds data to the stream, cutting it into chunks
+static int archive_add_data(ARCHIVE_TAPE *pA, const uint8_t *pData, int cbData, int iItem)
+{
+int i1;
+
+  for(i1=0; i1 < cbData; i1++)
+  {
+    pA->pBuf[pA->cbBuf++] = pData[i1];
+    pA->qwGear = (pA->qwGear << 1) + aqwGear[pData[i1]];
+
+    if((pA->cbBuf >= ARCHIVE_MIN_CHUNK && !(pA->qwGear & ARCHIVE_CHUNK_MASK)) ||
+       pA->cbBuf >= ARCHIVE_MAX_CHUNK)
+    {
+      if(archive_store_chunk(pA, iItem))
+        return -1;
+    }
+  }
+
+  return 0;
+}
+
+static int archive_write_manifest(ARCHIVE_TAPE *pA)
+{
+FILE *pF;
+int i1;
+char tbuf[PATH_MAX], szTemp[PATH_MAX + 2];
+
+  snprintf(tbuf, sizeof(tbuf), "%s/tapes/%s.mft", pA->szStore, archive_tape_name(pA->szTape));
+  snprintf(szTemp, sizeof(szTemp), "%s~", tbuf);
+
+  pF = fopen(szTemp, "w");
+
+  if(!pF)
+  {
+    fprintf(stderr, "ERROR - unable to create \"%s\", errno=%d (%xH)\n", szTemp, errno, errno);
+    return -1;
+  }
+
+  fprintf(pF, "%s\nTAPE %lld %d %d\n", ARCHIVE_ID, (long long)pA->cbTape, pA->nRuns, pA->nChunks);
+
+  for(i1=0; i1 < pA->nRuns; i1++)
+    fprintf(pF, "%c %lld\n", pA->pRuns[i1].cType, (long long)pA->pRuns[i1].lCount);
+
+  for(i1=0; i1 < pA->nChunks; i1++)
+    fprintf(pF, "%s %d\n", pA->pChunks[i1].szName, pA->pChunks[i1].cbChunk);
+
+  if(fclose(pF) || rename(szTemp, tbuf))
+  {
+    fprintf(stderr, "ERROR - unable to write \"%s\", errno=%d (%xH)\n", tbuf, errno, errno);
+    unlink(szTemp);
+    return -1;
+  }
+
+  return 0;
+}
+
+// 'run_in_parallel()' callback - adds one tape to the store
+static void archive_ingest_tape(void *pContext, int iItem)
+{
+ARCHIVE_TAPE *pA = ((ARCHIVE_TAPE *)pContext) + iItem;
+FILE *pTape;
+off_t lPos, lEnd;
+int i1, cb1, bZero;
+uint8_t block[512];
+
+  pA->iRval = -1;
+
+  pTape = fopen(pA->szTape, "r");
+
+  if(!pTape)
+  {
+    fprintf(stderr, "Unable to open tape file \"%s\", errno=%d (%xH)\n", pA->szTape, errno, errno);
+    return;
+  }
+
+  setvbuf(pTape, NULL, _IOFBF, TAPE_BUFSIZE);
+
+  pA->pBuf = (uint8_t *)malloc(ARCHIVE_MAX_CHUNK);
+
+  if(!pA->pBuf)
+    goto the_exit_point;
+
+  while(1)
+  {
+    lPos = ftello(pTape);
+
+    i1 = read_tape_block(pTape, block);
+
+    if(i1 == 0)
+    {
+      if(archive_add_run(pA, 'R', 1) || archive_add_data(pA, block, 512, iItem))
+        goto the_exit_point;
+    }
+    else if(i1 == 1)
+    {
+      if(archive_add_run(pA, 'M', 1))
+        goto the_exit_point;
+    }
+    else
+    {
+      break;
+    }
+  }
+
+  // whatever is left isn't a record or a data marker (usually it's nothing, or a partial
+  // data marker at the end).  Zeros are only counted.  Anything else goes into the stream.
+
+  fseeko(pTape, lPos, SEEK_SET);
+
+  while((cb1 = fread(block, 1, sizeof(block), pTape)) > 0)
+  {
+    for(i1=0, bZero=1; bZero && i1 < cb1; i1++)
+      bZero = !block[i1];
+
+    if(archive_add_run(pA, bZero ? 'Z' : 'X', cb1) ||
+       (!bZero && archive_add_data(pA, block, cb1, iItem)))
+    {
+      goto the_exit_point;
+    }
+  }
+
+  lEnd = ftello(pTape);
+
+  if(ferror(pTape))
+  {
+    fprintf(stderr, "ERROR - unable to read tape file \"%s\", errno=%d (%xH)\n", pA->szTape, errno, errno);
+    goto the_exit_point;
+  }
+
+  if(pA->cbBuf && archive_store_chunk(pA, iItem))
+    goto the_exit_point;
+
+  pA->cbTape = lEnd;
+
+  if(!archive_write_manifest(pA))
+    pA->iRval = 0;
+
+the_exit_point:
+  fclose(pTape);
+
+  if(pA->pBuf)
+  {
+    free(pA->pBuf);
+    pA->pBuf = NULL;
+  }
+}
+
+// lists the tapes in the store
+static int archive_list(const char *szStore)
+{
+void *pD;
+FILE *pF;
+unsigned long dwMode;
+long long cbTape;
+int cbDir, nTapes = 0;
+char tbuf[PATH_MAX], szLine[256];
+
+  snprintf(tbuf, sizeof(tbuf), "%s/tapes/*.mft", szStore);
+
+  pD = WBAllocDirectoryList(tbuf);
+
+  if(!pD)
+  {
+    fprintf(stderr, "ERROR - \"%s\" is not an archive store\n", szStore);
+    return -1;
+  }
+
+  cbDir = snprintf(tbuf, sizeof(tbuf), "%s/tapes/", szStore);
+
+  while(!WBNextDirectoryEntry(pD, tbuf + cbDir, sizeof(tbuf) - cbDir - 1, &dwMode))
+  {
+    pF = fopen(tbuf, "r");
+
+    if(!pF)
+      continue;
+
+    if(fgets(szLine, sizeof(szLine), pF) && !strncmp(szLine, ARCHIVE_ID, strlen(ARCHIVE_ID)) &&
+       fscanf(pF, "TAPE %lld", &cbTape) == 1)
+    {
+      tbuf[strlen(tbuf) - 4] = 0; // without the '.mft'
+
+      printf("  %-40s %14lld\n", tbuf + cbDir, cbTape);
+      nTapes++;
+    }
+
+    fclose(pF);
+  }
+
+  WBDestroyDirectoryList(pD);
+
+  printf("\n%d TAPES\n", nTapes);
+
+  return 0;
+}
+
+// adds tapes to the store (creating it if it doesn't exist), or lists them if there are none
+int archive_tapes(const char *szStore, char * const *pTapes, int nTapes, int nThreads)
+{
+ARCHIVE_TAPE *pTapeList;
+int i1, iRval = 0;
+long long cbTotal = 0, cbNew = 0;
+char tbuf[PATH_MAX];
+
+  if(!nTapes)
+    return archive_list(szStore);
+
+  mkdir(szStore, 0777);
+  snprintf(tbuf, sizeof(tbuf), "%s/chunks", szStore);
+  mkdir(tbuf, 0777);
+  snprintf(tbuf, sizeof(tbuf), "%s/tapes", szStore);
+
+  if(mkdir(tbuf, 0777) && errno != EEXIST)
+  {
+    fprintf(stderr, "ERROR - unable to create archive store \"%s\", errno=%d (%xH)\n", szStore, errno, errno);
+    return -1;
+  }
+
+  pTapeList = (ARCHIVE_TAPE *)calloc(nTapes, sizeof(*pTapeList));
+
+  if(!pTapeList)
+    return -1;
+
+  archive_init_gear();
+
+  for(i1=0; i1 < nTapes; i1++)
+  {
+    pTapeList[i1].szStore = szStore;
+    pTapeList[i1].szTape = pTapes[i1];
+  }
+
+  run_in_parallel(nThreads, nTapes, archive_ingest_tape, pTapeList);
+
+  for(i1=0; i1 < nTapes; i1++)
+  {
+    if(pTapeList[i1].iRval)
+    {
+      fprintf(stderr, "ERROR - \"%s\" was not archived\n", pTapes[i1]);
+      iRval = -1;
+    }
+    else
+    {
+      printf("  %-40s %14lld  %7d CHUNKS  %7d NEW  %14lld BYTES NEW\n",
+             archive_tape_name(pTapes[i1]), (long long)pTapeList[i1].cbTape,
+             pTapeList[i1].nChunks, pTapeList[i1].nNewChunks, (long long)pTapeList[i1].cbNew);
+
+      cbTotal += pTapeList[i1].cbTape;
+      cbNew += pTapeList[i1].cbNew;
+    }
+
+    if(pTapeList[i1].pRuns)
+      free(pTapeList[i1].pRuns);
+
+    if(pTapeList[i1].pChunks)
+      free(pTapeList[i1].pChunks);
+  }
+
+  free(pTapeList);
+
+  printf("\n%d TAPES, %lld BYTES, %lld NEW BYTES STORED\n", nTapes, cbTotal, cbNew);
+
+  return iRval;
+}
+
+// reads the next chunk listed in a manifest
+static int archive_next_chunk(FILE *pM, const char *szStore, uint8_t *pChunk, int *pcbChunk)
+{
+FILE *pC;
+int cbChunk;
+char tbuf[PATH_MAX], szChunk[32];
+
+  if(fscanf(pM, "%31s %d ", szChunk, &cbChunk) != 2 || cbChunk <= 0 || cbChunk > ARCHIVE_MAX_CHUNK)
+  {
+    fprintf(stderr, "ERROR - the manifest is missing chunks\n");
+    return -1;
+  }
+
+  snprintf(tbuf, sizeof(tbuf), "%s/chunks/%2.2s/%s", szStore, szChunk, szChunk);
+
+  pC = fopen(tbuf, "r");
+
+  if(!pC || fread(pChunk, cbChunk, 1, pC) != 1)
+  {
+    fprintf(stderr, "ERROR - unable to read chunk \"%s\", errno=%d (%xH)\n", tbuf, errno, errno);
+
+    if(pC)
+      fclose(pC);
+
+    return -1;
+  }
+
+  fclose(pC);
+
+  *pcbChunk = cbChunk;
+
+  return 0;
+}
+
+// writes a tape file from the store, exactly as it was archived
+int archive_rebuild(const char *szStore, const char *szName, const char *szTapeFile)
+{
+FILE *pM, *pTape = NULL;
+ARCHIVE_RUN *pRuns = NULL;
+long long cbTape, lCount;
+int i1, iRval = -1, nRuns, nChunks, cbChunk = 0, iData = 0, cbData, cb1, cbCopy;
+off_t lDone;
+char cType;
+uint8_t *pChunk = NULL;
+uint8_t block[512];
+char tbuf[PATH_MAX], szLine[256];
+
+  snprintf(tbuf, sizeof(tbuf), "%s/tapes/%s.mft", szStore, szName);
+
+  pM = fopen(tbuf, "r");
+
+  if(!pM)
+  {
+    fprintf(stderr, "ERROR - tape \"%s\" is not in archive store \"%s\"\n", szName, szStore);
+    return -1;
+  }
+
+  if(!fgets(szLine, sizeof(szLine), pM) || strncmp(szLine, ARCHIVE_ID, strlen(ARCHIVE_ID)) ||
+     fscanf(pM, "TAPE %lld %d %d ", &cbTape, &nRuns, &nChunks) != 3 || nRuns < 0 || nChunks < 0)
+  {
+    fprintf(stderr, "ERROR - \"%s\" is not a valid manifest\n", tbuf);
+    goto the_exit_point;
+  }
+
+  pRuns = (ARCHIVE_RUN *)malloc(sizeof(*pRuns) * (nRuns + 1));
+  pChunk = (uint8_t *)malloc(ARCHIVE_MAX_CHUNK);
+
+  if(!pRuns || !pChunk)
+    goto the_exit_point;
+
+  for(i1=0; i1 < nRuns; i1++)
+  {
+    if(fscanf(pM, "%c %lld ", &cType, &lCount) != 2 || !strchr("RMZX", cType) || lCount < 0)
+    {
+      fprintf(stderr, "ERROR - \"%s\" is not a valid manifest\n", tbuf);
+      goto the_exit_point;
+    }
+
+    pRuns[i1].cType = cType;
+    pRuns[i1].lCount = lCount;
+  }
+
+  pTape = fopen(szTapeFile, "w");
+
+  if(!pTape)
+  {
+    fprintf(stderr, "Unable to open tape file \"%s\", errno=%d (%xH)\n", szTapeFile, errno, errno);
+    goto the_exit_point;
+  }
+
+  setvbuf(pTape, NULL, _IOFBF, TAPE_BUFSIZE);
+
+  // the chunks are read as they're needed, while the layout says what to do with them.
+  // Data markers and zeros are skipped over (so they're a hole in the file, if they can be).
+
+  for(i1=0; i1 < nRuns; i1++)
+  {
+    if(pRuns[i1].cType == 'M' || pRuns[i1].cType == 'Z')
+    {
+      if(fseeko(pTape, pRuns[i1].lCount * (pRuns[i1].cType == 'M' ? 4 : 1), SEEK_CUR))
+        goto the_write_error;
+
+      continue;
+    }
+
+    // a record is a tape marker, 512 bytes of data, and another tape marker.  Other
+    // bytes ('X') are written just as they are.
+
+    for(lDone=0; lDone < pRuns[i1].lCount; )
+    {
+      cbData = pRuns[i1].cType == 'R' || pRuns[i1].lCount - lDone > 512
+             ? 512 : (int)(pRuns[i1].lCount - lDone);
+
+      for(cb1=0; cb1 < cbData; ) // a block can be split between 2 chunks
+      {
+        if(iData >= cbChunk)
+        {
+          if(!nChunks-- || archive_next_chunk(pM, szStore, pChunk, &cbChunk))
+            goto the_exit_point;
+
+          iData = 0;
+        }
+
+        cbCopy = cbData - cb1 < cbChunk - iData ? cbData - cb1 : cbChunk - iData;
+        memcpy(block + cb1, pChunk + iData, cbCopy);
+        cb1 += cbCopy;
+        iData += cbCopy;
+      }
+
+      if(pRuns[i1].cType == 'R')
+      {
+        if(write_tape_block(pTape, block))
+          goto the_write_error;
+
+        lDone++;
+      }
+      else
+      {
+        if(fwrite(block, cbData, 1, pTape) != 1)
+          goto the_write_error;
+
+        lDone += cbData;
+      }
+    }
+  }
+
+  if(fflush(pTape) || ftruncate(fileno(pTape), cbTape))
+    goto the_write_error;
+
+  iRval = 0;
+  goto the_exit_point;
+
+the_write_error:
+  fprintf(stderr, "ERROR - unable to write tape file \"%s\", errno=%d (%xH)\n", szTapeFile, errno, errno);
+
+the_exit_point:
+  if(pTape && fclose(pTape))
+    iRval = -1;
+
+  fclose(pM);
+
+  if(pRuns)
+    free(pRuns);
+
+  if(pChunk)
+    free(pChunk);
+
+  return iRval;
+}
+
+
+// TAPE LAYOUT
+//
+// The emulator can only read a tape from the beginning ('PIP' rewinds the tape for
+// every file), so the further along the tape a file is, the longer it takes to load.
+// '-O' writes the files in a better order than the directory gives them in.  It's
+// either 'size' (smallest files first), or an order file with one file name per line.
+// A name can be followed by a count, and a name that is in the file more than once is
+// counted each time, so the file can be a priority list or a log of which files were
+// used.  Files with the highest count go first, then (for the same count) the ones
+// that are in the file first, then files that aren't in it, smallest first.
+//
+// The cost report estimates how long each file takes to load, from where it is on
+// the tape, for a TU10 at 800 BPI and 45 inches per second, with a 0.6 inch gap
+// between records.
+
+#define LAYOUT_BYTES_PER_SECOND 36000.0          /* 800 BPI at 45 IPS */
+#define LAYOUT_GAP_SECONDS      (0.6 / 45.0)     /* inter-record gap */
+#define LAYOUT_RECORD_SECONDS   (512 / LAYOUT_BYTES_PER_SECOND + LAYOUT_GAP_SECONDS)
+
+typedef struct _LAYOUT_ENTRY_
+{
+  char szName[NAME_MAX + 1];
+  unsigned long dwMode;
+  off_t lSize;
+  long long nCount;           // from the order file, or 0
+  int iFirst;                 // where it is in the order file (first time), or INT_MAX
+} LAYOUT_ENTRY;
+
+struct _LAYOUT_LIST_ // typedef'd as LAYOUT_LIST
+{
+  LAYOUT_ENTRY *pEntries;
+  int nEntries, nMaxEntries;
+  int iNext;                  // for 'layout_next_entry()'
+};
+
+static LAYOUT_ENTRY *layout_add_entry(LAYOUT_LIST *pL, const char *szName)
+{
+LAYOUT_ENTRY *pE;
+
+  if(pL->nEntries >= pL->nMaxEntries)
+  {
+    pE = (LAYOUT_ENTRY *)realloc(pL->pEntries, sizeof(*pE) * (pL->nMaxEntries + 128));
+
+    if(!pE)
+      return NULL;
+
+    pL->pEntries = pE;
+    pL->nMaxEntries += 128;
+  }
+
+  pE = pL->pEntries + pL->nEntries++;
+
+  memset(pE, 0, sizeof(*pE));
+  strncpy(pE->szName, szName, sizeof(pE->szName) - 1);
+  pE->iFirst = INT_MAX;
+
+  return pE;
+}
+
+static LAYOUT_ENTRY *layout_find_entry(LAYOUT_LIST *pL, const char *szName)
+{
+int i1;
+
+  for(i1=0; i1 < pL->nEntries; i1++)
+  {
+    if(!strcasecmp(pL->pEntries[i1].szName, szName))
+      return pL->pEntries + i1;
+  }
+
+  return NULL;
+}
+
+// reads an order file, adding up the count for each name
+static int layout_read_order(const char *szOrder, LAYOUT_LIST *pL)
+{
+FILE *pF;
+LAYOUT_ENTRY *pE;
+long long nCount;
+int iLine = 0;
+char szLine[512], szName[NAME_MAX + 1];
+
+  pF = fopen(szOrder, "r");
+
+  if(!pF)
+  {
+    fprintf(stderr, "ERROR - unable to open order file \"%s\", errno=%d (%xH)\n", szOrder, errno, errno);
+    return -1;
+  }
+
+  while(fgets(szLine, sizeof(szLine), pF))
+  {
+    nCount = 1;
+
+    if(sscanf(szLine, "%255s %lld", szName, &nCount) < 1 || szName[0] == '#')
+      continue; // blank lines and comments
+
+    pE = layout_find_entry(pL, szName);
+
+    if(!pE && !(pE = layout_add_entry(pL, szName)))
+    {
+      fclose(pF);
+      return -1;
+    }
+
+    if(pE->iFirst == INT_MAX)
+      pE->iFirst = iLine++;
+
+    pE->nCount += nCount;
+  }
+
+  fclose(pF);
+
+  return 0;
+}
+
+static int layout_compare(const void *p1, const void *p2)
+{
+const LAYOUT_ENTRY *pE1 = (const LAYOUT_ENTRY *)p1;
+const LAYOUT_ENTRY *pE2 = (const LAYOUT_ENTRY *)p2;
+
+  if(pE1->nCount != pE2->nCount)
+    return pE1->nCount > pE2->nCount ? -1 : 1;
+
+  if(pE1->iFirst != pE2->iFirst)
+    return pE1->iFirst < pE2->iFirst ? -1 : 1;
+
+  if(pE1->lSize != pE2->lSize)
+    return pE1->lSize < pE2->lSize ? -1 : 1;
+
+  return strcmp(pE1->szName, pE2->szName);
+}
+
+// lists a directory (like 'WBAllocDirectoryList()') in the '-O' order
+LAYOUT_LIST *layout_sort_directory(const char *szDirSpec, const char *szOrder)
+{
+LAYOUT_LIST *pL, order;
+LAYOUT_ENTRY *pE, *pO;
+void *pD;
+unsigned long dwMode;
+int cbDir;
+const char *p1;
+struct stat st;
+char tbuf[PATH_MAX * 2];
+
+  memset(&order, 0, sizeof(order));
+
+  if(strcmp(szOrder, "size") && layout_read_order(szOrder, &order))
+    return NULL;
+
+  pL = (LAYOUT_LIST *)calloc(1, sizeof(*pL));
+  pD = WBAllocDirectoryList(szDirSpec);
+
+  if(!pL || !pD)
+    goto the_error_exit;
+
+  // the directory part of 'szDirSpec' (it ends with a wildcard), to 'stat()' the files
+
+  p1 = strrchr(szDirSpec, '/');
+  cbDir = p1 ? p1 - szDirSpec + 1 : 0;
+  memcpy(tbuf, szDirSpec, cbDir);
+
+  while(!WBNextDirectoryEntry(pD, tbuf + cbDir, sizeof(tbuf) - cbDir - 1, &dwMode))
+  {
+    pE = layout_add_entry(pL, tbuf + cbDir);
+
+    if(!pE)
+      goto the_error_exit;
+
+    pE->dwMode = dwMode;
+
+    if(!stat(tbuf, &st))
+      pE->lSize = st.st_size;
+
+    pO = layout_find_entry(&order, pE->szName);
+
+    if(pO)
+    {
+      pE->nCount = pO->nCount;
+      pE->iFirst = pO->iFirst;
+    }
+  }
+
+  WBDestroyDirectoryList(pD);
+
+  if(order.pEntries)
+    free(order.pEntries);
+
+  qsort(pL->pEntries, pL->nEntries, sizeof(*(pL->pEntries)), layout_compare);
+
+  return pL;
+
+the_error_exit:
+  fprintf(stderr, "ERROR - unable to get directory list for \"%s\", errno=%d (%xH)\n",
+          szDirSpec, errno, errno);
+
+  if(pD)
+    WBDestroyDirectoryList(pD);
+
+  layout_destroy_list(pL);
+
+  if(order.pEntries)
+    free(order.pEntries);
+
+  return NULL;
+}
+
+// same as 'WBNextDirectoryEntry()'
+int layout_next_entry(LAYOUT_LIST *pL, char *szNameReturn, int cbNameReturn, unsigned long *pdwModeAttrReturn)
+{
+LAYOUT_ENTRY *pE;
+
+  if(pL->iNext >= pL->nEntries)
+    return 1;
+
+  pE = pL->pEntries + pL->iNext++;
+
+  strncpy(szNameReturn, pE->szName, cbNameReturn);
+  szNameReturn[cbNameReturn - 1] = 0;
+
+  *pdwModeAttrReturn = pE->dwMode;
+
+  return 0;
+}
+
+void layout_destroy_list(LAYOUT_LIST *pL)
+{
+  if(!pL)
+    return;
+
+  if(pL->pEntries)
+    free(pL->pEntries);
+
+  free(pL);
+}
+
+typedef struct _LAYOUT_REPORT_
+{
+  LAYOUT_LIST *pOrder;        // counts from the order file, if there is one
+  off_t lPos;                 // where the current file's header is
+  char szIdentifier[18];
+  double dTotal, dWeighted;   // total time for all files, and weighted by count
+  long long nCounted;
+  int nFiles;
+} LAYOUT_REPORT;
+
+static int layout_report_file(void *pContext, const RT11_FILE_HEADER *pFile, off_t lPos)
+{
+LAYOUT_REPORT *pR = (LAYOUT_REPORT *)pContext;
+
+  memcpy(pR->szIdentifier, pFile->file_identifier, 17);
+  pR->szIdentifier[17] = 0;
+  pR->lPos = lPos;
+
+  return 0;
+}
+
+static int layout_report_eof(void *pContext, const RT11_FILE_EOF *pEOF, int nBlocks)
+{
+LAYOUT_REPORT *pR = (LAYOUT_REPORT *)pContext;
+LAYOUT_ENTRY *pE;
+double dStart, dLoad;
+long long nCount = 0;
+char tbuf[32];
+
+  // rewind to the start of tape, pass everything before it, then read it
+  // (the header, the data, and the EOF record).  Each data marker is about a record.
+
+  dStart = (double)(pR->lPos / 520) * LAYOUT_RECORD_SECONDS;
+  dLoad = dStart + (nBlocks + 2 + 3) * LAYOUT_RECORD_SECONDS;
+
+  make_output_file_name(pR->szIdentifier, tbuf, sizeof(tbuf));
+
+  if(pR->pOrder && (pE = layout_find_entry(pR->pOrder, tbuf)))
+    nCount = pE->nCount;
+
+  printf("  %-17.17s  %6d  %9lld  %9.1f  %9.1f", pR->szIdentifier, nBlocks,
+         (long long)(pR->lPos / 520), dStart, dLoad);
+
+  if(pR->pOrder)
+    printf("  %8lld", nCount);
+
+  putchar('\n');
+
+  pR->dTotal += dLoad;
+  pR->dWeighted += dLoad * nCount;
+  pR->nCounted += nCount;
+  pR->nFiles++;
+
+  return 0;
+}
+
+// prints the estimated time to load each file on a tape
+int layout_report(const char *szTapeFile, const char *szOrder)
+{
+FILE *pTape;
+TAPE_WALK walk;
+LAYOUT_REPORT rpt;
+LAYOUT_LIST order;
+int iRval;
+
+  memset(&rpt, 0, sizeof(rpt));
+  memset(&order, 0, sizeof(order));
+
+  if(szOrder && strcmp(szOrder, "size"))
+  {
+    if(layout_read_order(szOrder, &order))
+      return -1;
+
+    rpt.pOrder = &order;
+  }
+
+  pTape = fopen(szTapeFile, "r");
+
+  if(!pTape)
+  {
+    fprintf(stderr, "Unable to open tape file \"%s\", errno=%d (%xH)\n", szTapeFile, errno, errno);
+    iRval = -1;
+    goto the_exit_point;
+  }
+
+  setvbuf(pTape, NULL, _IOFBF, TAPE_BUFSIZE);
+
+  memset(&walk, 0, sizeof(walk));
+  walk.pfnFile = layout_report_file;
+  walk.pfnEOF = layout_report_eof;
+  walk.pContext = &rpt;
+
+  printf("FILE NAME            BLOCKS     RECORD  START (s)   LOAD (s)%s\n",
+         rpt.pOrder ? "     COUNT" : "");
+
+  iRval = walk_tape(pTape, &walk);
+
+  fclose(pTape);
+
+  if(iRval)
+    fprintf(stderr, "ERROR - tape \"%s\" is damaged, the report stops there\n", szTapeFile);
+
+  if(rpt.nFiles)
+    printf("\n%d FILES, AVERAGE LOAD TIME %.1f SECONDS", rpt.nFiles, rpt.dTotal / rpt.nFiles);
+
+  if(rpt.nCounted)
+    printf(", %.1f SECONDS WEIGHTED BY COUNT", rpt.dWeighted / rpt.nCounted);
+
+  printf("\n\n");
+
+the_exit_point:
+  if(order.pEntries)
+    free(order.pEntries);
+
+  return iRval;
+}
+
+
+// TAPE INDEX
+//
+// Where each file is on a tape, from one pass with 'walk_tape()'.  With the index, a
+// file's data can be copied straight from the tape file without reading anything
+// else.  'ZEROED.ZZZ' isn't in the index, and a file with more than one section (on
+// the same tape file) is in it once for each section.
+
+#define INDEX_READ_RECORDS 128 /* records read at a time when copying a file */
+#define INDEX_STREAM_RECORDS 2048 /* records read at a time when streaming a file */
+
+typedef struct _TAPE_INDEX_ENTRY_
+{
+  char szIdentifier[18];   // "NAME  .EXT" (17 characters)
+  char szDate[7];          // the creation date, as it is in the header
+  int iSeq;                // file sequence number
+  off_t lData;             // position of the first data record
+  long long nBlocks;
+} TAPE_INDEX_ENTRY;
+
+struct _TAPE_INDEX_ // typedef'd as TAPE_INDEX
+{
+  TAPE_INDEX_ENTRY *pEntries;
+  int nEntries, nMaxEntries;
+  off_t lEnd;              // position of the end of tape marker
+  int iLastSeq;            // sequence number of the last file (for appending)
+  RT11_FILE_HEADER prev;   // the previous file header, for file sections
+  int bPrev;
+};
+
+static int tape_index_file(void *pContext, const RT11_FILE_HEADER *pFile, off_t lPos)
+{
+TAPE_INDEX *pI = (TAPE_INDEX *)pContext;
+TAPE_INDEX_ENTRY *pE;
+char tbuf[8];
+
+  // the sequence number is counted the same way as 'read_the_tape()' does
+
+  if(!pI->bPrev || !is_next_file_section(&(pI->prev), pFile))
+    pI->iLastSeq++;
+
+  pI->prev = *pFile;
+  pI->bPrev = 1;
+
+  memcpy(tbuf, pFile->file_sequence_number, sizeof(pFile->file_sequence_number));
+  tbuf[sizeof(pFile->file_sequence_number)] = 0;
+
+  if(pI->iLastSeq == 1 && atoi(tbuf) == 0) // 'ZEROED.ZZZ'
+  {
+    pI->iLastSeq = 0;
+    return 0;
+  }
+
+  if(pI->nEntries >= pI->nMaxEntries)
+  {
+    pE = (TAPE_INDEX_ENTRY *)realloc(pI->pEntries, sizeof(*pE) * (pI->nMaxEntries + 128));
+
+    if(!pE)
+      return -1;
+
+    pI->pEntries = pE;
+    pI->nMaxEntries += 128;
+  }
+
+  pE = pI->pEntries + pI->nEntries++;
+
+  memcpy(pE->szIdentifier, pFile->file_identifier, 17);
+  pE->szIdentifier[17] = 0;
+  memcpy(pE->szDate, pFile->creation_date, 6);
+  pE->szDate[6] = 0;
+  pE->iSeq = pI->iLastSeq;
+  pE->lData = lPos + 520 + 4; // after the header and the data marker
+  pE->nBlocks = 0;
+
+  return 0;
+}
+
+static int tape_index_eof(void *pContext, const RT11_FILE_EOF *pEOF, int nBlocks)
+{
+TAPE_INDEX *pI = (TAPE_INDEX *)pContext;
+
+  if(pI->nEntries > 0 && pI->iLastSeq) // not for 'ZEROED.ZZZ'
+    pI->pEntries[pI->nEntries - 1].nBlocks = nBlocks;
+
+  return 0;
+}
+
+// builds the index for a tape.  Returns 0 if it's a good tape.
+int tape_index_build(FILE *pTape, TAPE_INDEX *pI)
+{
+TAPE_WALK walk;
+
+  memset(pI, 0, sizeof(*pI));
+
+  memset(&walk, 0, sizeof(walk));
+  walk.pfnFile = tape_index_file;
+  walk.pfnEOF = tape_index_eof;
+  walk.pContext = pI;
+
+  if(walk_tape(pTape, &walk) || !walk.bTape)
+    return -1;
+
+  pI->lEnd = ftello(pTape) - 4; // 'walk_tape()' read the end of tape marker
+
+  return 0;
+}
+
+// non-zero if there's a tape record (a tape marker at each end) at 'lPos'
+static int tape_index_is_record(int iFD, off_t lPos)
+{
+uint8_t marker[4];
+
+  return pread(iFD, marker, 4, lPos) == 4 && !memcmp(marker, TAPE_MARKER, 4) &&
+         pread(iFD, marker, 4, lPos + 516) == 4 && !memcmp(marker, TAPE_MARKER, 4);
+}
+
+// reads the EOF1 that should be after 'nBlocks' data records at 'lData' (and the data
+// marker in front of it).  Returns 0 if it's there (and with 'bCount', if its block
+// count agrees).
+static int tape_index_read_eof(int iFD, off_t lData, long long nBlocks, int bCount, RT11_FILE_EOF *pEOF)
+{
+uint8_t rec[4 + 520];
+char tbuf[8];
+
+  if(pread(iFD, rec, sizeof(rec), lData + nBlocks * 520) != sizeof(rec) ||
+     memcmp(rec, DATA_MARKER, 4) || memcmp(rec + 4, TAPE_MARKER, 4) ||
+     memcmp(rec + 520, TAPE_MARKER, 4))
+  {
+    return -1;
+  }
+
+  memcpy(pEOF, rec + 8, sizeof(*pEOF));
+
+  memcpy(tbuf, pEOF->block_count, sizeof(pEOF->block_count));
+  tbuf[sizeof(pEOF->block_count)] = 0;
+
+  if(memcmp(pEOF->label_identifier, "EOF", 3) || (bCount && atoll(tbuf) && atoll(tbuf) != nBlocks))
+    return -1;
+
+  return 0;
+}
+
+// adds the files from 'lPos' to the end of tape marker to the index.  At 0 that's the
+// whole tape (with the volume label and the boot block), otherwise 'lPos' is where the
+// end of tape marker was when the index was built, and it's the files appended since.
+static int tape_index_scan_from(int iFD, TAPE_INDEX *pI, off_t lPos)
+{
+long long nBlocks, nLow, nHigh;
+int bFirst = !lPos, bTape = !!lPos;
+uint8_t rec[520];
+RT11_FILE_HEADER *pFile = (RT11_FILE_HEADER *)(rec + 4);
+RT11_FILE_EOF eof;
+
+  while(1)
+  {
+    if(pread(iFD, rec, 4, lPos) != 4)
+      return -1;
+
+    if(!memcmp(rec, DATA_MARKER, 4)) // end of tape
+      break;
+
+    if(pread(iFD, rec, sizeof(rec), lPos) != sizeof(rec) ||
+       memcmp(rec, TAPE_MARKER, 4) || memcmp(rec + 516, TAPE_MARKER, 4))
+    {
+      return -1;
+    }
+
+    lPos += 520;
+
+    if(bFirst && !memcmp(pFile->label_identifier, "VOL", 3))
+    {
+      bTape = 1;
+      continue;
+    }
+
+    if(memcmp(pFile->label_identifier, "HDR", 3) || pFile->label_number != '1')
+    {
+      if(bFirst && bTape) // a boot block
+      {
+        bFirst = 0;
+        continue;
+      }
+
+      return -1;
+    }
+
+    bTape = 1;
+    bFirst = 0;
+
+    if(tape_index_file(pI, pFile, lPos - 520) ||
+       pread(iFD, rec, 4, lPos) != 4 || memcmp(rec, DATA_MARKER, 4))
+    {
+      return -1;
+    }
+
+    lPos += 4; // the first data record
+
+    // double the count until it's past the end, then search between the two
+
+    for(nLow=0, nHigh=0; tape_index_is_record(iFD, lPos + nHigh * 520); nHigh = nHigh * 2 + 1)
+      nLow = nHigh + 1;
+
+    while(nLow < nHigh)
+    {
+      nBlocks = (nLow + nHigh) / 2;
+
+      if(tape_index_is_record(iFD, lPos + nBlocks * 520))
+        nLow = nBlocks + 1;
+      else
+        nHigh = nBlocks;
+    }
+
+    nBlocks = nLow;
+
+    if(tape_index_read_eof(iFD, lPos, nBlocks, 1, &eof))
+    {
+      for(nBlocks=0; tape_index_is_record(iFD, lPos + nBlocks * 520); nBlocks++)
+        ;
+
+      if(tape_index_read_eof(iFD, lPos, nBlocks, 0, &eof))
+        return -1;
+    }
+
+    if(DEBUG_OUTPUT_CHATTY)
+      fprintf(stderr, "*INFO* - \"%-17.17s\" %lld blocks at %lld\n",
+              eof.file_identifier, nBlocks, (long long)lPos);
+
+    tape_index_eof(pI, &eof, (int)nBlocks);
+
+    lPos += nBlocks * 520 + 4 + 520; // data marker, EOF1
+
+    if(pread(iFD, rec, 4, lPos) != 4 || memcmp(rec, DATA_MARKER, 4))
+      return -1;
+
+    lPos += 4;
+  }
+
+  pI->lEnd = lPos;
+
+  return bTape ? 0 : -1;
+}
+
+// builds the same index as 'tape_index_build()', but only reads the label records.
+// Every data record is the same size, so the end of a file's data is found with a
+// binary search for the first place that isn't a record, and then checked against the
+// EOF1 (if the data happens to fool the search, the records are counted one at a
+// time).  That's a few reads for each file, rather than reading the whole tape.
+int tape_index_scan(int iFD, TAPE_INDEX *pI)
+{
+  memset(pI, 0, sizeof(*pI));
+
+  return tape_index_scan_from(iFD, pI, 0);
+}
+
+void tape_index_free(TAPE_INDEX *pI)
+{
+  if(pI->pEntries)
+    free(pI->pEntries);
+
+  memset(pI, 0, sizeof(*pI));
+}
+
+// the index entry for the last file with a host file name that matches 'szPattern'
+// (case doesn't matter), before entry 'iBefore'.  Returns -1 if there isn't one.
+int tape_index_find(const TAPE_INDEX *pI, const char *szPattern, int iBefore)
+{
+int i1;
+char tbuf[32];
+
+  for(i1=iBefore - 1; i1 >= 0; i1--)
+  {
+    make_output_file_name(pI->pEntries[i1].szIdentifier, tbuf, sizeof(tbuf));
+
+    if(!fnmatch(szPattern, tbuf, FNM_CASEFOLD))
+      return i1;
+  }
+
+  return -1;
+}
+
+// writes a line for each file that matches 'szPattern' (the same as the directory
+// listing, plus the sequence number and where the data starts)
+int tape_index_stat(const TAPE_INDEX *pI, const char *szPattern, FILE *pOut)
+{
+const TAPE_INDEX_ENTRY *pE;
+int i1, nFound = 0;
+char tbuf[32];
+
+  for(i1=0; i1 < pI->nEntries; i1++)
+  {
+    pE = pI->pEntries + i1;
+
+    make_output_file_name(pE->szIdentifier, tbuf, sizeof(tbuf));
+
+    if(fnmatch(szPattern, tbuf, FNM_CASEFOLD))
+      continue;
+
+    if(!nFound++)
+      fputs("  FILE NAME         CREATE DATE  BLOCKS  TOTAL BYTES   SEQ  DATA POSITION\n"
+            "  ================  ===========  ======  ===========  ====  =============\n", pOut);
+
+    fprintf(pOut, "  %-17.17s  %-9.9s  %6lld  %11lld  %4d  %13lld\n",
+            pE->szIdentifier, rt11_date_string(pE->szDate), pE->nBlocks, pE->nBlocks * 512,
+            pE->iSeq, (long long)pE->lData);
+  }
+
+  if(!nFound)
+    fprintf(pOut, "NO FILES MATCH \"%s\"\n", szPattern);
+
+  return nFound ? 0 : 1;
+}
+
+// copies a file's data (all 'nSections' of it) from the tape to 'iFD', and closes it.  The
+// file is written the same way as 'read_the_tape()' writes it (without trailing zeros,
+// with its date).
+int tape_index_copy(int iTapeFD, const TAPE_INDEX_ENTRY *pE, int nSections, int iFD)
+{
+const TAPE_INDEX_ENTRY *pLast = pE + nSections - 1;
+OUTPUT_FILE out;
+uint8_t *pRead, *pRecord;
+long long lBlock;
+int i1, nRecords, iRval = -1;
+
+  memset(&out, 0, sizeof(out));
+  out.iFD = iFD;
+  out.pBuf = (uint8_t *)malloc(OUTPUT_BUFSIZE);
+
+  pRead = (uint8_t *)malloc(INDEX_READ_RECORDS * 520);
+
+  if(!out.pBuf || !pRead)
+    goto the_exit_point;
+
+  for(; nSections > 0; nSections--, pE++)
+  for(lBlock=0; lBlock < pE->nBlocks; lBlock += nRecords)
+  {
+    nRecords = pE->nBlocks - lBlock > INDEX_READ_RECORDS ? INDEX_READ_RECORDS : (int)(pE->nBlocks - lBlock);
+
+    if(pread(iTapeFD, pRead, nRecords * 520, pE->lData + lBlock * 520) != nRecords * 520)
+    {
+      fprintf(stderr, "ERROR - unable to read \"%-17.17s\" from the tape, errno=%d (%xH)\n",
+              pE->szIdentifier, errno, errno);
+
+      goto the_exit_point;
+    }
+
+    for(i1=0, pRecord=pRead; i1 < nRecords; i1++, pRecord += 520)
+    {
+      if(memcmp(pRecord, TAPE_MARKER, 4) || memcmp(pRecord + 516, TAPE_MARKER, 4))
+      {
+        fprintf(stderr, "ERROR - \"%-17.17s\" has changed on the tape\n", pE->szIdentifier);
+        goto the_exit_point;
+      }
+
+      if(is_zero_block(pRecord + 4, 512))
+        output_file_skip(&out, 512);
+      else if(output_file_write(&out, pRecord + 4, 512))
+        goto the_write_error;
+    }
+  }
+
+  iRval = output_file_close(&out, 1, pLast->szDate);
+
+  if(iRval)
+    goto the_write_error;
+
+  goto the_exit_point;
+
+the_write_error:
+  fprintf(stderr, "ERROR - unable to write \"%-17.17s\", errno=%d (%xH)\n", pLast->szIdentifier, errno, errno);
+
+the_exit_point:
+  if(out.iFD >= 0)
+    close(out.iFD);
+
+  if(out.pBuf)
+    free(out.pBuf);
+
+  if(pRead)
+    free(pRead);
+
+  return iRval;
+}
+
+// the first section of the file that index entry 'iEntry' is part of
+int tape_index_first_section(const TAPE_INDEX *pI, int iEntry)
+{
+  while(iEntry > 0 && pI->pEntries[iEntry - 1].iSeq == pI->pEntries[iEntry].iSeq)
+    iEntry--;
+
+  return iEntry;
+}
+
+// writes a file's data (all 'nSections' of it) to 'iFD', which can be a pipe.  The
+// trailing zeros of the last block are left off, the same as 'output_file_close()'
+// does.  A piece of the tape is read into one buffer and its records are packed
+// together there, so it's one read and one write for each piece.
+int tape_index_stream(int iTapeFD, const TAPE_INDEX_ENTRY *pE, int nSections, int iFD)
+{
+uint8_t *pBuf, *pRecord;
+long long lBlock, nLeft = 0;
+int i1, nRecords, iRval = -1;
+size_t cbOut, cbDone;
+ssize_t cbWrite;
+
+  pBuf = (uint8_t *)malloc(INDEX_STREAM_RECORDS * 520);
+
+  if(!pBuf)
+    return -1;
+
+  for(i1=0; i1 < nSections; i1++)
+    nLeft += pE[i1].nBlocks;
+
+  for(; nSections > 0; nSections--, pE++)
+  {
+    for(lBlock=0; lBlock < pE->nBlocks; lBlock += nRecords)
+    {
+      nRecords = pE->nBlocks - lBlock > INDEX_STREAM_RECORDS ? INDEX_STREAM_RECORDS : (int)(pE->nBlocks - lBlock);
+
+      if(pread(iTapeFD, pBuf, nRecords * 520, pE->lData + lBlock * 520) != nRecords * 520)
+      {
+        fprintf(stderr, "ERROR - unable to read \"%-17.17s\" from the tape, errno=%d (%xH)\n",
+                pE->szIdentifier, errno, errno);
+
+        goto the_exit_point;
+      }
+
+      for(i1=0, pRecord=pBuf; i1 < nRecords; i1++, pRecord += 520)
+      {
+        if(memcmp(pRecord, TAPE_MARKER, 4) || memcmp(pRecord + 516, TAPE_MARKER, 4))
+        {
+          fprintf(stderr, "ERROR - \"%-17.17s\" has changed on the tape\n", pE->szIdentifier);
+          goto the_exit_point;
+        }
+
+        memmove(pBuf + i1 * 512, pRecord + 4, 512);
+      }
+
+      cbOut = (size_t)nRecords * 512;
+      nLeft -= nRecords;
+
+      while(!nLeft && cbOut > (size_t)(nRecords - 1) * 512 && !pBuf[cbOut - 1])
+        cbOut--; // the end of the last block
+
+      for(cbDone=0; cbDone < cbOut; cbDone += cbWrite)
+      {
+        cbWrite = write(iFD, pBuf + cbDone, cbOut - cbDone);
+
+        if(cbWrite < 0 && errno == EINTR)
+        {
+          cbWrite = 0;
+          continue;
+        }
+
+        if(cbWrite <= 0)
+        {
+          fprintf(stderr, "ERROR - unable to write \"%-17.17s\", errno=%d (%xH)\n",
+                  pE->szIdentifier, errno, errno);
+
+          goto the_exit_point;
+        }
+      }
+    }
+  }
+
+  iRval = 0;
+
+the_exit_point:
+  free(pBuf);
+
+  return iRval;
+}
+
+
+// TAPE SERVER
+//
+// 'dectape -Y socket' keeps the index, and the directory listing, for each tape that it's
+// asked about, and answers requests on a local socket.  When $DECTAPE_SOCKET is set to
+// the socket's name, listing a tape, looking up files on it ('-f'), copying some of them
+// out, and appending to it are sent to the server instead, which only has to read the
+// tape again after it has changed (inotify says so on Linux, otherwise the size and time
+// are checked).  If the server isn't running, 'dectape' does the work itself.
+//
+// A request is one line, "COMMAND<tab>tapefile[<tab>argument]", and for 'EXTRACT' it
+// comes with the file descriptor to write to.  The reply is "OK" or "ERROR message" on
+// a line by itself, followed by the output.  There's one request per connection.
+//
+//   LIST     tapefile             the directory listing
+//   STAT     tapefile  pattern    the files that match 'pattern'
+//   NAMES    tapefile  pattern    host file names that match 'pattern', one per line
+//   EXTRACT  tapefile  name       copy the last file named 'name' to the descriptor
+//   APPEND   tapefile  file       add 'file' (the full path) to the end of the tape
+//
+// The tapes are read with 'pread()' rather than mapped, so that a tape file that gets
+// shorter while it's in the cache can't crash the server.
+
+#define SERVER_MAX_TAPES   64
+#define SERVER_MAX_REQUEST (PATH_MAX * 2 + 32)
+
+typedef struct _SERVER_TAPE_
+{
+  char szPath[PATH_MAX];      // empty if not in use
+  int iFD;                    // the tape file, open for reading
+  struct stat st;             // when it was indexed
+  int iWatch;                 // inotify watch descriptor, or -1
+  TAPE_INDEX index;
+  char *pListing;             // the directory listing, exactly as 'dectape tapefile' prints it
+  size_t cbListing;
+  unsigned long dwUsed;       // the most recently used one stays in the cache
+} SERVER_TAPE;
+
+typedef struct _SERVER_
+{
+  SERVER_TAPE aTapes[SERVER_MAX_TAPES];
+  unsigned long dwRequests;
+  int iNotify;
+} SERVER;
+
+static volatile int bServerQuit = 0;
+
+static void server_signal_handler(int iSig)
+{
+  bServerQuit = 1;
+}
+
+static void server_drop_tape(SERVER *pS, SERVER_TAPE *pT)
+{
+  if(!pT->szPath[0])
+    return;
+
+  if(DEBUG_OUTPUT_INFO)
+    fprintf(stderr, "*INFO* - dropping \"%s\" from the cache\n", pT->szPath);
+
+#ifdef __linux__
+  if(pT->iWatch >= 0 && pS->iNotify >= 0)
+    inotify_rm_watch(pS->iNotify, pT->iWatch);
+#endif // __linux__
+
+  close(pT->iFD);
+  tape_index_free(&(pT->index));
+
+  if(pT->pListing)
+    free(pT->pListing);
+
+  memset(pT, 0, sizeof(*pT));
+}
+
+// drops the tapes that inotify says have changed (except for 'pKeep', which the server
+// just changed itself)
+static void server_check_changes(SERVER *pS, const SERVER_TAPE *pKeep)
+{
+#ifdef __linux__
+char evbuf[4096];
+const struct inotify_event *pEv;
+ssize_t cbRead, cb1;
+int i1;
+
+  if(pS->iNotify < 0)
+    return;
+
+  while((cbRead = read(pS->iNotify, evbuf, sizeof(evbuf))) > 0)
+  {
+    for(cb1=0; cb1 < cbRead; cb1 += sizeof(*pEv) + pEv->len)
+    {
+      pEv = (const struct inotify_event *)(evbuf + cb1);
+
+      for(i1=0; i1 < SERVER_MAX_TAPES; i1++)
+      {
+        if(pS->aTapes[i1].szPath[0] && pS->aTapes[i1].iWatch == pEv->wd &&
+           pS->aTapes + i1 != pKeep)
+        {
+          pS->aTapes[i1].iWatch = -1; // it's gone, or is going away
+          server_drop_tape(pS, pS->aTapes + i1);
+        }
+      }
+    }
+  }
+#endif // __linux__
+}
+
+// the directory listing, by running 'read_the_tape()' with stdout going to a temporary file
+static int server_capture_listing(SERVER_TAPE *pT)
+{
+FILE *pTape, *pTemp;
+int iSaved, iRval;
+long cbListing;
+
+  pTape = fdopen(dup(pT->iFD), "r");
+  pTemp = tmpfile();
+
+  if(!pTape || !pTemp)
+  {
+    if(pTape)
+      fclose(pTape);
+
+    if(pTemp)
+      fclose(pTemp);
+
+    return -1;
+  }
+
+  setvbuf(pTape, NULL, _IOFBF, TAPE_BUFSIZE);
+
+  fflush(stdout);
+  iSaved = dup(STDOUT_FILENO);
+  dup2(fileno(pTemp), STDOUT_FILENO);
+
+  iRval = read_the_tape(pTape, pT->szPath, NULL, 1, 0, 0, 0, 0, NULL, 0, NULL, NULL);
+
+  fflush(stdout);
+  dup2(iSaved, STDOUT_FILENO);
+  close(iSaved);
+  fclose(pTape);
+
+  cbListing = lseek(fileno(pTemp), 0, SEEK_END);
+
+  pT->pListing = (char *)malloc(cbListing > 0 ? cbListing : 1);
+
+  if(!iRval && pT->pListing && cbListing >= 0 &&
+     pread(fileno(pTemp), pT->pListing, cbListing, 0) == cbListing)
+  {
+    pT->cbListing = cbListing;
+  }
+  else
+  {
+    iRval = -1;
+  }
+
+  fclose(pTemp);
+
+  return iRval;
+}
+
+// finds (or reads) a tape, making sure that what's in the cache is up to date
+static SERVER_TAPE *server_get_tape(SERVER *pS, const char *szPath)
+{
+SERVER_TAPE *pT = NULL, *pOldest = NULL;
+FILE *pTape;
+struct stat st;
+int i1;
+
+  server_check_changes(pS, NULL);
+
+  if(stat(szPath, &st))
+    return NULL;
+
+  for(i1=0; i1 < SERVER_MAX_TAPES; i1++)
+  {
+    if(!strcmp(pS->aTapes[i1].szPath, szPath))
+    {
+      pT = pS->aTapes + i1;
+      break;
+    }
+
+    if(!pOldest || pS->aTapes[i1].dwUsed < pOldest->dwUsed)
+      pOldest = pS->aTapes + i1;
+  }
+
+  if(pT && (pT->st.st_dev != st.st_dev || pT->st.st_ino != st.st_ino ||
+            pT->st.st_size != st.st_size || pT->st.st_mtime != st.st_mtime))
+  {
+    server_drop_tape(pS, pT); // it changed
+  }
+
+  if(!pT || !pT->szPath[0])
+  {
+    pT = pT ? pT : pOldest;
+
+    server_drop_tape(pS, pT);
+
+    pT->iFD = open(szPath, O_RDONLY | O_CLOEXEC);
+
+    if(pT->iFD < 0)
+      return NULL;
+
+    strncpy(pT->szPath, szPath, sizeof(pT->szPath) - 1);
+    pT->iWatch = -1;
+
+    // the time and size from before it's read, so a change while it's being read
+    // is found the next time
+
+    fstat(pT->iFD, &(pT->st));
+
+#ifdef __linux__
+    if(pS->iNotify >= 0)
+      pT->iWatch = inotify_add_watch(pS->iNotify, szPath, IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |
+                                                          IN_MOVE_SELF | IN_DELETE_SELF);
+#endif // __linux__
+
+    pTape = fdopen(dup(pT->iFD), "r");
+
+    if(!pTape)
+    {
+      server_drop_tape(pS, pT);
+      return NULL;
+    }
+
+    setvbuf(pTape, NULL, _IOFBF, TAPE_BUFSIZE);
+
+    i1 = tape_index_build(pTape, &(pT->index));
+
+    fclose(pTape);
+
+    if(i1 || server_capture_listing(pT))
+    {
+      server_drop_tape(pS, pT);
+      return NULL;
+    }
+
+    if(DEBUG_OUTPUT_INFO)
+      fprintf(stderr, "*INFO* - \"%s\" indexed, %d files\n", szPath, pT->index.nEntries);
+  }
+
+  pT->dwUsed = ++(pS->dwRequests);
+
+  return pT;
+}
+
+static int server_reply(int iClient, const char *pData, size_t cbData)
+{
+ssize_t cb1;
+
+  while(cbData > 0)
+  {
+    cb1 = write(iClient, pData, cbData);
+
+    if(cb1 < 0 && errno == EINTR)
+      continue;
+
+    if(cb1 <= 0)
+      return -1;
+
+    pData += cb1;
+    cbData -= cb1;
+  }
+
+  return 0;
+}
+
+static void server_error(int iClient, const char *szMessage, const char *szArg)
+{
+char tbuf[PATH_MAX + 256];
+
+  snprintf(tbuf, sizeof(tbuf), "ERROR %s \"%s\"\n", szMessage, szArg);
+  server_reply(iClient, tbuf, strlen(tbuf));
+}
+
+// reads a request, and the file descriptor that comes with it (if there is one)
+static int server_read_request(int iClient, char *pBuf, int cbBuf, int *piFD)
+{
+struct msghdr msg;
+struct iovec iov;
+struct cmsghdr *pCmsg;
+union
+{
+  char buf[CMSG_SPACE(sizeof(int))];
+  struct cmsghdr align;
+} ctl;
+ssize_t cb1;
+int cbRead = 0;
+
+  *piFD = -1;
+
+  while(cbRead < cbBuf - 1 && !memchr(pBuf, '\n', cbRead))
+  {
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = pBuf + cbRead;
+    iov.iov_len = cbBuf - 1 - cbRead;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+
+    cb1 = recvmsg(iClient, &msg, 0);
+
+    if(cb1 < 0 && errno == EINTR)
+      continue;
+
+    if(cb1 <= 0)
+      return -1;
+
+    for(pCmsg=CMSG_FIRSTHDR(&msg); pCmsg; pCmsg=CMSG_NXTHDR(&msg, pCmsg))
+    {
+      if(pCmsg->cmsg_level == SOL_SOCKET && pCmsg->cmsg_type == SCM_RIGHTS && *piFD < 0)
+        memcpy(piFD, CMSG_DATA(pCmsg), sizeof(int));
+    }
+
+    cbRead += cb1;
+  }
+
+  pBuf[cbRead] = 0;
+
+  return memchr(pBuf, '\n', cbRead) ? 0 : -1;
+}
+
+static void server_handle_client(SERVER *pS, int iClient)
+{
+SERVER_TAPE *pT;
+FILE *pTape, *pOut;
+char *pCommand, *pTapeName, *pArg, *pText = NULL;
+size_t cbText = 0;
+int i1, iFD = -1, iSeq;
+char tbuf[SERVER_MAX_REQUEST], szName[32];
+
+  if(server_read_request(iClient, tbuf, sizeof(tbuf), &iFD))
+    goto the_exit_point;
+
+  *strchr(tbuf, '\n') = 0;
+
+  pCommand = tbuf;
+  pTapeName = strchr(pCommand, '\t');
+
+  if(!pTapeName)
+  {
+    server_error(iClient, "bad request", tbuf);
+    goto the_exit_point;
+  }
+
+  *(pTapeName++) = 0;
+
+  pArg = strchr(pTapeName, '\t');
+
+  if(pArg)
+    *(pArg++) = 0;
+
+  if(DEBUG_OUTPUT_INFO)
+    fprintf(stderr, "*INFO* - %s \"%s\" \"%s\"\n", pCommand, pTapeName, pArg ? pArg : "");
+
+  pT = server_get_tape(pS, pTapeName);
+
+  if(!pT)
+  {
+    server_error(iClient, "not a valid tape", pTapeName);
+    goto the_exit_point;
+  }
+
+  if(strcmp(pCommand, "LIST") && !pArg)
+  {
+    server_error(iClient, "bad request", pCommand);
+    goto the_exit_point;
+  }
+
+  if(!strcmp(pCommand, "LIST"))
+  {
+    if(!pT->pListing && server_capture_listing(pT)) // it was appended to
+    {
+      server_error(iClient, "unable to list", pTapeName);
+      server_drop_tape(pS, pT);
+      goto the_exit_point;
+    }
+
+    server_reply(iClient, "OK\n", 3);
+    server_reply(iClient, pT->pListing, pT->cbListing);
+  }
+  else if(!strcmp(pCommand, "STAT") || !strcmp(pCommand, "NAMES"))
+  {
+    pOut = open_memstream(&pText, &cbText);
+
+    if(!pOut)
+    {
+      server_error(iClient, "out of memory for", pCommand);
+      goto the_exit_point;
+    }
+
+    if(!strcmp(pCommand, "STAT"))
+    {
+      tape_index_stat(&(pT->index), pArg, pOut);
+    }
+    else
+    {
+      for(i1=pT->index.nEntries; (i1 = tape_index_find(&(pT->index), pArg, i1)) >= 0; )
+      {
+        make_output_file_name(pT->index.pEntries[i1].szIdentifier, szName, sizeof(szName));
+
+        if(tape_index_find(&(pT->index), szName, pT->index.nEntries) == i1) // the last one
+          fprintf(pOut, "%s\n", szName);
+      }
+    }
+
+    fclose(pOut);
+
+    server_reply(iClient, "OK\n", 3);
+    server_reply(iClient, pText, cbText);
+  }
+  else if(!strcmp(pCommand, "FIND"))
+  {
+    i1 = tape_index_find(&(pT->index), pArg, pT->index.nEntries);
+
+    if(i1 < 0)
+    {
+      server_error(iClient, "file not found", pArg);
+      goto the_exit_point;
+    }
+
+    pOut = open_memstream(&pText, &cbText);
+
+    if(!pOut)
+    {
+      server_error(iClient, "out of memory for", pCommand);
+      goto the_exit_point;
+    }
+
+    for(iSeq=tape_index_first_section(&(pT->index), i1); iSeq <= i1; iSeq++)
+    {
+      fprintf(pOut, "%lld %lld\n", (long long)pT->index.pEntries[iSeq].lData,
+              pT->index.pEntries[iSeq].nBlocks);
+    }
+
+    fclose(pOut);
+
+    server_reply(iClient, "OK\n", 3);
+    server_reply(iClient, pText, cbText);
+  }
+  else if(!strcmp(pCommand, "EXTRACT"))
+  {
+    i1 = tape_index_find(&(pT->index), pArg, pT->index.nEntries);
+
+    if(i1 < 0 || iFD < 0)
+    {
+      server_error(iClient, iFD < 0 ? "no file descriptor for" : "file not found", pArg);
+      goto the_exit_point;
+    }
+
+    // every section of it, not just the last one
+
+    iSeq = tape_index_first_section(&(pT->index), i1);
+    i1 = tape_index_copy(pT->iFD, pT->index.pEntries + iSeq, i1 - iSeq + 1, iFD);
+    iFD = -1; // it was closed
+
+    if(i1)
+      server_error(iClient, "unable to copy", pArg);
+    else
+      server_reply(iClient, "OK\n", 3);
+  }
+  else if(!strcmp(pCommand, "APPEND"))
+  {
+    // the new file goes where the end of tape marker is
+
+    pTape = fopen(pTapeName, "r+");
+    iSeq = pT->index.iLastSeq;
+
+    i1 = !pTape || fseeko(pTape, pT->index.lEnd, SEEK_SET) ||
+         write_single_file_to_tape(pTape, pArg, &iSeq, 0, NULL, 0, NULL, NULL);
+
+    if(pTape && fclose(pTape))
+      i1 = 1;
+
+    // only the new file has to be added to the index (rather than reading the whole tape
+    // again for every file in a directory), and the listing is captured again the next
+    // time it's asked for
+
+    if(!i1)
+    {
+      server_check_changes(pS, pT);
+
+      i1 = tape_index_scan_from(pT->iFD, &(pT->index), pT->index.lEnd) ||
+           fstat(pT->iFD, &(pT->st));
+    }
+
+    if(i1)
+    {
+      server_drop_tape(pS, pT); // it's different now
+    }
+    else if(pT->pListing)
+    {
+      free(pT->pListing);
+      pT->pListing = NULL;
+      pT->cbListing = 0;
+    }
+
+    if(i1)
+      server_error(iClient, "unable to append", pArg);
+    else
+      server_reply(iClient, "OK\n", 3);
+  }
+  else
+  {
+    server_error(iClient, "unknown request", pCommand);
+  }
+
+the_exit_point:
+  if(iFD >= 0)
+    close(iFD);
+
+  if(pText)
+    free(pText);
+}
+
+// runs the tape server until CTRL+C (or SIGTERM)
+int serve_tapes(const char *szSocket)
+{
+SERVER *pS;
+struct sockaddr_un addr;
+struct pollfd afd[2];
+struct stat st;
+int iListen, iClient, iRval = -1;
+
+  if(strlen(szSocket) >= sizeof(addr.sun_path))
+  {
+    fprintf(stderr, "ERROR - socket name \"%s\" is too long\n", szSocket);
+    return -1;
+  }
+
+  pS = (SERVER *)calloc(1, sizeof(*pS));
+
+  if(!pS)
+    return -1;
+
+  pS->iNotify = -1;
+
+  if(!lstat(szSocket, &st) && S_ISSOCK(st.st_mode)) // left over from before
+    unlink(szSocket);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, szSocket);
+
+  iListen = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  if(iListen < 0 || bind(iListen, (struct sockaddr *)&addr, sizeof(addr)) ||
+     chmod(szSocket, 0600) || listen(iListen, 16))
+  {
+    fprintf(stderr, "ERROR - unable to listen on \"%s\", errno=%d (%xH)\n", szSocket, errno, errno);
+    goto the_exit_point;
+  }
+
+#ifdef __linux__
+  pS->iNotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif // __linux__
+
+  signal(SIGINT, server_signal_handler);
+  signal(SIGTERM, server_signal_handler);
+  signal(SIGPIPE, SIG_IGN); // a client that goes away is not fatal
+
+  fprintf(stderr, "Serving tapes on \"%s\" - press CTRL+C to stop\n", szSocket);
+
+  afd[0].fd = iListen;
+  afd[0].events = POLLIN;
+  afd[1].fd = pS->iNotify;
+  afd[1].events = POLLIN;
+
+  while(!bServerQuit)
+  {
+    if(poll(afd, pS->iNotify >= 0 ? 2 : 1, -1) <= 0)
+      continue;
+
+    if(pS->iNotify >= 0 && afd[1].revents)
+      server_check_changes(pS, NULL);
+
+    if(!afd[0].revents)
+      continue;
+
+    iClient = accept(iListen, NULL, NULL);
+
+    if(iClient >= 0)
+    {
+      server_handle_client(pS, iClient);
+      close(iClient);
+    }
+  }
+
+  iRval = 0;
+
+the_exit_point:
+  for(iClient=0; iClient < SERVER_MAX_TAPES; iClient++)
+    server_drop_tape(pS, pS->aTapes + iClient);
+
+  if(iListen >= 0)
+  {
+    close(iListen);
+    unlink(szSocket);
+  }
+
+  if(pS->iNotify >= 0)
+    close(pS->iNotify);
+
+  free(pS);
+
+  return iRval;
+}
+
+// sends a request to the server named by $DECTAPE_SOCKET, and copies the output to 'pOut'.
+// Returns 1 if there's no server (so the caller does it instead), -1 on error.
+int server_request(const char *szCommand, const char *szTape, const char *szArg, int iFD, FILE *pOut)
+{
+const char *szSocket = getenv("DECTAPE_SOCKET");
+struct sockaddr_un addr;
+struct msghdr msg;
+struct iovec iov;
+struct cmsghdr *pCmsg;
+union
+{
+  char buf[CMSG_SPACE(sizeof(int))];
+  struct cmsghdr align;
+} ctl;
+int iSocket, iRval = -1, cbReq;
+ssize_t cb1;
+char *p1;
+char szPath[PATH_MAX], tbuf[SERVER_MAX_REQUEST];
+
+  if(!szSocket || !*szSocket || strlen(szSocket) >= sizeof(addr.sun_path) ||
+     !realpath(szTape, szPath)) // the server needs the full path
+  {
+    return 1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, szSocket);
+
+  iSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  if(iSocket < 0)
+    return 1;
+
+  if(connect(iSocket, (struct sockaddr *)&addr, sizeof(addr)))
+  {
+    close(iSocket);
+    return 1; // not running
+  }
+
+  cbReq = snprintf(tbuf, sizeof(tbuf), "%s\t%s%s%s\n", szCommand, szPath, szArg ? "\t" : "", szArg ? szArg : "");
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = tbuf;
+  iov.iov_len = cbReq;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  if(iFD >= 0) // pass the file descriptor along with the request
+  {
+    memset(&ctl, 0, sizeof(ctl));
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+
+    pCmsg = CMSG_FIRSTHDR(&msg);
+    pCmsg->cmsg_level = SOL_SOCKET;
+    pCmsg->cmsg_type = SCM_RIGHTS;
+    pCmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(pCmsg), &iFD, sizeof(int));
+  }
+
+  if(cbReq >= (int)sizeof(tbuf) || sendmsg(iSocket, &msg, 0) != cbReq)
+  {
+    fprintf(stderr, "ERROR - unable to send request to \"%s\", errno=%d (%xH)\n", szSocket, errno, errno);
+    goto the_exit_point;
+  }
+
+  // the status line, then the output
+
+  for(cbReq=0; cbReq < (int)sizeof(tbuf) - 1; cbReq++)
+  {
+    if(read(iSocket, tbuf + cbReq, 1) != 1 || tbuf[cbReq] == '\n')
+      break;
+  }
+
+  tbuf[cbReq] = 0;
+
+  if(strcmp(tbuf, "OK"))
+  {
+    p1 = strncmp(tbuf, "ERROR ", 6) ? tbuf : tbuf + 6;
+    fprintf(stderr, "ERROR - tape server: %s\n", *p1 ? p1 : "no reply");
+    goto the_exit_point;
+  }
+
+  while((cb1 = read(iSocket, tbuf, sizeof(tbuf))) > 0)
+  {
+    if(pOut && fwrite(tbuf, cb1, 1, pOut) != 1)
+      goto the_exit_point;
+  }
+
+  iRval = cb1 < 0 ? -1 : 0;
+
+the_exit_point:
+  close(iSocket);
+
+  return iRval;
+}
+
+// lists the files on a tape that match 'szPattern' (using the server if it's running)
+int stat_tape_files(const char *szTapeFile, const char *szPattern)
+{
+TAPE_INDEX ti;
+FILE *pTape;
+int iRval;
+
+  iRval = server_request("STAT", szTapeFile, szPattern, -1, stdout);
+
+  if(iRval <= 0)
+    return iRval;
+
+  pTape = fopen(szTapeFile, "r");
+
+  if(!pTape)
+  {
+    fprintf(stderr, "Unable to open tape file \"%s\"\n", szTapeFile);
+    return -1;
+  }
+
+  setvbuf(pTape, NULL, _IOFBF, TAPE_BUFSIZE);
+
+  if(tape_index_build(pTape, &ti))
+  {
+    fprintf(stderr, "ERROR - \"%s\" is not a valid tape\n", szTapeFile);
+    iRval = -1;
+  }
+  else
+  {
+    iRval = tape_index_stat(&ti, szPattern, stdout);
+  }
+
+  tape_index_free(&ti);
+  fclose(pTape);
+
+  return iRval;
+}
+
+// writes the (last) file on a tape that matches 'szName' to stdout.  If the tape server
+// is running, it has the index already.  Otherwise, the tape is scanned for it.
+int cat_tape_file(const char *szTapeFile, const char *szName)
+{
+TAPE_INDEX ti;
+FILE *pOut;
+char *pText = NULL, *p1;
+size_t cbText = 0;
+long long lData, nBlocks;
+int i1, iFD, nSections = 0, iRval = -1;
+
+  memset(&ti, 0, sizeof(ti));
+
+  iFD = open(szTapeFile, O_RDONLY);
+
+  if(iFD < 0)
+  {
+    fprintf(stderr, "Unable to open tape file \"%s\"\n", szTapeFile);
+    return -1;
+  }
+
+  // the server's answer is the data position and the number of blocks, for each section
+
+  pOut = open_memstream(&pText, &cbText);
+  i1 = pOut ? server_request("FIND", szTapeFile, szName, -1, pOut) : 1;
+
+  if(pOut)
+    fclose(pOut);
+
+  if(i1 < 0)
+    goto the_exit_point;
+
+  if(!i1)
+  {
+    for(p1=pText; p1 && sscanf(p1, "%lld %lld", &lData, &nBlocks) == 2; p1 = strchr(p1 + 1, '\n'), nSections++)
+    {
+      if(nSections >= ti.nMaxEntries)
+      {
+        ti.nMaxEntries += 8;
+        ti.pEntries = (TAPE_INDEX_ENTRY *)realloc(ti.pEntries, sizeof(*ti.pEntries) * ti.nMaxEntries);
+
+        if(!ti.pEntries)
+          goto the_exit_point;
+      }
+
+      memset(ti.pEntries + nSections, 0, sizeof(*ti.pEntries));
+      snprintf(ti.pEntries[nSections].szIdentifier, sizeof(ti.pEntries->szIdentifier), "%s", szName);
+      ti.pEntries[nSections].lData = lData;
+      ti.pEntries[nSections].nBlocks = nBlocks;
+    }
+
+    ti.nEntries = nSections;
+    i1 = 0;
+  }
+  else
+  {
+    if(tape_index_scan(iFD, &ti))
+    {
+      fprintf(stderr, "ERROR - \"%s\" is not a valid tape\n", szTapeFile);
+      goto the_exit_point;
+    }
+
+    i1 = tape_index_find(&ti, szName, ti.nEntries);
+
+    if(i1 < 0)
+    {
+      fprintf(stderr, "NO FILES MATCH \"%s\"\n", szName);
+      goto the_exit_point;
+    }
+
+    nSections = i1 + 1;
+    i1 = tape_index_first_section(&ti, i1);
+    nSections -= i1;
+  }
+
+  if(nSections > 0)
+    iRval = tape_index_stream(iFD, ti.pEntries + i1, nSections, STDOUT_FILENO);
+
+the_exit_point:
+  close(iFD);
+
+  if(pText)
+    free(pText);
+
+  tape_index_free(&ti);
+
+  return iRval;
+}
+
+// appends the files in a directory to a tape, through the server.  Returns 1 if the
+// server isn't running (and nothing was done).
+int append_files_to_server(const char *szDir, const char *szTapeFile)
+{
+void *pD;
+unsigned long dwMode;
+int cbDir, iRval = 0, bFirst = 1;
+char tbuf[PATH_MAX * 2], szPath[PATH_MAX];
+
+  if(!getenv("DECTAPE_SOCKET"))
+    return 1;
+
+  // the same files that 'write_the_tape()' would write, in the same order
+
+  cbDir = snprintf(tbuf, sizeof(tbuf), "%s%s*.*", szDir, szDir[strlen(szDir) - 1] == '/' ? "" : "/");
+
+  pD = WBAllocDirectoryList(tbuf);
+
+  if(!pD)
+  {
+    fprintf(stderr, "ERROR - unable to get directory list for \"%s\", errno=%d (%xH)\n",
+            tbuf, errno, errno);
+
+    return -1;
+  }
+
+  cbDir -= 3; // without the '*.*'
+
+  while(!WBNextDirectoryEntry(pD, tbuf + cbDir, sizeof(tbuf) - cbDir - 1, &dwMode))
+  {
+    if(S_ISDIR(dwMode) || S_ISFIFO(dwMode) || S_ISSOCK(dwMode) || S_ISLNK(dwMode))
+      continue;
+
+    if(!realpath(tbuf, szPath))
+    {
+      fprintf(stderr, "ERROR - unable to find \"%s\", errno=%d (%xH)\n", tbuf, errno, errno);
+      iRval = -1;
+      break;
+    }
+
+    iRval = server_request("APPEND", szTapeFile, szPath, -1, NULL);
+
+    if(iRval > 0 && !bFirst) // the server went away
+      fprintf(stderr, "ERROR - tape server stopped before \"%s\" was appended\n", tbuf);
+
+    if(iRval)
+      break;
+
+    bFirst = 0;
+  }
+
+  WBDestroyDirectoryList(pD);
+
+  return iRval > 0 && !bFirst ? -1 : iRval;
+}
+
+// copies the files that match 'szPattern' from a tape to a directory (using the server
+// if it's running).  When a name is on the tape more than once, the last one is copied.
+int extract_matching_files(const char *szTapeFile, const char *szPattern, const char *szOutDir,
+                           int bOverwrite, int bConfirm)
+{
+TAPE_INDEX ti;
+FILE *pTape = NULL, *pNames;
+char *pNames0 = NULL, *p1, *p2;
+size_t cbNames = 0;
+int i1, i2, iOutDir, iFD, iRval = -1, bServer, nFiles = 0;
+char szName[32], szOutName[32];
+
+  memset(&ti, 0, sizeof(ti));
+
+  iOutDir = open(szOutDir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  if(iOutDir < 0)
+  {
+    fprintf(stderr, "Unable to open directory \"%s\" - errno=%d (%xH)\n", szOutDir, errno, errno);
     return -1;
   }
 
-  // STEP 1:  does the file exist??
+  // get the list of names from the server, or read the tape
+
+  pNames = open_memstream(&pNames0, &cbNames);
+
+  if(!pNames)
+    goto the_exit_point;
+
+  i1 = server_request("NAMES", szTapeFile, szPattern, -1, pNames);
+
+  fclose(pNames);
+
+  if(i1 < 0)
+    goto the_exit_point;
+
+  bServer = !i1;
+
+  if(!bServer)
+  {
+    pTape = fopen(szTapeFile, "r");
+
+    if(!pTape)
+    {
+      fprintf(stderr, "Unable to open tape file \"%s\"\n", szTapeFile);
+      goto the_exit_point;
+    }
+
+    setvbuf(pTape, NULL, _IOFBF, TAPE_BUFSIZE);
+
+    if(tape_index_build(pTape, &ti))
+    {
+      fprintf(stderr, "ERROR - \"%s\" is not a valid tape\n", szTapeFile);
+      goto the_exit_point;
+    }
+  }
+
+  iRval = 0;
+
+  for(p1=pNames0, i1=ti.nEntries; ; )
+  {
+    if(bServer) // one name per line
+    {
+      if(!p1 || !*p1)
+        break;
+
+      p2 = strchr(p1, '\n');
+
+      if(p2)
+        *(p2++) = 0;
+
+      strncpy(szName, p1, sizeof(szName) - 1);
+      szName[sizeof(szName) - 1] = 0;
+      p1 = p2;
+    }
+    else
+    {
+      i1 = tape_index_find(&ti, szPattern, i1);
+
+      if(i1 < 0)
+        break;
+
+      make_output_file_name(ti.pEntries[i1].szIdentifier, szName, sizeof(szName));
+
+      if(tape_index_find(&ti, szName, ti.nEntries) != i1)
+        continue; // not the last one with this name
+    }
+
+    iFD = do_open_output_file(iOutDir, szOutDir, szName, bOverwrite, bConfirm, szOutName, sizeof(szOutName));
+
+    if(iFD < 0)
+    {
+      fprintf(stderr, "Unable to open \"%s/%s\" - errno=%d (%xH)\n", szOutDir, szName, errno, errno);
+      iRval = -1;
+      continue;
+    }
+
+    if(bServer)
+    {
+      i2 = server_request("EXTRACT", szTapeFile, szName, iFD, NULL);
+      close(iFD);
+    }
+    else
+    {
+      i2 = tape_index_first_section(&ti, i1);
+      i2 = tape_index_copy(fileno(pTape), ti.pEntries + i2, i1 - i2 + 1, iFD);
+    }
+
+    if(i2)
+      iRval = -1;
+    else
+      nFiles++;
+
+    if(iVerbosity > 0)
+      fprintf(stderr, "  %s\n", szOutName);
+  }
+
+  if(!nFiles && !iRval)
+    fprintf(stderr, "NO FILES MATCH \"%s\"\n", szPattern);
+
+the_exit_point:
+  if(pTape)
+    fclose(pTape);
+
+  if(pNames0)
+    free(pNames0);
+
+  tape_index_free(&ti);
+  close(iOutDir);
+
+  return iRval;
+}
+
+
+// TAPE MERGE AND SPLIT
+//
+// Tapes are put together (or taken apart) by copying each file's records from one tape
+// file straight into the other.  A record doesn't depend on where it is on the tape, so the only
+// thing that has to change is the sequence number in each HDR1 and EOF1.  On Linux
+// the copying is done by 'copy_file_range()', so the data doesn't pass through this
+// program at all (and a file system that can share blocks between files may do so).
+
+#define MERGE_BUFSIZE (1024 * 1024) /* for copying without 'copy_file_range()' */
+
+// copies 'cbCopy' bytes at 'lIn' in 'iInFD' to 'lOut' in 'iOutFD'
+int merge_copy_range(int iInFD, off_t lIn, int iOutFD, off_t lOut, off_t cbCopy)
+{
+ssize_t cb1;
+uint8_t *pBuf = NULL;
+int iRval = -1;
+#ifdef __linux__
+loff_t lInPos = lIn, lOutPos = lOut;
+
+  while(cbCopy > 0)
+  {
+    cb1 = copy_file_range(iInFD, &lInPos, iOutFD, &lOutPos, cbCopy, 0);
+
+    if(cb1 <= 0) // not supported here (or across file systems), so do the rest below
+      break;
+
+    cbCopy -= cb1;
+  }
+
+  lIn = lInPos;
+  lOut = lOutPos;
+#endif // __linux__
 
-  if(FileExists(szFileName))
+  if(cbCopy > 0)
   {
-    if(!bOverwrite && !QueryYesNo("Overwrite existing file"))
-      return 1; // you said 'no'
+    pBuf = (uint8_t *)malloc(MERGE_BUFSIZE);
 
-    // make sure file is zero bytes long
+    if(!pBuf)
+      goto the_exit_point;
 
-    if(truncate(szFileName, 0)) // zero bytes long
+    while(cbCopy > 0)
     {
-      fprintf(stderr, "Unable to write (truncate) to \"%s\", errno=%d (%xH)\n",
-              szFileName, errno, errno);
+      cb1 = cbCopy > MERGE_BUFSIZE ? MERGE_BUFSIZE : (ssize_t)cbCopy;
 
-      return -1;
+      if(pread(iInFD, pBuf, cb1, lIn) != cb1 ||
+         pwrite(iOutFD, pBuf, cb1, lOut) != cb1)
+      {
+        goto the_exit_point;
+      }
+
+      lIn += cb1;
+      lOut += cb1;
+      cbCopy -= cb1;
     }
   }
 
-  pTape = fopen(szFileName, "w");
-  if(!pTape)
+  iRval = 0;
+
+the_exit_point:
+  if(pBuf)
+    free(pBuf);
+
+  return iRval;
+}
+
+// reads the HDR1 or EOF1 record at 'lPos', and writes it at 'lOut' with sequence number 'iSeq'
+static int merge_label_record(int iInFD, off_t lPos, const char *szLabel, int iOutFD, off_t lOut, int iSeq)
+{
+uint8_t rec[520];
+RT11_FILE_HEADER *pFile = (RT11_FILE_HEADER *)(rec + 4);
+char tbuf[16];
+
+  if(pread(iInFD, rec, sizeof(rec), lPos) != sizeof(rec) ||
+     memcmp(rec, TAPE_MARKER, 4) || memcmp(rec + 516, TAPE_MARKER, 4) ||
+     memcmp(pFile->label_identifier, szLabel, 3))
   {
-    fprintf(stderr, "Unable to open \"%s\", errno=%d (%xH)\n",
-            szFileName, errno, errno);
+    return 1;
+  }
 
+  snprintf(tbuf, sizeof(tbuf), "%04d", iSeq);
+  memcpy(pFile->file_sequence_number, tbuf, sizeof(pFile->file_sequence_number));
+
+  return pwrite(iOutFD, rec, sizeof(rec), lOut) == sizeof(rec) ? 0 : -1;
+}
+
+// copies a file (HDR1, data marker, data, data marker, EOF1, data marker) to 'lOut' in
+// 'iOutFD', as file number 'iSeq'.  Returns the number of bytes written, or -1.
+static off_t merge_copy_file(int iInFD, const TAPE_INDEX_ENTRY *pE, int iOutFD, off_t lOut, int iSeq)
+{
+off_t lHeader = pE->lData - 524, lEOF = pE->lData + pE->nBlocks * 520 + 4;
+int i1;
+
+  i1 = merge_label_record(iInFD, lHeader, "HDR", iOutFD, lOut, iSeq);
+
+  if(!i1 && merge_copy_range(iInFD, lHeader + 520, iOutFD, lOut + 520, lEOF - (lHeader + 520)))
+    i1 = -1;
+
+  if(!i1)
+    i1 = merge_label_record(iInFD, lEOF, "EOF", iOutFD, lOut + (lEOF - lHeader), iSeq);
+
+  if(!i1 && pwrite(iOutFD, DATA_MARKER, 4, lOut + (lEOF - lHeader) + 520) != 4)
+    i1 = -1;
+
+  if(i1 > 0)
+    fprintf(stderr, "ERROR - \"%-17.17s\" has changed on the tape\n", pE->szIdentifier);
+  else if(i1 < 0)
+    fprintf(stderr, "ERROR - unable to copy \"%-17.17s\", errno=%d (%xH)\n", pE->szIdentifier, errno, errno);
+
+  return i1 ? -1 : lEOF + 520 + 4 - lHeader;
+}
+
+// writes the end of tape marker at 'lOut', and sets the size of the tape (the rest of it
+// is a hole).  Returns the size, or -1.
+off_t merge_end_tape(int iOutFD, const char *szOutput, off_t lOut, int iDriveSize, int cbHeadroom)
+{
+off_t lSize = lOut + 4 + TAPE_TAIL_BYTES + cbHeadroom;
+
+  if(lSize < (off_t)1024 * 1024 * iDriveSize)
+    lSize = (off_t)1024 * 1024 * iDriveSize;
+
+  if(pwrite(iOutFD, DATA_MARKER, 4, lOut) != 4 || ftruncate(iOutFD, lSize))
+  {
+    fprintf(stderr, "ERROR - unable to write \"%s\", errno=%d (%xH)\n", szOutput, errno, errno);
     return -1;
   }
 
-  iRval = do_initialize_tape(pTape, szFileName, iDriveSize, pLabel);
+  return lSize;
+}
 
-  fclose(pTape);
+// writes 'szOutput' with all of the files on 'pTapes', in order.  The volume header
+// (and boot block) come from the first tape, and the files are numbered from 1.
+int merge_tapes(const char *szOutput, char * const *pTapes, int nTapes, int iDriveSize,
+                const char *szLabel, int cbHeadroom)
+{
+FILE *pTape = NULL, *pOut = NULL;
+TAPE_INDEX ti;
+struct stat st, stOut;
+int i1, i2, iOutFD = -1, nSeq = 0, nFiles = 0, iRval = -1;
+off_t lOut = 0, lSize, cb1;
+uint8_t rec[520];
+
+  memset(&ti, 0, sizeof(ti));
+
+  // the new tape is truncated when it's opened, so it can't be one of the others
+
+  for(i1=0; !stat(szOutput, &stOut) && i1 < nTapes; i1++)
+  {
+    if(!stat(pTapes[i1], &st) && st.st_dev == stOut.st_dev && st.st_ino == stOut.st_ino)
+    {
+      fprintf(stderr, "ERROR - \"%s\" can not be merged into itself\n", pTapes[i1]);
+      return -1;
+    }
+  }
+
+  pOut = fopen(szOutput, "w+");
+
+  if(!pOut)
+  {
+    fprintf(stderr, "Unable to open tape file \"%s\", errno=%d (%xH)\n", szOutput, errno, errno);
+    return -1;
+  }
+
+  iOutFD = fileno(pOut);
+
+  for(i1=0; i1 < nTapes; i1++)
+  {
+    pTape = fopen(pTapes[i1], "r");
+
+    if(!pTape)
+    {
+      fprintf(stderr, "Unable to open tape file \"%s\", errno=%d (%xH)\n", pTapes[i1], errno, errno);
+      goto the_exit_point;
+    }
+
+    if(tape_index_scan(fileno(pTape), &ti))
+    {
+      fprintf(stderr, "ERROR - \"%s\" is not a tape file, or it's damaged\n", pTapes[i1]);
+      goto the_exit_point;
+    }
+
+    if(!i1) // the volume header, and the boot block if there is one
+    {
+      for(cb1=0; cb1 < 1040; cb1 += 520)
+      {
+        if(pread(fileno(pTape), rec, sizeof(rec), cb1) != sizeof(rec) ||
+           memcmp(rec, TAPE_MARKER, 4) || !memcmp(rec + 4, "HDR1", 4) ||
+           (!cb1 && memcmp(rec + 4, "VOL", 3)))
+        {
+          break;
+        }
+      }
+
+      if(!cb1) // there isn't one, so make one
+      {
+        if(do_initialize_tape(pOut, szOutput, 0, szLabel) || fflush(pOut))
+          goto the_exit_point;
+
+        cb1 = 520;
+      }
+      else if(merge_copy_range(fileno(pTape), 0, iOutFD, 0, cb1))
+      {
+        fprintf(stderr, "ERROR - unable to write \"%s\", errno=%d (%xH)\n", szOutput, errno, errno);
+        goto the_exit_point;
+      }
+
+      lOut = cb1;
+    }
+
+    for(i2=0; i2 < ti.nEntries; i2++)
+    {
+      cb1 = merge_copy_file(fileno(pTape), ti.pEntries + i2, iOutFD, lOut, nSeq + ti.pEntries[i2].iSeq);
+
+      if(cb1 < 0)
+        goto the_exit_point;
+
+      lOut += cb1;
+    }
+
+    if(DEBUG_OUTPUT_INFO)
+      fprintf(stderr, "*INFO* - \"%s\" %d files, sequence numbers %d to %d\n",
+              pTapes[i1], ti.nEntries, nSeq + 1, nSeq + ti.iLastSeq);
+
+    nSeq += ti.iLastSeq;
+    nFiles += ti.nEntries;
+
+    tape_index_free(&ti);
+    fclose(pTape);
+    pTape = NULL;
+  }
+
+  lSize = merge_end_tape(iOutFD, szOutput, lOut, iDriveSize, cbHeadroom);
+
+  if(lSize < 0)
+    goto the_exit_point;
+
+  printf("\"%s\" %d files from %d tapes, %lld bytes\n", szOutput, nFiles, nTapes, (long long)lSize);
+
+  iRval = 0;
+
+the_exit_point:
+  if(pTape)
+    fclose(pTape);
+
+  tape_index_free(&ti);
+
+  if(pOut)
+    fclose(pOut);
+
+  if(iRval)
+    unlink(szOutput); // don't leave half of a tape
 
   return iRval;
 }
 
-static const short aDays[13]=
+// non-zero if 'szSelect' picks the file 'pE'.  'szSelect' is a list of sequence numbers,
+// ranges of them ('3-7', or '10-' for 10 to the end), and file name patterns, with
+// commas between them, i.e. '1-4,*.MAC'.
+static int split_is_selected(const char *szSelect, const TAPE_INDEX_ENTRY *pE)
 {
-  1,
-  1 + 31,
-  1 + 31 + 28,
-  1 + 31 + 28 + 31,
-  1 + 31 + 28 + 31 + 30,
-  1 + 31 + 28 + 31 + 30 + 31,
-  1 + 31 + 28 + 31 + 30 + 31 + 30,
-  1 + 31 + 28 + 31 + 30 + 31 + 30 + 31,
-  1 + 31 + 28 + 31 + 30 + 31 + 30 + 31 + 31,
-  1 + 31 + 28 + 31 + 30 + 31 + 30 + 31 + 31 + 30,
-  1 + 31 + 28 + 31 + 30 + 31 + 30 + 31 + 31 + 30 + 31,
-  1 + 31 + 28 + 31 + 30 + 31 + 30 + 31 + 31 + 30 + 31 + 30,
-  1 + 31 + 28 + 31 + 30 + 31 + 30 + 31 + 31 + 30 + 31 + 30 + 31
-};
-static const short aDaysLeap[13]=
+const char *p1, *p2;
+char *pEnd, tbuf[32], szItem[256];
+long lFirst, lLast;
+
+  make_output_file_name(pE->szIdentifier, tbuf, sizeof(tbuf));
+
+  for(p1=szSelect; *p1; p1 = *p2 ? p2 + 1 : p2)
+  {
+    p2 = strchr(p1, ',');
+
+    if(!p2)
+      p2 = p1 + strlen(p1);
+
+    snprintf(szItem, sizeof(szItem), "%.*s", (int)(p2 - p1), p1);
+
+    if(isdigit(szItem[0]))
+    {
+      lFirst = lLast = strtol(szItem, &pEnd, 10);
+
+      if(*pEnd == '-' && !pEnd[1]) // to the end
+      {
+        lLast = LONG_MAX;
+        pEnd++;
+      }
+      else if(*pEnd == '-')
+      {
+        lLast = strtol(pEnd + 1, &pEnd, 10);
+      }
+
+      if(!*pEnd) // a number or a range (otherwise it's a name that starts with a digit)
+      {
+        if(pE->iSeq >= lFirst && pE->iSeq <= lLast)
+          return 1;
+
+        continue;
+      }
+    }
+
+    if(!fnmatch(szItem, tbuf, FNM_CASEFOLD))
+      return 1;
+  }
+
+  return 0;
+}
+
+// writes a new tape with the index entries in 'piEntries' (all of the sections of
+// each file), renumbered from 1.  Returns the number of files, or -1.
+static int split_write_tape(int iInFD, const TAPE_INDEX *pI, const int *piEntries, int nEntries,
+                            const char *szOutput, int iDriveSize, const char *szLabel, int cbHeadroom)
 {
-  1,
-  1 + 31,
-  1 + 31 + 29,
-  1 + 31 + 29 + 31,
-  1 + 31 + 29 + 31 + 30,
-  1 + 31 + 29 + 31 + 30 + 31,
-  1 + 31 + 29 + 31 + 30 + 31 + 30,
-  1 + 31 + 29 + 31 + 30 + 31 + 30 + 31,
-  1 + 31 + 29 + 31 + 30 + 31 + 30 + 31 + 31,
-  1 + 31 + 29 + 31 + 30 + 31 + 30 + 31 + 31 + 30,
-  1 + 31 + 29 + 31 + 30 + 31 + 30 + 31 + 31 + 30 + 31,
-  1 + 31 + 29 + 31 + 30 + 31 + 30 + 31 + 31 + 30 + 31 + 30,
-  1 + 31 + 29 + 31 + 30 + 31 + 30 + 31 + 31 + 30 + 31 + 30 + 31
-};
+FILE *pOut;
+const TAPE_INDEX_ENTRY *pE;
+int i1, nSeq = 0, iRval = -1;
+off_t lOut = 520, cb1;
 
-int days_since_year_start(int iYear, int iMonth, int iDay)
+  pOut = fopen(szOutput, "w+");
+
+  if(!pOut)
+  {
+    fprintf(stderr, "Unable to open tape file \"%s\", errno=%d (%xH)\n", szOutput, errno, errno);
+    return -1;
+  }
+
+  if(do_initialize_tape(pOut, szOutput, 0, szLabel) || fflush(pOut))
+    goto the_exit_point;
+
+  for(i1=0; i1 < nEntries; i1++)
+  {
+    pE = pI->pEntries + piEntries[i1];
+
+    if(!i1 || pE->iSeq != pI->pEntries[piEntries[i1 - 1]].iSeq) // not the next section
+      nSeq++;
+
+    cb1 = merge_copy_file(iInFD, pE, fileno(pOut), lOut, nSeq);
+
+    if(cb1 < 0)
+      goto the_exit_point;
+
+    lOut += cb1;
+  }
+
+  if(merge_end_tape(fileno(pOut), szOutput, lOut, iDriveSize, cbHeadroom) >= 0)
+    iRval = nSeq;
+
+the_exit_point:
+  fclose(pOut);
+
+  if(iRval < 0)
+    unlink(szOutput);
+
+  return iRval;
+}
+
+// copies the files on 'szTapeFile' that 'szSelect' picks to the new tape 'szOutput', or
+// when 'szOutput' is a directory, each of them to its own tape 'NAME.EXT.tap' there
+// (if a name is on the tape more than once, the last one is used)
+int split_tape(const char *szTapeFile, const char *szSelect, const char *szOutput,
+               int bOverwrite, int bConfirm, int iDriveSize, const char *szLabel, int cbHeadroom)
 {
-const short *pD;
+TAPE_INDEX ti;
+struct stat st, stOut;
+int i1, i2, iFD, nSelected = 0, nTapes = 0, iRval = -1;
+int *piEntries = NULL;
+char tbuf[32], szPath[PATH_MAX];
+int bDirectory = IsDirectory(szOutput);
 
-  if((iYear % 400) == 0 ||
-     ((iYear % 4) == 0 && (iYear % 100) != 0)) // leap year
+  memset(&ti, 0, sizeof(ti));
+
+  iFD = open(szTapeFile, O_RDONLY);
+
+  if(iFD < 0 || fstat(iFD, &st))
   {
-    pD = aDaysLeap;
+    fprintf(stderr, "Unable to open tape file \"%s\", errno=%d (%xH)\n", szTapeFile, errno, errno);
+    goto the_exit_point;
   }
-  else
+
+  if(!bDirectory && !stat(szOutput, &stOut) && st.st_dev == stOut.st_dev && st.st_ino == stOut.st_ino)
   {
-    pD = aDays;
+    fprintf(stderr, "ERROR - \"%s\" can not be split into itself\n", szTapeFile);
+    goto the_exit_point;
+  }
+
+  if(tape_index_scan(iFD, &ti))
+  {
+    fprintf(stderr, "ERROR - \"%s\" is not a tape file, or it's damaged\n", szTapeFile);
+    goto the_exit_point;
+  }
+
+  piEntries = (int *)malloc(sizeof(*piEntries) * (ti.nEntries + 1));
+
+  if(!piEntries)
+    goto the_exit_point;
+
+  for(i1=0; i1 < ti.nEntries; i1++)
+  {
+    if(split_is_selected(szSelect, ti.pEntries + i1))
+      piEntries[nSelected++] = i1;
+  }
+
+  if(!nSelected)
+  {
+    fprintf(stderr, "NO FILES MATCH \"%s\"\n", szSelect);
+    iRval = 1;
+    goto the_exit_point;
+  }
+
+  iRval = 0;
+
+  if(!bDirectory)
+  {
+    if(FileExists(szOutput) && !bOverwrite && bConfirm && !QueryYesNo("Overwrite tape file"))
+      goto the_exit_point;
+
+    i1 = split_write_tape(iFD, &ti, piEntries, nSelected, szOutput, iDriveSize, szLabel, cbHeadroom);
+
+    if(i1 < 0)
+      iRval = -1;
+    else
+      printf("\"%s\" %d files\n", szOutput, i1);
+
+    goto the_exit_point;
+  }
+
+  // a tape for each file, with all of its sections
+
+  for(i1=0; i1 < nSelected; i1 = i2)
+  {
+    for(i2=i1 + 1; i2 < nSelected && ti.pEntries[piEntries[i2]].iSeq == ti.pEntries[piEntries[i1]].iSeq; i2++)
+      ;
+
+    make_output_file_name(ti.pEntries[piEntries[i1]].szIdentifier, tbuf, sizeof(tbuf));
+
+    if(ti.pEntries[tape_index_find(&ti, tbuf, ti.nEntries)].iSeq != ti.pEntries[piEntries[i1]].iSeq)
+      continue; // there's a newer one
+
+    snprintf(szPath, sizeof(szPath), "%s/%s.tap", szOutput, tbuf);
+
+    if(FileExists(szPath) && !bOverwrite && bConfirm && !QueryYesNo("Overwrite tape file"))
+      continue;
+
+    if(split_write_tape(iFD, &ti, piEntries + i1, i2 - i1, szPath, iDriveSize, szLabel, cbHeadroom) < 0)
+      iRval = -1;
+    else
+      nTapes++;
+
+    if(iVerbosity > 0)
+      fprintf(stderr, "  %s\n", szPath);
   }
 
-  if(iMonth >= 1 && iMonth <= 12)
-    return pD[iMonth - 1] + iDay - 1;
+  printf("%d tapes written to \"%s\"\n", nTapes, szOutput);
+
+the_exit_point:
+  if(iFD >= 0)
+    close(iFD);
+
+  if(piEntries)
+    free(piEntries);
+
+  tape_index_free(&ti);
+
+  return iRval;
+}
+
+
+// READ AFTER WRITE VERIFY
+//
+// With '-w', each file is read back from the tape file after it's written, and compared
+// to the host file it came from (or for a text file, which is converted as it's written,
+// to a hash of the converted data).  That's done by a second thread, so the files are
+// checked while the next ones are being written.  A file is only handed to that thread
+// once it's committed (see 'commit_tape_files()'), since until then it isn't on the tape.
+// The records are read with 'mmap()', which only looks at the part of the tape that's
+// done, so the stdio buffer of the thread that's writing doesn't matter.
+
+#define VERIFY_BUFSIZE (256 * 1024) /* host file data read at a time */
+
+typedef struct _VERIFY_FILE_
+{
+  struct _VERIFY_FILE_ *pNext;
+  off_t lStart, lEnd;      // HDR1 through the data marker after the (last) EOF1
+  uint64_t qwTextHash;     // hash of the converted data for a text file, 0 otherwise
+  char szFileName[1];      // the host file (allocated with the rest of it)
+} VERIFY_FILE;
+
+struct _VERIFY_ // typedef'd as VERIFY
+{
+  pthread_t thread;
+  pthread_mutex_t mutex;   // protects everything up to 'nFiles'
+  pthread_cond_t cond;     // signaled when there's a file to check, or it's done
+  VERIFY_FILE *pFirst, *pLast;
+  int bDone;
+  VERIFY_FILE *pPending, *pPendingLast; // written, but not committed yet
+  int iTapeFD;
+  int nFiles, nBad;        // only used by the verify thread until it's finished
+  uint8_t *pBuf;           // VERIFY_BUFSIZE bytes of the host file
+};
+
+static void verify_free_list(VERIFY_FILE *pF)
+{
+VERIFY_FILE *pNext;
 
-  return 0; // an error, really
+  for(; pF; pF = pNext)
+  {
+    pNext = pF->pNext;
+    free(pF);
+  }
 }
 
-void mdy_from_days_since_year_start(int iYear, int nDays, int *piMonth, int *piDay)
+// the next 512 bytes of the host file (zero padded at the end), or NULL at the end of it
+static const uint8_t *verify_next_block(VERIFY *pV, int iFD, off_t lPos, ssize_t *pcbBuf)
 {
-const short *pD;
+ssize_t cbOffset = lPos % VERIFY_BUFSIZE;
 
-  if((iYear % 400) == 0 ||
-     ((iYear % 4) == 0 && (iYear % 100) != 0)) // leap year
+  if(!cbOffset) // time for the next piece of the file
   {
-    pD = aDaysLeap;
+    *pcbBuf = pread(iFD, pV->pBuf, VERIFY_BUFSIZE, lPos);
+
+    if(*pcbBuf < 0)
+      *pcbBuf = 0;
+    else if(*pcbBuf % 512)
+      memset(pV->pBuf + *pcbBuf, 0, 512 - *pcbBuf % 512);
   }
-  else
+
+  return cbOffset < *pcbBuf ? pV->pBuf + cbOffset : NULL;
+}
+
+// checks one file.  Returns 0 if it's the same on the tape.
+static int verify_file(VERIFY *pV, const VERIFY_FILE *pF)
+{
+const uint8_t *p1, *pEnd, *pBlock;
+uint8_t *pMap;
+off_t lMap = pF->lStart - pF->lStart % sysconf(_SC_PAGESIZE), lSource = 0;
+size_t cbMap = pF->lEnd - lMap;
+ssize_t cbBuf = 0;
+uint64_t qwHash = FNV1A_HASH_INIT;
+long long nBlocks;
+int iFD = -1;
+const char *szWhy = NULL;
+char tbuf[16];
+
+  pMap = (uint8_t *)mmap(NULL, cbMap, PROT_READ, MAP_SHARED, pV->iTapeFD, lMap);
+
+  if(pMap == MAP_FAILED)
   {
-    pD = aDays;
+    fprintf(stderr, "VERIFY ERROR - unable to read \"%s\" from the tape, errno=%d (%xH)\n",
+            pF->szFileName, errno, errno);
+
+    return -1;
   }
 
-  for(*piMonth=1; *piMonth < 12; (*piMonth)++) // month is 1-based, as is day in year
+  if(!pF->qwTextHash && (iFD = open(pF->szFileName, O_RDONLY | O_CLOEXEC)) < 0)
   {
-    if(nDays < pD[*piMonth]) // found entry with more days than current one
-      break;
+    szWhy = "can't be opened";
+    goto the_exit_point;
   }
 
-  *piDay = 1 + nDays - pD[*piMonth - 1]; // day is also 1-based
+  p1 = pMap + (pF->lStart - lMap);
+  pEnd = pMap + cbMap;
 
-  if(*piMonth < 1 || *piMonth > 12 || *piDay < 1 || *piDay > 31)
+  while(p1 < pEnd && !szWhy) // each file section (HDR1, data marker, data, data marker, EOF1, data marker)
   {
-    fprintf(stderr, "ERROR - insane month/days from year start:  iYear=%d  nDays=%d  iMonth=%d  iDay=%d\n",
-            iYear, nDays, *piMonth, *piDay);
-  }
-}
+    if(pEnd - p1 < 520 + 4 || !is_tape_record(p1, pEnd - p1, 0) || memcmp(p1 + 4, "HDR1", 4) ||
+       memcmp(p1 + 520, DATA_MARKER, 4))
+    {
+      szWhy = "has a bad file header";
+      break;
+    }
 
-void rt11_date(const char *pDate, int *piYear, int *piDayInYear)
-{
-int iYear, iDay;
+    for(p1 += 520 + 4, nBlocks=0; is_tape_record(p1, pEnd - p1, 0); p1 += 520, nBlocks++)
+    {
+      if(pF->qwTextHash)
+      {
+        qwHash = fnv1a_hash(qwHash, p1 + 4, 512);
+      }
+      else
+      {
+        pBlock = verify_next_block(pV, iFD, lSource, &cbBuf);
 
-  // ignore first character if it's a space, otherwise # of years since 1900
-  // format the date from the following information:
-  //
-  // YYYddd  where 'YYY' is years since 1900, and 'ddd' is days since Jan 1 (inclusive)
+        if(!pBlock)
+        {
+          szWhy = "is longer on the tape";
+          break;
+        }
 
-  if(*pDate >= '0' && *pDate <= '9')
-    iYear = 1900 + 100 * (*pDate - '0');
-  else
-    iYear = 1900;
+        if(memcmp(pBlock, p1 + 4, 512))
+        {
+          szWhy = "is different on the tape";
+          break;
+        }
 
-  iYear += 10 * (pDate[1] - '0') + (pDate[2] - '0');
+        lSource += 512;
+      }
+    }
 
-  iDay = 100 * (pDate[3] - '0')
-       + 10 * (pDate[4] - '0')
-       + (pDate[5] - '0');
+    if(szWhy)
+      break;
 
-  if(iDay < 1 || iDay > 366)
-  {
-    fprintf(stderr, "ERROR - insane 'day' value: \"%s\" --> iYear=%d, iDay=%d\n",
-            pDate, iYear, iDay);
-  }
+    if(pEnd - p1 < 4 + 520 + 4 || memcmp(p1, DATA_MARKER, 4) || !is_tape_record(p1, pEnd - p1, 4) ||
+       memcmp(p1 + 8, "EOF1", 4) || memcmp(p1 + 524, DATA_MARKER, 4))
+    {
+      szWhy = "has a bad EOF1";
+      break;
+    }
 
-  if(piYear)
-    *piYear = iYear;
+    memcpy(tbuf, ((const RT11_FILE_EOF *)(p1 + 8))->block_count, 6);
+    tbuf[6] = 0;
 
-  if(piDayInYear)
-    *piDayInYear = iDay;
-}
+    if(atoll(tbuf) != nBlocks)
+      szWhy = "has the wrong block count";
 
-const char *rt11_date_string(const char *pDate)
-{
-int iYear, iDay, iMonth;
-static char szRval[16];
-static const char * const aszMonthNames[13]=
-{
-  "???","Jan","Feb","Mar","Apr","May","Jun","Jul","Aug","Sep","Oct","Nov","Dec"
-};
+    p1 += 4 + 520 + 4;
+  }
 
-  rt11_date(pDate, &iYear, &iDay);
-  mdy_from_days_since_year_start(iYear, iDay, &iMonth, &iDay);
+  if(!szWhy && pF->qwTextHash && qwHash != pF->qwTextHash)
+    szWhy = "is different on the tape";
 
-  if(iDay < 1 || iDay > 30 || iMonth < 1 || iMonth > 12)
+  if(!szWhy && !pF->qwTextHash && verify_next_block(pV, iFD, lSource, &cbBuf))
+    szWhy = "is shorter on the tape";
+
+the_exit_point:
+  if(szWhy)
   {
-    fprintf(stderr, "ERROR - insane dates - \"%s\" --> iYear=%d, iMonth=%d iDay=%d\n",
-            pDate, iYear, iMonth, iDay);
+    if(iFD < 0 && !pF->qwTextHash)
+      fprintf(stderr, "VERIFY ERROR - \"%s\" %s, errno=%d (%xH)\n", pF->szFileName, szWhy, errno, errno);
+    else if(lSource && !pF->qwTextHash)
+      fprintf(stderr, "VERIFY ERROR - \"%s\" %s (block %lld)\n", pF->szFileName, szWhy, (long long)(lSource / 512));
+    else
+      fprintf(stderr, "VERIFY ERROR - \"%s\" %s\n", pF->szFileName, szWhy);
+  }
+  else if(DEBUG_OUTPUT_INFO)
+  {
+    fprintf(stderr, "*INFO* - \"%s\" verified\n", pF->szFileName);
   }
 
-  snprintf(szRval, sizeof(szRval), "%02d-%s-%02d",
-           (iDay % 100),
-           aszMonthNames[iMonth], // 1-based month
-           (iYear % 100));
+  if(iFD >= 0)
+    close(iFD);
 
-  return szRval;
-}
+  munmap(pMap, cbMap);
 
+  return szWhy ? 1 : 0;
+}
 
-void format_rt11_file_name(const char *szSourceFile, char *pBuf, int cbBuf)
+static void *verify_thread(void *pArg)
 {
-int i1;
-const char *p1c;
-char *p1, *p2;
-char tbuf[64];
-char name[7];
-char ext[4];
+VERIFY *pV = (VERIFY *)pArg;
+VERIFY_FILE *pF;
 
-  memset(tbuf, 0, sizeof(tbuf));
+  while(1)
+  {
+    pthread_mutex_lock(&(pV->mutex));
 
-  // the filename must be a 6.3 name, upper case.
-  p1c = strrchr(szSourceFile, '/'); // if it has a directory in it, find the '/'
-  if(p1c)
-    p1c++;
-  else
-    p1c = szSourceFile;
+    while(!pV->pFirst && !pV->bDone)
+      pthread_cond_wait(&(pV->cond), &(pV->mutex));
 
-  memset(tbuf, 0, sizeof(tbuf));
-  memset(name, 0, sizeof(name));
-  memset(ext, 0, sizeof(ext));
+    pF = pV->pFirst;
 
-  strncpy(tbuf, p1c, sizeof(tbuf)-1);
+    if(pF)
+      pV->pFirst = pF->pNext;
 
-  // convert to upper case.  Name must be RAD50 char, 0-9 A-Z $ ? or space,
-  // in the format NNNNNN.EEE  with trailing white space to justify
+    pthread_mutex_unlock(&(pV->mutex));
 
-  p1 = tbuf;
-  while(*p1 && *p1 != '.')
-  {
-    char c1 = toupper(*p1);
-    if((c1 < '0' && c1 > '9') &&
-       (c1 < 'A' && c1 > 'Z') &&
-       (c1 != '$' && c1 != '?' && c1 != ' '))
-    {
-      c1 = '?'; // sub in '?' for bad chars
-    }
+    if(!pF)
+      break; // done
 
-    *(p1++) = c1;
+    pV->nFiles++;
+
+    if(verify_file(pV, pF))
+      pV->nBad++;
+
+    free(pF);
   }
 
-  i1 = p1 - tbuf;
-  if(i1 > 6)
-    i1 = 6;
+  return NULL;
+}
 
-  if(i1 > 0)
-    memcpy(name, tbuf, i1);
+// starts the verify thread for 'szTapeFile'.  Returns NULL on error.
+VERIFY *verify_start(const char *szTapeFile)
+{
+VERIFY *pV;
 
-  if(i1 < 6)
-    memset(name + i1, ' ', 6 - i1);
+  pV = (VERIFY *)calloc(1, sizeof(*pV));
 
-  name[6] = 0;
+  if(!pV)
+    return NULL;
 
-  if(!*p1)
+  pV->iTapeFD = open(szTapeFile, O_RDONLY | O_CLOEXEC);
+  pV->pBuf = (uint8_t *)malloc(VERIFY_BUFSIZE);
+
+  if(pV->iTapeFD < 0 || !pV->pBuf)
   {
-    fputs("SHIT\n",stderr);
-    p2 = p1;
+    fprintf(stderr, "ERROR - unable to open \"%s\" to verify it, errno=%d (%xH)\n", szTapeFile, errno, errno);
+    goto the_error;
   }
+
+  pthread_mutex_init(&(pV->mutex), NULL);
+  pthread_cond_init(&(pV->cond), NULL);
+
+  if(!pthread_create(&(pV->thread), NULL, verify_thread, pV))
+    return pV;
+
+  fprintf(stderr, "ERROR - unable to start the verify thread\n");
+
+  pthread_cond_destroy(&(pV->cond));
+  pthread_mutex_destroy(&(pV->mutex));
+
+the_error:
+  if(pV->iTapeFD >= 0)
+    close(pV->iTapeFD);
+
+  if(pV->pBuf)
+    free(pV->pBuf);
+
+  free(pV);
+
+  return NULL;
+}
+
+// a file that was just written to the tape, from 'lStart' to the end of tape marker at
+// 'lEnd'.  It's checked after the next 'verify_commit()'.
+int verify_add(VERIFY *pV, const char *szFileName, off_t lStart, off_t lEnd, uint64_t qwTextHash)
+{
+VERIFY_FILE *pF;
+
+  pF = (VERIFY_FILE *)malloc(sizeof(*pF) + strlen(szFileName));
+
+  if(!pF)
+    return -1;
+
+  pF->pNext = NULL;
+  pF->lStart = lStart;
+  pF->lEnd = lEnd;
+  pF->qwTextHash = qwTextHash;
+  strcpy(pF->szFileName, szFileName);
+
+  if(pV->pPendingLast)
+    pV->pPendingLast->pNext = pF;
   else
-  {
-    p1++;
-    p2 = p1;
+    pV->pPending = pF;
 
-//    fprintf(stderr, "    HERE:  \"%s\"\n", p1);
+  pV->pPendingLast = pF;
 
-    while(*p1)
-    {
-      char c1 = toupper(*p1);
-      if((c1 < '0' && c1 > '9') &&
-         (c1 < 'A' && c1 > 'Z') &&
-         (c1 != '$' && c1 != '?' && c1 != ' '))
-      {
-        c1 = '?'; // sub in '?' for bad chars
-      }
+  return 0;
+}
 
-      *(p1++) = c1;
-    }
+// the files that were added are on the tape now (and written to the tape file), so
+// they can be checked
+void verify_commit(VERIFY *pV)
+{
+  if(!pV->pPending)
+    return;
 
-//    fprintf(stderr, "    HERE:  \"%s\" len=%d\n", p2, p1 - p2);
-  }
+  pthread_mutex_lock(&(pV->mutex));
 
-  i1 = p1 - p2;
-  if(i1 > 3)
-    i1 = 3;
+  if(pV->pFirst)
+    pV->pLast->pNext = pV->pPending;
+  else
+    pV->pFirst = pV->pPending;
 
-  if(i1 > 0)
-    memcpy(ext, p2, i1);
+  pV->pLast = pV->pPendingLast;
+  pV->pPending = pV->pPendingLast = NULL;
 
-  if(i1 < 3)
-    memset(ext + i1, ' ', 3 - i1);
+  pthread_cond_signal(&(pV->cond));
+  pthread_mutex_unlock(&(pV->mutex));
+}
 
-  ext[3] = 0;
+// waits for the files that were committed to be checked, and reports how many there
+// were.  Returns 0 if all of them are the same on the tape.
+int verify_finish(VERIFY *pV)
+{
+int iRval;
 
-//  fprintf(stderr, "    TEMPORARY:  %s becomes \"%s.%s\"\n",
-//          szSourceFile, name, ext);
+  pthread_mutex_lock(&(pV->mutex));
+  pV->bDone = 1;
+  pthread_cond_signal(&(pV->cond));
+  pthread_mutex_unlock(&(pV->mutex));
 
-  // format file name into output buffer
+  pthread_join(pV->thread, NULL);
 
-  if(cbBuf > 6)
-  {
-    memcpy(pBuf, name, 6);
-    pBuf += 6;
-    cbBuf -= 6;
-  }
-  else if(cbBuf > 0)
-  {
-    memcpy(pBuf, name, cbBuf);
-    cbBuf = 0;
-  }
+  if(pV->nBad)
+    fprintf(stderr, "** %d OF %d FILES DID NOT VERIFY **\n", pV->nBad, pV->nFiles);
+  else
+    printf("** %d FILES VERIFIED **\n", pV->nFiles);
 
-  if(cbBuf > 0)
-  {
-    *(pBuf++) = '.';
-    cbBuf --;
-  }
+  iRval = pV->nBad ? -26 : 0;
 
-  if(cbBuf > 3)
-  {
-    memcpy(pBuf, ext, 3);
-    pBuf += 3;
-    cbBuf -= 3;
-  }
-  else if(cbBuf > 0)
-  {
-    memcpy(pBuf, ext, cbBuf);
-    cbBuf = 0;
-  }
+  verify_free_list(pV->pPending); // never committed
 
-  if(cbBuf > 0)
-    *pBuf = 0;
+  pthread_cond_destroy(&(pV->cond));
+  pthread_mutex_destroy(&(pV->mutex));
+  close(pV->iTapeFD);
+  free(pV->pBuf);
+  free(pV);
+
+  return iRval;
 }
 
 
@@ -1666,6 +10548,24 @@ struct stat sb;
          S_ISDIR(sb.st_mode);
 }
 
+// a hash of what 'stat()' says about a file that changes whenever it's written - which
+// file it is, its size, and the modification and inode change times to the nanosecond.
+// The size and the modification time in seconds aren't enough, since a tape file is
+// usually the same size after it's written and that can happen in the same second.
+uint64_t stat_fingerprint(const struct stat *pSt)
+{
+int64_t aStat[6];
+
+  aStat[0] = (int64_t)pSt->st_ino;
+  aStat[1] = (int64_t)pSt->st_size;
+  aStat[2] = (int64_t)pSt->st_mtim.tv_sec;
+  aStat[3] = (int64_t)pSt->st_mtim.tv_nsec;
+  aStat[4] = (int64_t)pSt->st_ctim.tv_sec;
+  aStat[5] = (int64_t)pSt->st_ctim.tv_nsec;
+
+  return fnv1a_hash(FNV1A_HASH_INIT, (const uint8_t *)aStat, sizeof(aStat));
+}
+
 // NOTE:  year is returned as YYYY not YY, so subtract 1900 - then 2000 becomes 100, etc.
 int get_file_RT11_date_time(const char *szFileName, int *pnRTYear, int *pnRTDay)
 {
@@ -1702,30 +10602,65 @@ time_t tmFile;
   return 0;
 }
 
-int set_file_RT11_date_time(const char *szFileName, int nRTYear, int nRTDay)
+// convert an RT11 date to a 'time_t' (midnight, local time).  Files on a tape
+// tend to have the same dates, so the last one is cached to avoid 'mktime()'
+time_t rt11_date_to_time(int nRTYear, int nRTDay)
 {
-struct timeval tms[2];
 struct tm tm1;
 int iMonth, iDay;
+static int nLastYear = -1, nLastDay = -1;
+static time_t tmLast = 0;
 
 
+  if(nRTYear == nLastYear && nRTDay == nLastDay)
+    return tmLast;
+
   mdy_from_days_since_year_start(nRTYear, nRTDay, &iMonth, &iDay);
 
   memset(&tm1, 0, sizeof(tm1));
   tm1.tm_mday = iDay;
   tm1.tm_mon = iMonth - 1;
   tm1.tm_year = nRTYear - 1900;
+  tm1.tm_isdst = -1;
+
+  tmLast = mktime(&tm1);
+  nLastYear = nRTYear;
+  nLastDay = nRTDay;
+
+  return tmLast;
+}
+
+int set_file_RT11_date_time(const char *szFileName, int nRTYear, int nRTDay)
+{
+struct timeval tms[2];
+
 
   memset(tms, 0, sizeof(tms));
-  tms[0].tv_sec = tms[1].tv_sec = mktime(&tm1);
+  tms[0].tv_sec = tms[1].tv_sec = rt11_date_to_time(nRTYear, nRTDay);
 
   if(DEBUG_OUTPUT_CHATTY)
-    fprintf(stderr, "File:  \"%s\" - set RT11 date %d.%d %04d-%02d-%02d  %ld\n",
-            szFileName, nRTYear, nRTDay, nRTYear, iMonth, iDay, tms[0].tv_sec);
+    fprintf(stderr, "File:  \"%s\" - set RT11 date %d.%d  %ld\n",
+            szFileName, nRTYear, nRTDay, (long)tms[0].tv_sec);
 
   return utimes(szFileName, &(tms[0]));
 }
 
+// same as 'set_file_RT11_date_time()' but for an open file, no path lookup
+int set_fd_RT11_date_time(int iFD, int nRTYear, int nRTDay)
+{
+struct timespec tms[2];
+
+
+  memset(tms, 0, sizeof(tms));
+  tms[0].tv_sec = tms[1].tv_sec = rt11_date_to_time(nRTYear, nRTDay);
+
+  if(DEBUG_OUTPUT_CHATTY)
+    fprintf(stderr, "File:  fd %d - set RT11 date %d.%d  %ld\n",
+            iFD, nRTYear, nRTDay, (long)tms[0].tv_sec);
+
+  return futimens(iFD, tms);
+}
+
 typedef struct __DIRLIST__
 {
   const char *szPath, *szNameSpec;
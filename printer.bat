@@ -8,5 +8,6 @@ detach LPT
 attach LPT %1
 echo
 echo Don't forget to detach LPT to flush the buffers
+echo or use '"dectape -F %1 directory"' from the host to follow the output
 echo
 